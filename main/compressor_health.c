@@ -0,0 +1,306 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "compressor_health.h"
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "stor.h"
+
+#include "utils.h"
+
+static const char *TAG = "COMPRESSOR";
+
+#define COMPRESSOR_STORE "compressor"
+#define BASELINE_KEY "baseline"
+#define BASELINE_RUNS_KEY "baseline_runs"
+
+#define TOP_BAND_PERCENT 20          // the top band is the upper 20% of the low..high marks range
+#define MIN_TOP_BAND_TIME_MS 2000    // shorter top band crossings are too noisy to get a rate from
+#define MIN_RUN_TIME_MS 5000         // shorter runs are not summarized into the health score
+#define RECENT_RUNS_COUNT 3          // runs averaged to get the current top fill rate
+#define BASELINE_SEED_RUNS 4         // runs averaged before the baseline starts rolling
+#define BASELINE_EWMA_SHIFT 4        // rolling baseline follows every new run by 1/16
+#define DEGRADATION_WARNING_LEVEL 25 // %
+
+typedef struct run_tracker
+{
+  bool running;
+  bool in_top_band;
+  int64_t started_at_us;
+  int64_t top_entered_at_us;
+  int64_t top_last_at_us;
+  pressure_value_t top_entered_pressure;
+  pressure_value_t top_last_pressure;
+  compressor_run_t run;
+} run_tracker_t;
+
+/*
+  Declarations
+*/
+static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void relay_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+static void start_run(int64_t now_us);
+static void track_run(int64_t now_us, pressure_value_t pressure);
+static void finish_run(int64_t now_us);
+static void store_run(const compressor_run_t *run);
+static void update_health(const compressor_run_t *run);
+static int32_t calc_rate(pressure_value_t from, pressure_value_t to, int64_t duration_us);
+
+static uint8_t controlled_relay_index;
+static uint8_t controlled_sensor_index;
+static pressure_value_t top_band_start;
+static pressure_value_t high_mark;
+static portMUX_TYPE marks_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static pressure_value_t last_pressure = PRESSURE_SENSOR_ABSENT;
+static run_tracker_t tracker;
+
+static compressor_run_t runs[COMPRESSOR_RUNS_COUNT];
+static uint8_t runs_head;
+static uint8_t runs_count;
+
+static compressor_health_t health;
+static int32_t baseline_runs;
+
+static SemaphoreHandle_t health_lock;
+
+void compressor_health_start(uint8_t relay_index, uint8_t pressure_sensor_index, pressure_value_t low_mark, pressure_value_t pressure_high_mark)
+{
+  health_lock = xSemaphoreCreateMutex();
+  ESP_MEM_CHECK(TAG, health_lock, abort());
+
+  controlled_relay_index  = relay_index;
+  controlled_sensor_index = pressure_sensor_index;
+
+  compressor_health_set_marks(low_mark, pressure_high_mark);
+
+  health.baseline_top_fill_rate = stor_get_i32(COMPRESSOR_STORE, BASELINE_KEY, 0);
+  baseline_runs                 = stor_get_i32(COMPRESSOR_STORE, BASELINE_RUNS_KEY, 0);
+
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_VALUE_CHANGED, pressure_sensor_update_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAYS_EVENTS, ESP_EVENT_ANY_ID, relay_update_handler, NULL, NULL);
+
+  ESP_LOGI(TAG, "Tracking relay #%d by sensor #%d, top band: %d..%d Pa, baseline: %d Pa/s (%d runs)",
+           relay_index, pressure_sensor_index, top_band_start, high_mark,
+           health.baseline_top_fill_rate, baseline_runs);
+}
+
+// The baseline is kept: it was learned on the old top band, runs against the new one pull it over
+void compressor_health_set_marks(pressure_value_t low_mark, pressure_value_t pressure_high_mark)
+{
+  portENTER_CRITICAL(&marks_lock);
+  high_mark      = pressure_high_mark;
+  top_band_start = pressure_high_mark - (pressure_high_mark - low_mark) * TOP_BAND_PERCENT / 100;
+  portEXIT_CRITICAL(&marks_lock);
+}
+
+void compressor_health_get(compressor_health_t *out)
+{
+  xSemaphoreTake(health_lock, portMAX_DELAY);
+  *out = health;
+  xSemaphoreGive(health_lock);
+}
+
+size_t compressor_health_get_runs(compressor_run_t *out, size_t max_count)
+{
+  xSemaphoreTake(health_lock, portMAX_DELAY);
+
+  size_t count = runs_count < max_count ? runs_count : max_count;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = runs[(runs_head + COMPRESSOR_RUNS_COUNT - 1 - i) % COMPRESSOR_RUNS_COUNT];
+  }
+
+  xSemaphoreGive(health_lock);
+
+  return count;
+}
+
+static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  sensor_pressure_t *sensor = (sensor_pressure_t *)event_data;
+
+  if (sensor->index != controlled_sensor_index)
+    return;
+
+  if (sensor->pressure < 0)
+  {
+    if (tracker.running)
+      tracker.run.flags |= RUN_SENSOR_FAULT;
+
+    return;
+  }
+
+  last_pressure = sensor->pressure;
+
+  if (tracker.running)
+    track_run(esp_timer_get_time(), sensor->pressure);
+}
+
+static void relay_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  uint8_t relay_index = *(uint8_t *)event_data;
+
+  if (relay_index != controlled_relay_index)
+    return;
+
+  if (event_id == RELAY_TURNED_ON && !tracker.running)
+  {
+    start_run(esp_timer_get_time());
+  }
+  else if (event_id == RELAY_TURNED_OFF && tracker.running)
+  {
+    finish_run(esp_timer_get_time());
+  }
+}
+
+static void start_run(int64_t now_us)
+{
+  memset(&tracker, 0, sizeof(tracker));
+
+  tracker.running            = true;
+  tracker.started_at_us      = now_us;
+  tracker.run.started_at_s   = now_us / 1000000;
+  tracker.run.start_pressure = last_pressure;
+  tracker.run.end_pressure   = last_pressure;
+
+  if (last_pressure < 0)
+    tracker.run.flags |= RUN_SENSOR_FAULT;
+  else
+    track_run(now_us, last_pressure);
+}
+
+// Only the edges of the fill curve are kept: the run start and the first\last samples inside the top band
+static void track_run(int64_t now_us, pressure_value_t pressure)
+{
+  tracker.run.end_pressure = pressure;
+
+  portENTER_CRITICAL(&marks_lock);
+  pressure_value_t band_start = top_band_start;
+  pressure_value_t band_end   = high_mark;
+  portEXIT_CRITICAL(&marks_lock);
+
+  if (pressure > band_end)
+    tracker.run.flags |= RUN_HIGH_MARK_REACHED;
+
+  if (pressure >= band_start && !tracker.in_top_band)
+  {
+    tracker.in_top_band          = true;
+    tracker.top_entered_at_us    = now_us;
+    tracker.top_entered_pressure = pressure;
+  }
+
+  if (tracker.in_top_band)
+  {
+    tracker.top_last_at_us    = now_us;
+    tracker.top_last_pressure = pressure;
+  }
+}
+
+static void finish_run(int64_t now_us)
+{
+  compressor_run_t *run = &tracker.run;
+
+  tracker.running  = false;
+  run->duration_ms = (now_us - tracker.started_at_us) / 1000;
+
+  if (run->start_pressure >= 0)
+    run->avg_fill_rate = calc_rate(run->start_pressure, run->end_pressure, now_us - tracker.started_at_us);
+
+  if (tracker.in_top_band && (tracker.top_last_at_us - tracker.top_entered_at_us) >= MIN_TOP_BAND_TIME_MS * 1000)
+  {
+    run->top_fill_rate = calc_rate(tracker.top_entered_pressure, tracker.top_last_pressure, tracker.top_last_at_us - tracker.top_entered_at_us);
+    run->flags |= RUN_TOP_BAND_REACHED;
+  }
+
+  xSemaphoreTake(health_lock, portMAX_DELAY);
+  store_run(run);
+  if (run->duration_ms >= MIN_RUN_TIME_MS)
+    update_health(run);
+  xSemaphoreGive(health_lock);
+
+  ESP_LOGI(TAG, "Run: %d ms, %d -> %d Pa, avg: %d Pa/s, top: %d Pa/s, flags: 0x%02x, degradation: %d%%",
+           run->duration_ms, run->start_pressure, run->end_pressure,
+           run->avg_fill_rate, run->top_fill_rate, run->flags, health.degradation);
+
+  if ((run->flags & RUN_HIGH_MARK_REACHED) == 0 && (run->flags & RUN_SENSOR_FAULT) == 0)
+    ESP_LOGW(TAG, "The run has not reached the high mark");
+
+  if (health.degradation >= DEGRADATION_WARNING_LEVEL)
+    ESP_LOGW(TAG, "Compressor fills %d%% slower near the high mark than its baseline", health.degradation);
+}
+
+static void store_run(const compressor_run_t *run)
+{
+  runs[runs_head] = *run;
+  runs_head       = (runs_head + 1) % COMPRESSOR_RUNS_COUNT;
+
+  if (runs_count < COMPRESSOR_RUNS_COUNT)
+    runs_count++;
+
+  health.runs_total++;
+}
+
+static void update_health(const compressor_run_t *run)
+{
+  if ((run->flags & RUN_TOP_BAND_REACHED) == 0 || (run->flags & RUN_SENSOR_FAULT) != 0)
+    return;
+
+  // recent rate: mean of the last valid runs, the current one included
+  int64_t sum   = 0;
+  uint8_t valid = 0;
+
+  for (uint8_t i = 0; i < runs_count && valid < RECENT_RUNS_COUNT; i++)
+  {
+    const compressor_run_t *r = &runs[(runs_head + COMPRESSOR_RUNS_COUNT - 1 - i) % COMPRESSOR_RUNS_COUNT];
+
+    if ((r->flags & RUN_TOP_BAND_REACHED) != 0 && (r->flags & RUN_SENSOR_FAULT) == 0)
+    {
+      sum += r->top_fill_rate;
+      valid++;
+    }
+  }
+
+  health.recent_top_fill_rate = sum / valid;
+
+  // the score is computed against the baseline before the run is folded into it
+  if (baseline_runs >= BASELINE_SEED_RUNS && health.baseline_top_fill_rate > 0 &&
+      health.recent_top_fill_rate < health.baseline_top_fill_rate)
+  {
+    int32_t lag        = health.baseline_top_fill_rate - health.recent_top_fill_rate;
+    health.degradation = lag >= health.baseline_top_fill_rate ? 100 : lag * 100 / health.baseline_top_fill_rate;
+  }
+  else
+  {
+    health.degradation = 0;
+  }
+
+  if (baseline_runs < BASELINE_SEED_RUNS)
+  {
+    health.baseline_top_fill_rate = ((int64_t)health.baseline_top_fill_rate * baseline_runs + run->top_fill_rate) / (baseline_runs + 1);
+    baseline_runs++;
+  }
+  else
+  {
+    health.baseline_top_fill_rate += (run->top_fill_rate - health.baseline_top_fill_rate) >> BASELINE_EWMA_SHIFT;
+  }
+
+  stor_set_i32(COMPRESSOR_STORE, BASELINE_KEY, health.baseline_top_fill_rate);
+  stor_set_i32(COMPRESSOR_STORE, BASELINE_RUNS_KEY, baseline_runs);
+}
+
+static int32_t calc_rate(pressure_value_t from, pressure_value_t to, int64_t duration_us)
+{
+  if (duration_us <= 0)
+    return 0;
+
+  return (int64_t)(to - from) * 1000000 / duration_us;
+}
@@ -0,0 +1,44 @@
+#ifndef _COMPRESSOR_HEALTH_H_
+#define _COMPRESSOR_HEALTH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pressure_sensors.h"
+
+#define COMPRESSOR_RUNS_COUNT 32
+
+enum compressor_run_flags
+{
+  RUN_TOP_BAND_REACHED = 0x01, // pressure got into the top band, top_fill_rate is valid
+  RUN_HIGH_MARK_REACHED = 0x02,
+  RUN_SENSOR_FAULT = 0x04 // sensor reported absent\overload during the run
+};
+
+// One compressor run summary, built incrementally while the relay is ON
+typedef struct compressor_run
+{
+  uint32_t started_at_s; // since boot
+  uint32_t duration_ms;
+  pressure_value_t start_pressure; // Pa
+  pressure_value_t end_pressure;   // Pa
+  int32_t avg_fill_rate;           // Pa/s over the whole run
+  int32_t top_fill_rate;           // Pa/s inside the top band (just under the high mark)
+  uint8_t flags;
+} compressor_run_t;
+
+typedef struct compressor_health
+{
+  uint32_t runs_total;
+  int32_t baseline_top_fill_rate; // Pa/s, 0 until enough runs have been seen
+  int32_t recent_top_fill_rate;   // Pa/s, mean of the last few valid runs
+  uint8_t degradation;            // 0..100 %, how much slower the pump fills near the high mark than its baseline
+} compressor_health_t;
+
+void compressor_health_start(uint8_t relay_index, uint8_t pressure_sensor_index, pressure_value_t low_mark, pressure_value_t pressure_high_mark);
+void compressor_health_set_marks(pressure_value_t low_mark, pressure_value_t pressure_high_mark);
+
+void compressor_health_get(compressor_health_t *health);
+size_t compressor_health_get_runs(compressor_run_t *runs, size_t max_count); // newest first
+
+#endif // _COMPRESSOR_HEALTH_H_
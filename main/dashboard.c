@@ -0,0 +1,87 @@
+#include <stdio.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+
+#include "dashboard.h"
+#include "http_server.h"
+
+static const char *TAG = "DASHBOARD";
+
+#define DASHBOARD_CACHE_REVALIDATE "no-cache"
+#define DASHBOARD_CACHE_IMMUTABLE "public, max-age=31536000, immutable"
+
+/*
+  The embedded files live in the flash mapped into the address space, httpd_resp_send() takes
+  them from there, nothing is copied or allocated per request. There are no uncompressed copies,
+  every browser takes gzip.
+*/
+
+typedef struct web_asset
+{
+  const char *type;
+  const char *cache_control;
+  const uint8_t *start;
+  const uint8_t *end;
+} web_asset_t;
+
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+extern const uint8_t app_js_gz_start[] asm("_binary_app_js_gz_start");
+extern const uint8_t app_js_gz_end[] asm("_binary_app_js_gz_end");
+extern const uint8_t style_css_gz_start[] asm("_binary_style_css_gz_start");
+extern const uint8_t style_css_gz_end[] asm("_binary_style_css_gz_end");
+
+/*
+  Declarations
+*/
+static esp_err_t asset_get_handler(httpd_req_t *req);
+
+static const web_asset_t index_html = {"text/html", DASHBOARD_CACHE_REVALIDATE, index_html_gz_start, index_html_gz_end};
+static const web_asset_t app_js     = {"application/javascript", DASHBOARD_CACHE_IMMUTABLE, app_js_gz_start, app_js_gz_end};
+static const web_asset_t style_css  = {"text/css", DASHBOARD_CACHE_IMMUTABLE, style_css_gz_start, style_css_gz_end};
+
+static const httpd_uri_t endpoints[] = {
+    {.uri = "/", .method = HTTP_GET, .handler = asset_get_handler, .user_ctx = (void *)&index_html},
+    {.uri = "/app.js", .method = HTTP_GET, .handler = asset_get_handler, .user_ctx = (void *)&app_js},
+    {.uri = "/style.css", .method = HTTP_GET, .handler = asset_get_handler, .user_ctx = (void *)&style_css}};
+
+// of the firmware, the page changes with it only
+static char etag[HTTP_SERVER_ETAG_SIZE];
+
+void dashboard_start()
+{
+  const uint8_t *sha = esp_ota_get_app_description()->app_elf_sha256;
+
+  snprintf(etag, sizeof(etag), "\"%02x%02x%02x%02x\"", sha[0], sha[1], sha[2], sha[3]);
+
+  for (uint8_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++)
+    http_server_register(&endpoints[i]);
+
+  ESP_LOGI(TAG, "Started, %d bytes of gzipped assets",
+           (index_html_gz_end - index_html_gz_start) + (app_js_gz_end - app_js_gz_start) + (style_css_gz_end - style_css_gz_start));
+}
+
+static esp_err_t asset_get_handler(httpd_req_t *req)
+{
+  const web_asset_t *asset = (const web_asset_t *)req->user_ctx;
+
+  httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+
+  if (asset == &index_html)
+  {
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    if (http_server_etag_matches(req, etag))
+    {
+      httpd_resp_set_status(req, "304 Not Modified");
+      return httpd_resp_send(req, NULL, 0);
+    }
+  }
+
+  httpd_resp_set_type(req, asset->type);
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+
+  return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
+}
@@ -0,0 +1,17 @@
+#ifndef _DASHBOARD_H_
+#define _DASHBOARD_H_
+
+/*
+  Web dashboard at /: live gauges and trends of the sensors, the relays and the controller
+  settings. The page takes everything from the /api/v1/stream WebSocket, it doesn't poll.
+
+  The assets are in main/web, gzipped at build time by tools/web_assets.py and embedded in the
+  firmware. They are sent from the flash as they are, with Content-Encoding: gzip. index.html is
+  revalidated by the firmware ETag. It refers to the other assets by their content hash, and
+  those are cached for a year.
+*/
+
+// Call after http_server_start()
+void dashboard_start();
+
+#endif // _DASHBOARD_H_
@@ -0,0 +1,281 @@
+#include <string.h>
+
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/spi_master.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "display.h"
+#include "utils.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+#include "lvgl_helpers.h"
+
+static const char *TAG = "DISPLAY";
+
+/*
+  LVGL renders into one buffer while the other one is clocked out by the SPI DMA.
+  A flush only queues transactions and returns, lv_disp_flush_ready() is called from
+  the post transfer interrupt of the last one.
+*/
+
+// the bus, clock and mode of the driver, the ST7789 wants mode 2 and a wrong one garbles it
+#ifdef CONFIG_LVGL_TFT_DISPLAY_SPI_HSPI
+#define DISPLAY_SPI_HOST HSPI_HOST
+#else
+#define DISPLAY_SPI_HOST VSPI_HOST
+#endif
+#define DISPLAY_SPI_CLOCK_HZ SPI_TFT_CLOCK_SPEED_HZ
+#define DISPLAY_SPI_MODE SPI_TFT_SPI_MODE
+#ifdef CONFIG_LVGL_DISPLAY_USE_SPI_CS
+#define DISPLAY_CS_PIN CONFIG_LVGL_DISP_SPI_CS
+#else
+#define DISPLAY_CS_PIN -1
+#endif
+#define DISPLAY_DC_PIN CONFIG_LVGL_DISP_PIN_DC
+
+#define DISPLAY_BUFFER_SIZE (LV_HOR_RES_MAX * CONFIG_DISPLAY_BUFFER_LINES)
+#define DISPLAY_MAX_TRANSFER (DISP_BUF_SIZE * sizeof(lv_color_t)) // the bus is set up by lvgl_driver_init() for that
+#define DISPLAY_MAX_CHUNKS ((DISPLAY_BUFFER_SIZE * sizeof(lv_color_t) + DISPLAY_MAX_TRANSFER - 1) / DISPLAY_MAX_TRANSFER)
+#define DISPLAY_WINDOW_TRANSACTIONS 5 // CASET, RASET with their data and RAMWR
+#define DISPLAY_MAX_TRANSACTIONS (DISPLAY_WINDOW_TRANSACTIONS + DISPLAY_MAX_CHUNKS)
+
+#define DISPLAY_BCKL_PIN CONFIG_LVGL_DISP_PIN_BCKL
+#define BACKLIGHT_LEDC_MODE LEDC_LOW_SPEED_MODE
+#define BACKLIGHT_LEDC_TIMER LEDC_TIMER_0
+#define BACKLIGHT_LEDC_CHANNEL LEDC_CHANNEL_0
+#define BACKLIGHT_LEDC_FREQ_HZ 5000
+#define BACKLIGHT_DUTY_MAX ((1 << LEDC_TIMER_10_BIT) - 1)
+
+#define ST7789_SLPIN 0x10
+#define ST7789_SLPOUT 0x11
+#define ST7789_SLPIN_DELAY_MS 5    // before the next command
+#define ST7789_SLPOUT_DELAY_MS 120 // till the panel shows the frame memory again
+#define ST7789_DISPOFF 0x28
+#define ST7789_DISPON 0x29
+#define ST7789_CASET 0x2A
+#define ST7789_RASET 0x2B
+#define ST7789_RAMWR 0x2C
+
+// spi_transaction_t.user flags
+#define TRANS_DATA 0x01
+#define TRANS_FLUSH_END 0x02
+
+/*
+  Declarations
+*/
+static void display_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_map);
+static void IRAM_ATTR spi_pre_transfer_cb(spi_transaction_t *trans);
+static void IRAM_ATTR spi_post_transfer_cb(spi_transaction_t *trans);
+static void queue_command(uint8_t command, const uint8_t *data, uint8_t length);
+static void queue_transaction(spi_transaction_t *trans);
+static void wait_transactions();
+static void backlight_init();
+
+static spi_device_handle_t spi;
+static spi_transaction_t transactions[DISPLAY_MAX_TRANSACTIONS];
+static uint8_t transactions_queued;
+
+static lv_disp_drv_t *flushing_drv;
+static lv_disp_buf_t disp_buf;
+
+#ifdef CONFIG_DISPLAY_BUFFER_STATIC
+static DMA_ATTR lv_color_t buf1[DISPLAY_BUFFER_SIZE];
+#ifdef CONFIG_DISPLAY_DOUBLE_BUFFER
+static DMA_ATTR lv_color_t buf2[DISPLAY_BUFFER_SIZE];
+#endif
+#endif
+
+void display_init(lv_disp_drv_t *disp_drv)
+{
+  lv_color_t *first = NULL, *second = NULL;
+
+#ifdef CONFIG_DISPLAY_BUFFER_STATIC
+  first = buf1;
+#ifdef CONFIG_DISPLAY_DOUBLE_BUFFER
+  second = buf2;
+#endif
+#else
+  first = heap_caps_malloc(DISPLAY_BUFFER_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  ESP_MEM_CHECK(TAG, first, abort());
+#ifdef CONFIG_DISPLAY_DOUBLE_BUFFER
+  second = heap_caps_malloc(DISPLAY_BUFFER_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  ESP_MEM_CHECK(TAG, second, abort());
+#endif
+#endif
+
+  lv_disp_buf_init(&disp_buf, first, second, DISPLAY_BUFFER_SIZE);
+
+  // a device of our own on the bus lvgl_driver_init() has set up, with the settings of its one
+  spi_device_interface_config_t device_config = {
+      .clock_speed_hz = DISPLAY_SPI_CLOCK_HZ,
+      .mode           = DISPLAY_SPI_MODE,
+      .spics_io_num   = DISPLAY_CS_PIN,
+      .flags          = SPI_DEVICE_NO_DUMMY,
+      .queue_size     = DISPLAY_MAX_TRANSACTIONS,
+      .pre_cb         = spi_pre_transfer_cb,
+      .post_cb        = spi_post_transfer_cb};
+
+  ESP_ERROR_CHECK(spi_bus_add_device(DISPLAY_SPI_HOST, &device_config, &spi));
+
+  disp_drv->buffer   = &disp_buf;
+  disp_drv->flush_cb = display_flush;
+
+  backlight_init();
+
+  ESP_LOGI(TAG, "%s %d lines buffer(s) in %s, %d bytes each, %d MHz SPI",
+           second ? "Two" : "One", CONFIG_DISPLAY_BUFFER_LINES,
+#ifdef CONFIG_DISPLAY_BUFFER_STATIC
+           "static DRAM",
+#else
+           "DMA capable heap",
+#endif
+           DISPLAY_BUFFER_SIZE * sizeof(lv_color_t), DISPLAY_SPI_CLOCK_HZ / 1000000);
+}
+
+void display_set_backlight(uint8_t percent)
+{
+  ESP_ERROR_CHECK(ledc_set_duty(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL, BACKLIGHT_DUTY_MAX * percent / 100));
+  ESP_ERROR_CHECK(ledc_update_duty(BACKLIGHT_LEDC_MODE, BACKLIGHT_LEDC_CHANNEL));
+}
+
+void display_sleep()
+{
+  display_set_backlight(0);
+
+  wait_transactions();
+  queue_command(ST7789_DISPOFF, NULL, 0);
+  queue_command(ST7789_SLPIN, NULL, 0);
+  wait_transactions();
+
+  vTaskDelay(pdMS_TO_TICKS(ST7789_SLPIN_DELAY_MS));
+
+  ESP_LOGI(TAG, "Panel asleep");
+}
+
+void display_wake()
+{
+  wait_transactions();
+  queue_command(ST7789_SLPOUT, NULL, 0);
+  queue_command(ST7789_DISPON, NULL, 0);
+  wait_transactions();
+
+  // the frame memory survives the sleep, light it up once the panel shows it
+  vTaskDelay(pdMS_TO_TICKS(ST7789_SLPOUT_DELAY_MS));
+  display_set_backlight(CONFIG_DISPLAY_BACKLIGHT_LEVEL);
+
+  ESP_LOGI(TAG, "Panel awake");
+}
+
+// lvgl_driver_init() drives the backlight pin as a plain GPIO, the LEDC takes it over
+static void backlight_init()
+{
+  ledc_timer_config_t timer_config = {
+      .speed_mode      = BACKLIGHT_LEDC_MODE,
+      .duty_resolution = LEDC_TIMER_10_BIT,
+      .timer_num       = BACKLIGHT_LEDC_TIMER,
+      .freq_hz         = BACKLIGHT_LEDC_FREQ_HZ,
+      .clk_cfg         = LEDC_AUTO_CLK};
+
+  ESP_ERROR_CHECK(ledc_timer_config(&timer_config));
+
+  ledc_channel_config_t channel_config = {
+      .gpio_num   = DISPLAY_BCKL_PIN,
+      .speed_mode = BACKLIGHT_LEDC_MODE,
+      .channel    = BACKLIGHT_LEDC_CHANNEL,
+      .timer_sel  = BACKLIGHT_LEDC_TIMER,
+      .duty       = BACKLIGHT_DUTY_MAX * CONFIG_DISPLAY_BACKLIGHT_LEVEL / 100,
+      .hpoint     = 0};
+
+  ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
+}
+
+static void display_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_map)
+{
+  // LVGL calls flush only after the previous one is ready, its transactions are done by now
+  wait_transactions();
+
+  flushing_drv = disp_drv;
+
+  uint8_t columns[] = {area->x1 >> 8, area->x1 & 0xFF, area->x2 >> 8, area->x2 & 0xFF};
+  uint8_t rows[]    = {area->y1 >> 8, area->y1 & 0xFF, area->y2 >> 8, area->y2 & 0xFF};
+
+  queue_command(ST7789_CASET, columns, sizeof(columns));
+  queue_command(ST7789_RASET, rows, sizeof(rows));
+  queue_command(ST7789_RAMWR, NULL, 0);
+
+  size_t left         = lv_area_get_size(area) * sizeof(lv_color_t);
+  const uint8_t *data = (const uint8_t *)color_map;
+
+  while (left > 0)
+  {
+    size_t chunk           = left > DISPLAY_MAX_TRANSFER ? DISPLAY_MAX_TRANSFER : left;
+    spi_transaction_t *trans = &transactions[transactions_queued];
+
+    memset(trans, 0, sizeof(spi_transaction_t));
+    trans->length    = chunk * 8;
+    trans->tx_buffer = data;
+    trans->user      = (void *)(uintptr_t)(TRANS_DATA | (chunk == left ? TRANS_FLUSH_END : 0));
+
+    queue_transaction(trans);
+
+    data += chunk;
+    left -= chunk;
+  }
+}
+
+static void queue_command(uint8_t command, const uint8_t *data, uint8_t length)
+{
+  spi_transaction_t *trans = &transactions[transactions_queued];
+
+  memset(trans, 0, sizeof(spi_transaction_t));
+  trans->flags      = SPI_TRANS_USE_TXDATA;
+  trans->length     = 8;
+  trans->tx_data[0] = command;
+  trans->user       = (void *)0;
+
+  queue_transaction(trans);
+
+  if (length == 0)
+    return;
+
+  trans = &transactions[transactions_queued];
+
+  memset(trans, 0, sizeof(spi_transaction_t));
+  trans->flags  = SPI_TRANS_USE_TXDATA;
+  trans->length = length * 8;
+  trans->user   = (void *)TRANS_DATA;
+  memcpy(trans->tx_data, data, length);
+
+  queue_transaction(trans);
+}
+
+static void queue_transaction(spi_transaction_t *trans)
+{
+  ESP_ERROR_CHECK(spi_device_queue_trans(spi, trans, portMAX_DELAY));
+  transactions_queued++;
+}
+
+static void wait_transactions()
+{
+  spi_transaction_t *done;
+
+  for (; transactions_queued > 0; transactions_queued--)
+    spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+}
+
+static void IRAM_ATTR spi_pre_transfer_cb(spi_transaction_t *trans)
+{
+  gpio_set_level(DISPLAY_DC_PIN, (uintptr_t)trans->user & TRANS_DATA);
+}
+
+static void IRAM_ATTR spi_post_transfer_cb(spi_transaction_t *trans)
+{
+  if ((uintptr_t)trans->user & TRANS_FLUSH_END)
+    lv_disp_flush_ready(flushing_drv);
+}
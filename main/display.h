@@ -0,0 +1,15 @@
+#ifndef _DISPLAY_H_
+#define _DISPLAY_H_
+
+#include "lvgl/lvgl.h"
+
+// Draw buffers and the asynchronous flush path for the ST7789.
+// The bus and the panel are brought up by lvgl_driver_init(), call it first.
+void display_init(lv_disp_drv_t *disp_drv);
+
+// Power management, GUI task only and never while LVGL is rendering
+void display_set_backlight(uint8_t percent);
+void display_sleep(); // backlight off, panel in SLPIN, frame memory is kept
+void display_wake();
+
+#endif // _DISPLAY_H_
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "gauge.h"
+#include "utils.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+
+static const char *TAG = "GAUGE";
+
+#define GAUGE_SIZE 65
+#define GAUGE_LINES 23
+#define GAUGE_ANGLE 240
+#define GAUGE_START_ANGLE (90 + (360 - GAUGE_ANGLE) / 2)
+#define GAUGE_SCALE_WIDTH LV_DPX(10)
+#define GAUGE_LINE_WIDTH LV_DPX(2)
+#define GAUGE_UNIT_TEXT "kPa"
+#define GAUGE_UNIT_BOTTOM_PAD 2
+
+// the image ext goes first, so the gauge stays a valid lv_img for LVGL
+typedef struct
+{
+  lv_img_ext_t img;
+  uint8_t active_lines;
+} gauge_ext_t;
+
+typedef struct
+{
+  lv_point_t outer;
+  lv_point_t inner;
+  lv_area_t area; // covers the drawn line, relative to the gauge
+} gauge_tick_t;
+
+/*
+  Declarations
+*/
+static void scale_init(lv_obj_t *parent);
+static lv_design_res_t gauge_design(lv_obj_t *gauge, const lv_area_t *clip_area, lv_design_mode_t mode);
+static uint8_t value_to_lines(int32_t value);
+
+static lv_design_cb_t ancestor_design;
+
+static gauge_tick_t ticks[GAUGE_LINES];
+static lv_img_dsc_t scale_img;
+static lv_draw_line_dsc_t active_line_dsc;
+
+lv_obj_t *gauge_create(lv_obj_t *parent)
+{
+  if (scale_img.data == NULL)
+    scale_init(parent);
+
+  lv_obj_t *gauge = lv_img_create(parent, NULL);
+  lv_img_set_src(gauge, &scale_img);
+
+  gauge_ext_t *ext = lv_obj_allocate_ext_attr(gauge, sizeof(gauge_ext_t));
+  ESP_MEM_CHECK(TAG, ext, abort());
+
+  ext->active_lines = 0;
+
+  if (ancestor_design == NULL)
+    ancestor_design = lv_obj_get_design_cb(gauge);
+
+  lv_obj_set_design_cb(gauge, gauge_design);
+
+  return gauge;
+}
+
+void gauge_set_value(lv_obj_t *gauge, int32_t value)
+{
+  gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  uint8_t lines    = value_to_lines(value);
+
+  if (lines == ext->active_lines)
+    return;
+
+  uint8_t from = lines < ext->active_lines ? lines : ext->active_lines;
+  uint8_t to   = lines < ext->active_lines ? ext->active_lines : lines;
+
+  // only the ticks which change color are redrawn, the rest of the gauge stays on the screen
+  lv_area_t area = ticks[from].area;
+
+  for (uint8_t i = from + 1; i < to; i++)
+    _lv_area_join(&area, &area, &ticks[i].area);
+
+  lv_area_t coords;
+  lv_obj_get_coords(gauge, &coords);
+  lv_area_move(&area, coords.x1, coords.y1);
+
+  lv_obj_invalidate_area(gauge, &area);
+
+  ext->active_lines = lines;
+}
+
+// Renders the static part once into the image all the gauges show. The canvas is only a drawing
+// tool, the image outlives it and the screens the gauges are built on.
+static void scale_init(lv_obj_t *parent)
+{
+  lv_color_t *buffer = malloc(LV_CANVAS_BUF_SIZE_TRUE_COLOR(GAUGE_SIZE, GAUGE_SIZE));
+  ESP_MEM_CHECK(TAG, buffer, abort());
+
+  lv_obj_t *scale_canvas = lv_canvas_create(parent, NULL);
+  lv_canvas_set_buffer(scale_canvas, buffer, GAUGE_SIZE, GAUGE_SIZE, LV_IMG_CF_TRUE_COLOR);
+  lv_obj_set_hidden(scale_canvas, true);
+
+  lv_canvas_fill_bg(scale_canvas, lv_obj_get_style_bg_color(parent, LV_OBJ_PART_MAIN), LV_OPA_COVER);
+
+  lv_coord_t center = GAUGE_SIZE / 2;
+  lv_coord_t r_out  = center - GAUGE_LINE_WIDTH / 2;
+  lv_coord_t r_in   = r_out - GAUGE_SCALE_WIDTH;
+
+  // frame
+
+  lv_draw_line_dsc_t line_dsc;
+  lv_draw_line_dsc_init(&line_dsc);
+  line_dsc.color = lv_color_hex3(0xCCC);
+  line_dsc.width = 1;
+
+  lv_canvas_draw_arc(scale_canvas, center, center, r_out, GAUGE_START_ANGLE, GAUGE_START_ANGLE + GAUGE_ANGLE, &line_dsc);
+
+  // inactive scale
+
+  line_dsc.color = lv_color_hex3(0x888);
+  line_dsc.width = GAUGE_LINE_WIDTH;
+
+  for (uint8_t i = 0; i < GAUGE_LINES; i++)
+  {
+    int16_t angle = GAUGE_START_ANGLE + i * GAUGE_ANGLE / (GAUGE_LINES - 1);
+    int32_t sin   = lv_trigo_sin(angle);
+    int32_t cos   = lv_trigo_sin(angle + 90);
+
+    gauge_tick_t *tick = &ticks[i];
+
+    tick->outer.x = center + ((r_out * cos) >> LV_TRIGO_SHIFT);
+    tick->outer.y = center + ((r_out * sin) >> LV_TRIGO_SHIFT);
+    tick->inner.x = center + ((r_in * cos) >> LV_TRIGO_SHIFT);
+    tick->inner.y = center + ((r_in * sin) >> LV_TRIGO_SHIFT);
+
+    tick->area.x1 = LV_MATH_MIN(tick->outer.x, tick->inner.x) - GAUGE_LINE_WIDTH;
+    tick->area.y1 = LV_MATH_MIN(tick->outer.y, tick->inner.y) - GAUGE_LINE_WIDTH;
+    tick->area.x2 = LV_MATH_MAX(tick->outer.x, tick->inner.x) + GAUGE_LINE_WIDTH;
+    tick->area.y2 = LV_MATH_MAX(tick->outer.y, tick->inner.y) + GAUGE_LINE_WIDTH;
+
+    lv_point_t points[] = {tick->outer, tick->inner};
+    lv_canvas_draw_line(scale_canvas, points, 2, &line_dsc);
+  }
+
+  // unit
+
+  lv_draw_label_dsc_t label_dsc;
+  lv_draw_label_dsc_init(&label_dsc);
+  label_dsc.font  = lv_theme_get_font_small();
+  label_dsc.color = lv_theme_get_color_primary();
+
+  lv_canvas_draw_text(scale_canvas, 0, GAUGE_SIZE - lv_font_get_line_height(label_dsc.font) - GAUGE_UNIT_BOTTOM_PAD,
+                      GAUGE_SIZE, &label_dsc, GAUGE_UNIT_TEXT, LV_LABEL_ALIGN_CENTER);
+
+  scale_img = *lv_canvas_get_img(scale_canvas);
+  lv_obj_del(scale_canvas);
+
+  // active ticks are drawn live over the image
+
+  lv_draw_line_dsc_init(&active_line_dsc);
+  active_line_dsc.color = lv_theme_get_color_primary();
+  active_line_dsc.width = GAUGE_LINE_WIDTH;
+
+  ESP_LOGI(TAG, "Scale image: %dx%d, %d bytes", GAUGE_SIZE, GAUGE_SIZE, LV_CANVAS_BUF_SIZE_TRUE_COLOR(GAUGE_SIZE, GAUGE_SIZE));
+}
+
+static lv_design_res_t gauge_design(lv_obj_t *gauge, const lv_area_t *clip_area, lv_design_mode_t mode)
+{
+  lv_design_res_t res = ancestor_design(gauge, clip_area, mode);
+
+  if (mode != LV_DESIGN_DRAW_MAIN)
+    return res;
+
+  gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  lv_area_t coords, area;
+
+  lv_obj_get_coords(gauge, &coords);
+
+  for (uint8_t i = 0; i < ext->active_lines; i++)
+  {
+    lv_area_copy(&area, &ticks[i].area);
+    lv_area_move(&area, coords.x1, coords.y1);
+
+    if (!_lv_area_intersect(&area, &area, clip_area))
+      continue;
+
+    lv_point_t outer = {coords.x1 + ticks[i].outer.x, coords.y1 + ticks[i].outer.y};
+    lv_point_t inner = {coords.x1 + ticks[i].inner.x, coords.y1 + ticks[i].inner.y};
+
+    lv_draw_line(&outer, &inner, clip_area, &active_line_dsc);
+  }
+
+  return res;
+}
+
+// The count of active ticks: lv_linemeter's level of the value plus one, as lv_linemeter lights
+// the tick of the level too, so the first tick is on even at the minimum
+static uint8_t value_to_lines(int32_t value)
+{
+  if (value < GAUGE_MIN_VALUE)
+    value = GAUGE_MIN_VALUE;
+
+  if (value > GAUGE_MAX_VALUE)
+    value = GAUGE_MAX_VALUE;
+
+  return (value - GAUGE_MIN_VALUE) * (GAUGE_LINES - 1) / (GAUGE_MAX_VALUE - GAUGE_MIN_VALUE) + 1;
+}
@@ -0,0 +1,16 @@
+#ifndef _GAUGE_H_
+#define _GAUGE_H_
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+#define GAUGE_MIN_VALUE 0
+#define GAUGE_MAX_VALUE 800 // kPa
+
+// A linemeter look-alike whose static part (inactive scale, frame and unit) is rendered once
+// into an image shared by all gauges. A value change only invalidates the ticks that change color.
+lv_obj_t *gauge_create(lv_obj_t *parent);
+void gauge_set_value(lv_obj_t *gauge, int32_t value);
+
+#endif // _GAUGE_H_
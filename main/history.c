@@ -0,0 +1,514 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "history.h"
+#include "pressure_filters.h"
+#include "pressure_sensors.h"
+
+#include "utils.h"
+
+static const char *TAG = "HISTORY";
+
+/*
+  Every channel keeps a ring of fixed-size blocks holding the fast stream at full rate.
+  A block starts with the first sample in its header, the rest are varint tokens:
+    zigzag(delta) << 1     - the next sample differs from the previous one by delta
+    (run << 1) | 1         - the previous value repeats run times
+  Samples are stored in PRESSURE_RESOLUTION units, sensor states (negative values) as is.
+  Timestamps are implicit: first_timestamp_us + n * HISTORY_PERIOD_US. A sample that drifts
+  more than a half of the period from its slot starts a new block.
+*/
+
+#define HISTORY_BLOCK_SIZE CONFIG_HISTORY_BLOCK_SIZE
+#define HISTORY_BLOCKS_PER_CHANNEL CONFIG_HISTORY_BLOCKS_PER_CHANNEL
+#define HISTORY_PERIOD_US (PRESSURE_MEASURE_CYCLE_MS * 1000)
+
+#define HISTORY_BLOCK_HEADER_SIZE 26
+#define HISTORY_BLOCK_PAYLOAD_SIZE (HISTORY_BLOCK_SIZE - HISTORY_BLOCK_HEADER_SIZE)
+#define NO_RUN UINT16_MAX
+
+#define VARINT_MAX_LEN 5
+
+typedef struct history_block
+{
+  int64_t first_timestamp_us;
+  uint32_t seq;
+  pressure_value_t first_value; // stored units
+  pressure_value_t last_value;  // stored units, encoder state
+  uint16_t count;
+  uint16_t used;       // payload bytes
+  uint16_t run_offset; // offset of the last token if it is a run, NO_RUN otherwise
+  uint8_t payload[HISTORY_BLOCK_PAYLOAD_SIZE];
+} __attribute__((packed)) history_block_t;
+
+_Static_assert(sizeof(history_block_t) == HISTORY_BLOCK_SIZE, "history block header size mismatch");
+
+typedef struct history_ring
+{
+  history_block_t *blocks;
+  uint16_t capacity;
+  uint16_t head; // newest block
+  uint16_t used; // blocks in use
+  uint32_t appended;
+  portMUX_TYPE lock; // the sensor task appends under it, so it is held for O(1) work and block copies only
+} history_ring_t;
+
+/*
+  Declarations
+*/
+static void history_stream_cb(const pressure_aggregate_t *sample, void *arg);
+
+static bool ring_init(history_ring_t *ring, uint16_t capacity);
+static void ring_free(history_ring_t *ring);
+static void ring_append(history_ring_t *ring, int64_t timestamp_us, pressure_value_t pressure);
+static history_block_t *ring_block(history_ring_t *ring, uint16_t position);
+static int32_t ring_find(history_ring_t *ring, int64_t timestamp_us);
+static bool ring_copy_block(history_ring_t *ring, uint32_t seq, history_block_t *copy);
+
+static bool block_encode(history_block_t *block, pressure_value_t value);
+static size_t block_decode(const history_block_t *block, int64_t from_us, int64_t to_us, history_sample_cb_t cb, void *arg);
+
+static uint8_t varint_write(uint8_t *buf, uint32_t value);
+static uint8_t varint_read(const uint8_t *buf, uint16_t len, uint32_t *value);
+static uint8_t varint_len(uint32_t value);
+
+static pressure_value_t to_stored(pressure_value_t pressure);
+static pressure_value_t from_stored(pressure_value_t value);
+
+#ifdef CONFIG_HISTORY_BENCHMARK
+static void history_benchmark();
+#endif
+
+static history_ring_t rings[SENSORS_COUNT];
+
+void history_init()
+{
+#ifdef CONFIG_HISTORY_BENCHMARK
+  history_benchmark();
+#endif
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    ESP_MEM_CHECK(TAG, ring_init(&rings[i], HISTORY_BLOCKS_PER_CHANNEL), abort());
+  }
+
+  pressure_stream_subscribe(PRESSURE_RATE_FAST, history_stream_cb, NULL);
+
+  ESP_LOGI(TAG, "%d blocks x %d bytes per channel, %d bytes total",
+           HISTORY_BLOCKS_PER_CHANNEL, HISTORY_BLOCK_SIZE, SENSORS_COUNT * HISTORY_BLOCKS_PER_CHANNEL * HISTORY_BLOCK_SIZE);
+}
+
+static void history_stream_cb(const pressure_aggregate_t *sample, void *arg)
+{
+  ring_append(&rings[sample->index], sample->timestamp_us, sample->mean);
+}
+
+esp_err_t history_get_range(uint8_t index, history_range_t *range)
+{
+  history_ring_t *ring = &rings[index];
+  esp_err_t err        = ESP_ERR_NOT_FOUND;
+
+  portENTER_CRITICAL(&ring->lock);
+
+  if (ring->used > 0)
+  {
+    history_block_t *oldest = ring_block(ring, 0);
+    history_block_t *newest = ring_block(ring, ring->used - 1);
+
+    range->oldest_block        = oldest->seq;
+    range->newest_block        = newest->seq;
+    range->oldest_timestamp_us = oldest->first_timestamp_us;
+    range->newest_timestamp_us = newest->first_timestamp_us + (int64_t)(newest->count - 1) * HISTORY_PERIOD_US;
+
+    err = ESP_OK;
+  }
+
+  portEXIT_CRITICAL(&ring->lock);
+
+  return err;
+}
+
+esp_err_t history_read_block(uint8_t index, uint32_t seq, history_sample_cb_t cb, void *arg)
+{
+  history_block_t block;
+
+  if (!ring_copy_block(&rings[index], seq, &block))
+    return ESP_ERR_NOT_FOUND;
+
+  block_decode(&block, INT64_MIN, INT64_MAX, cb, arg);
+
+  return ESP_OK;
+}
+
+// Blocks are copied out one at a time under the lock and decoded without it, so a long read never stalls the sampler
+size_t history_read(uint8_t index, int64_t from_us, int64_t to_us, history_sample_cb_t cb, void *arg)
+{
+  history_ring_t *ring = &rings[index];
+  history_block_t block;
+  size_t samples       = 0;
+  uint32_t seq         = 0;
+
+  portENTER_CRITICAL(&ring->lock);
+  int32_t position = ring_find(ring, from_us);
+  if (position >= 0)
+    seq = ring_block(ring, position)->seq;
+  portEXIT_CRITICAL(&ring->lock);
+
+  if (position < 0)
+    return 0;
+
+  while (ring_copy_block(ring, seq, &block) && block.first_timestamp_us <= to_us)
+  {
+    samples += block_decode(&block, from_us, to_us, cb, arg);
+    seq++;
+  }
+
+  return samples;
+}
+
+void history_get_stats(history_stats_t *stats)
+{
+  memset(stats, 0, sizeof(history_stats_t));
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    history_ring_t *ring = &rings[i];
+
+    portENTER_CRITICAL(&ring->lock);
+
+    stats->ram_bytes += ring->capacity * sizeof(history_block_t);
+    stats->appended += ring->appended;
+
+    for (uint16_t p = 0; p < ring->used; p++)
+    {
+      history_block_t *block = ring_block(ring, p);
+      stats->used_bytes += HISTORY_BLOCK_HEADER_SIZE + block->used;
+      stats->samples += block->count;
+    }
+
+    portEXIT_CRITICAL(&ring->lock);
+  }
+}
+
+static bool ring_init(history_ring_t *ring, uint16_t capacity)
+{
+  memset(ring, 0, sizeof(history_ring_t));
+
+  ring->blocks = heap_caps_malloc(capacity * sizeof(history_block_t), MALLOC_CAP_8BIT);
+  ring->lock   = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+
+  if (ring->blocks == NULL)
+  {
+    ring_free(ring);
+    return false;
+  }
+
+  ring->capacity = capacity;
+
+  return true;
+}
+
+static void ring_free(history_ring_t *ring)
+{
+  free(ring->blocks);
+
+  memset(ring, 0, sizeof(history_ring_t));
+}
+
+static void ring_append(history_ring_t *ring, int64_t timestamp_us, pressure_value_t pressure)
+{
+  pressure_value_t value = to_stored(pressure);
+
+  portENTER_CRITICAL(&ring->lock);
+
+  history_block_t *block = ring->used > 0 ? &ring->blocks[ring->head] : NULL;
+
+  int64_t drift = block == NULL ? 0 : timestamp_us - (block->first_timestamp_us + (int64_t)block->count * HISTORY_PERIOD_US);
+
+  if (block == NULL || drift > HISTORY_PERIOD_US / 2 || drift < -HISTORY_PERIOD_US / 2 || !block_encode(block, value))
+  {
+    uint32_t seq = block == NULL ? 0 : block->seq + 1;
+
+    if (block != NULL)
+      ring->head = (ring->head + 1) % ring->capacity;
+
+    if (ring->used < ring->capacity)
+      ring->used++;
+
+    block                     = &ring->blocks[ring->head];
+    block->first_timestamp_us = timestamp_us;
+    block->seq                = seq;
+    block->first_value        = value;
+    block->last_value         = value;
+    block->count              = 1;
+    block->used               = 0;
+    block->run_offset         = NO_RUN;
+  }
+
+  ring->appended++;
+
+  portEXIT_CRITICAL(&ring->lock);
+}
+
+// position 0 is the oldest block
+static history_block_t *ring_block(history_ring_t *ring, uint16_t position)
+{
+  return &ring->blocks[(ring->head + ring->capacity - ring->used + 1 + position) % ring->capacity];
+}
+
+// binary search of the last block starting not later than timestamp_us, the oldest one if there is none
+static int32_t ring_find(history_ring_t *ring, int64_t timestamp_us)
+{
+  if (ring->used == 0)
+    return -1;
+
+  int32_t low = 0, high = ring->used - 1;
+
+  while (low < high)
+  {
+    int32_t middle = (low + high + 1) / 2;
+
+    if (ring_block(ring, middle)->first_timestamp_us <= timestamp_us)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+
+  return low;
+}
+
+static bool ring_copy_block(history_ring_t *ring, uint32_t seq, history_block_t *copy)
+{
+  bool found = false;
+
+  portENTER_CRITICAL(&ring->lock);
+
+  if (ring->used > 0)
+  {
+    uint32_t newest = ring->blocks[ring->head].seq;
+
+    if (seq <= newest && newest - seq < ring->used)
+    {
+      history_block_t *block = ring_block(ring, ring->used - 1 - (newest - seq));
+
+      memcpy(copy, block, HISTORY_BLOCK_HEADER_SIZE + block->used);
+      found = true;
+    }
+  }
+
+  portEXIT_CRITICAL(&ring->lock);
+
+  return found;
+}
+
+static bool block_encode(history_block_t *block, pressure_value_t value)
+{
+  // a run of a constant channel never fills the payload
+  if (block->count == UINT16_MAX)
+    return false;
+
+  int32_t delta = value - block->last_value;
+
+  if (delta == 0 && block->run_offset != NO_RUN)
+  {
+    uint32_t token;
+    varint_read(block->payload + block->run_offset, block->used - block->run_offset, &token);
+
+    token += 2; // run + 1
+
+    if (block->run_offset + varint_len(token) > HISTORY_BLOCK_PAYLOAD_SIZE)
+      return false;
+
+    block->used = block->run_offset + varint_write(block->payload + block->run_offset, token);
+  }
+  else
+  {
+    uint32_t token = delta == 0 ? (1 << 1) | 1 : (((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31)) << 1;
+
+    if (block->used + varint_len(token) > HISTORY_BLOCK_PAYLOAD_SIZE)
+      return false;
+
+    block->run_offset = delta == 0 ? block->used : NO_RUN;
+    block->used += varint_write(block->payload + block->used, token);
+  }
+
+  block->last_value = value;
+  block->count++;
+
+  return true;
+}
+
+static size_t block_decode(const history_block_t *block, int64_t from_us, int64_t to_us, history_sample_cb_t cb, void *arg)
+{
+  int64_t timestamp_us   = block->first_timestamp_us;
+  pressure_value_t value = block->first_value;
+  uint16_t offset        = 0;
+  size_t samples         = 0;
+  uint32_t repeat        = 0;
+
+  for (uint16_t n = 0; n < block->count && timestamp_us <= to_us; n++)
+  {
+    if (n > 0 && repeat == 0)
+    {
+      uint32_t token;
+      offset += varint_read(block->payload + offset, block->used - offset, &token);
+
+      if (token & 1)
+      {
+        repeat = token >> 1;
+      }
+      else
+      {
+        token >>= 1;
+        value += (int32_t)(token >> 1) ^ -(int32_t)(token & 1);
+      }
+    }
+
+    if (repeat > 0)
+      repeat--;
+
+    if (timestamp_us >= from_us)
+    {
+      cb(timestamp_us, from_stored(value), arg);
+      samples++;
+    }
+
+    timestamp_us += HISTORY_PERIOD_US;
+  }
+
+  return samples;
+}
+
+static uint8_t varint_write(uint8_t *buf, uint32_t value)
+{
+  uint8_t len = 0;
+
+  while (value >= 0x80)
+  {
+    buf[len++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+
+  buf[len++] = value;
+
+  return len;
+}
+
+static uint8_t varint_read(const uint8_t *buf, uint16_t len, uint32_t *value)
+{
+  uint8_t n = 0;
+  *value    = 0;
+
+  while (n < len && n < VARINT_MAX_LEN)
+  {
+    *value |= (uint32_t)(buf[n] & 0x7F) << (7 * n);
+
+    if ((buf[n++] & 0x80) == 0)
+      break;
+  }
+
+  return n;
+}
+
+static uint8_t varint_len(uint32_t value)
+{
+  uint8_t len = 1;
+
+  while (value >= 0x80)
+  {
+    value >>= 7;
+    len++;
+  }
+
+  return len;
+}
+
+static pressure_value_t to_stored(pressure_value_t pressure)
+{
+  return pressure < 0 ? pressure : (pressure + PRESSURE_RESOLUTION / 2) / PRESSURE_RESOLUTION;
+}
+
+static pressure_value_t from_stored(pressure_value_t value)
+{
+  return value < 0 ? value : value * PRESSURE_RESOLUTION;
+}
+
+#ifdef CONFIG_HISTORY_BENCHMARK
+
+#define BENCHMARK_SAMPLES (10 * 60 * PRESSURE_SAMPLES_PER_SEC) // 10 minutes of one channel
+
+static void benchmark_sample_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg)
+{
+  *(int64_t *)arg += pressure;
+}
+
+// Synthetic compressor-like signal: slow fill and drain with +-2 kPa noise and short sensor dropouts
+static pressure_value_t benchmark_signal(uint32_t n, uint32_t *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+
+  if (n % 5000 < 5)
+    return PRESSURE_SENSOR_ABSENT;
+
+  uint32_t phase = n % 3000;
+  int32_t base   = phase < 1500 ? 250000 + phase * 380 : 820000 - (phase - 1500) * 380;
+
+  return pressure_round(base + ((int32_t)(*seed >> 16) % 5 - 2) * 1000, PRESSURE_RESOLUTION);
+}
+
+static void history_benchmark()
+{
+  history_ring_t ring;
+  uint32_t seed = 1;
+
+  if (!ring_init(&ring, HISTORY_BLOCKS_PER_CHANNEL * 4))
+  {
+    ESP_LOGE(TAG, "Not enough memory for the benchmark");
+    return;
+  }
+
+  int64_t started = esp_timer_get_time();
+
+  for (uint32_t n = 0; n < BENCHMARK_SAMPLES; n++)
+  {
+    ring_append(&ring, (int64_t)n * HISTORY_PERIOD_US, benchmark_signal(n, &seed));
+  }
+
+  int64_t append_us = esp_timer_get_time() - started;
+
+  size_t used = 0;
+  for (uint16_t p = 0; p < ring.used; p++)
+  {
+    used += HISTORY_BLOCK_HEADER_SIZE + ring_block(&ring, p)->used;
+  }
+
+  int64_t checksum = 0;
+  size_t decoded   = 0;
+  history_block_t block;
+
+  started = esp_timer_get_time();
+
+  for (uint32_t seq = ring_block(&ring, 0)->seq; ring_copy_block(&ring, seq, &block); seq++)
+  {
+    decoded += block_decode(&block, INT64_MIN, INT64_MAX, benchmark_sample_cb, &checksum);
+  }
+
+  int64_t decode_us = esp_timer_get_time() - started;
+
+  ESP_LOGI(TAG, "Benchmark: %d samples, %d blocks, %d bytes (%d.%02d bytes/sample, raw %d)",
+           BENCHMARK_SAMPLES, ring.used, used, used / decoded, used * 100 / decoded % 100, sizeof(pressure_value_t) + sizeof(int64_t));
+  ESP_LOGI(TAG, "Benchmark: append %lld us (%lld samples/s), decode %d samples %lld us (%lld samples/s), checksum %lld",
+           append_us, (int64_t)BENCHMARK_SAMPLES * 1000000 / (append_us + 1),
+           decoded, decode_us, (int64_t)decoded * 1000000 / (decode_us + 1), checksum);
+  ESP_LOGI(TAG, "Benchmark: %d channels x %d blocks = %d bytes of RAM",
+           SENSORS_COUNT, HISTORY_BLOCKS_PER_CHANNEL, SENSORS_COUNT * HISTORY_BLOCKS_PER_CHANNEL * HISTORY_BLOCK_SIZE);
+
+  ring_free(&ring);
+}
+
+#endif // CONFIG_HISTORY_BENCHMARK
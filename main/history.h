@@ -0,0 +1,37 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "pressure_sensors.h"
+
+typedef void (*history_sample_cb_t)(int64_t timestamp_us, pressure_value_t pressure, void *arg);
+
+typedef struct history_range
+{
+  uint32_t oldest_block; // block sequence numbers, random access key for history_read_block()
+  uint32_t newest_block;
+  int64_t oldest_timestamp_us;
+  int64_t newest_timestamp_us;
+} history_range_t;
+
+typedef struct history_stats
+{
+  size_t ram_bytes;  // allocated for all channels
+  size_t used_bytes; // compressed payload and headers in use
+  uint32_t samples;  // samples held in RAM
+  uint32_t appended; // samples appended since boot
+} history_stats_t;
+
+void history_init();
+
+esp_err_t history_get_range(uint8_t index, history_range_t *range);
+esp_err_t history_read_block(uint8_t index, uint32_t block, history_sample_cb_t cb, void *arg);
+size_t history_read(uint8_t index, int64_t from_us, int64_t to_us, history_sample_cb_t cb, void *arg);
+
+void history_get_stats(history_stats_t *stats);
+
+#endif // _HISTORY_H_
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "http_server.h"
+
+static const char *TAG = "HTTP";
+
+#define HTTP_SERVER_MAX_URI_HANDLERS 20 // the SoftAP provisioning adds its own
+#define HTTP_SERVER_CPU_CORE 0 // the GUI has the other one
+#define HTTP_SERVER_MAX_CLOSE_CALLBACKS 4
+// the dashboard page and its assets, REST, metrics and OTA share these with keep-alive
+#define HTTP_SERVER_SPARE_SESSIONS 4
+#define HTTP_SERVER_MAX_SESSIONS (CONFIG_LIVE_STREAM_MAX_CLIENTS + HTTP_SERVER_SPARE_SESSIONS)
+
+/*
+  Every socket of the firmware comes from the LWIP pool:
+    HTTP server     listen, control and HTTP_SERVER_MAX_SESSIONS
+    Modbus TCP      listen and CONFIG_MODBUS_SERVER_MAX_CLIENTS
+    UDP telemetry   1
+    MQTT            1
+  With all the sessions taken the least recently used one is closed for a new connection. The
+  stream marks its sessions used on every message, so idle keep-alive connections go first.
+*/
+#define HTTP_SERVER_SOCKETS (2 + HTTP_SERVER_MAX_SESSIONS)
+#define FIRMWARE_SOCKETS (HTTP_SERVER_SOCKETS + 1 + CONFIG_MODBUS_SERVER_MAX_CLIENTS + 1 + 1)
+
+_Static_assert(FIRMWARE_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS,
+               "Stream and Modbus clients do not fit LWIP max sockets, raise it or lower the clients");
+
+/*
+  Declarations
+*/
+static void session_closed(httpd_handle_t hd, int sockfd);
+
+static httpd_handle_t server;
+
+static http_server_close_cb_t close_callbacks[HTTP_SERVER_MAX_CLOSE_CALLBACKS];
+static uint8_t close_callbacks_count = 0;
+
+void http_server_start()
+{
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+  config.server_port      = CONFIG_HTTP_SERVER_PORT;
+  config.max_uri_handlers = HTTP_SERVER_MAX_URI_HANDLERS;
+  config.max_open_sockets = HTTP_SERVER_MAX_SESSIONS;
+  config.lru_purge_enable = true;
+  config.core_id          = HTTP_SERVER_CPU_CORE;
+  // below the sensor tasks, clients wait rather than the measure cycle
+  config.task_priority = CONFIG_HTTP_SERVER_TASK_PRIORITY;
+  config.close_fn      = session_closed;
+
+  ESP_ERROR_CHECK(httpd_start(&server, &config));
+
+  ESP_LOGI(TAG, "Listening on port %d, %d sessions, %d of %d sockets taken by the firmware",
+           config.server_port, config.max_open_sockets, FIRMWARE_SOCKETS, CONFIG_LWIP_MAX_SOCKETS);
+}
+
+void http_server_register(const httpd_uri_t *uri)
+{
+  ESP_ERROR_CHECK(httpd_register_uri_handler(server, uri));
+}
+
+httpd_handle_t http_server_handle()
+{
+  return server;
+}
+
+void http_server_on_close(http_server_close_cb_t cb)
+{
+  if (close_callbacks_count >= HTTP_SERVER_MAX_CLOSE_CALLBACKS)
+  {
+    ESP_LOGE(TAG, "Too many close callbacks, one is dropped");
+    return;
+  }
+
+  close_callbacks[close_callbacks_count++] = cb;
+}
+
+// A custom close_fn has to close the socket itself
+static void session_closed(httpd_handle_t hd, int sockfd)
+{
+  for (uint8_t i = 0; i < close_callbacks_count; i++)
+    close_callbacks[i](sockfd);
+
+  close(sockfd);
+}
+
+// If-None-Match is read into a stack buffer, a list of tags or * are not worth the parsing here
+bool http_server_etag_matches(httpd_req_t *req, const char *etag)
+{
+  char value[HTTP_SERVER_ETAG_SIZE + 4];
+
+  if (httpd_req_get_hdr_value_len(req, "If-None-Match") >= sizeof(value))
+    return false;
+
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK)
+    return false;
+
+  // weak validators compare the same
+  const char *tag = strncmp(value, "W/", 2) == 0 ? value + 2 : value;
+
+  return strcmp(tag, etag) == 0;
+}
@@ -0,0 +1,23 @@
+#ifndef _HTTP_SERVER_H_
+#define _HTTP_SERVER_H_
+
+#include <stdbool.h>
+
+#include "esp_http_server.h"
+
+#define HTTP_SERVER_ETAG_SIZE 16 // "xxxxxxxx" with the quotes
+
+// Called from the server task before a session socket is closed
+typedef void (*http_server_close_cb_t)(int sockfd);
+
+// One server for all the network interfaces, each registers its own URIs
+void http_server_start();
+void http_server_register(const httpd_uri_t *uri);
+void http_server_on_close(http_server_close_cb_t cb);
+// NULL until http_server_start()
+httpd_handle_t http_server_handle();
+
+// true if If-None-Match of the request is the strong or weak form of etag, quotes included
+bool http_server_etag_matches(httpd_req_t *req, const char *etag);
+
+#endif // _HTTP_SERVER_H_
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "http_server.h"
+#include "live_stream.h"
+#include "pressure_sensors.h"
+#include "telemetry.h"
+
+static const char *TAG = "STREAM";
+
+/*
+  The sensor tasks only store the latest fast value of their channel, nothing else happens on their
+  side. A task of its own turns the latest values into a frame every measure cycle and puts it into
+  the bounded queue of every client which wants it at its rate. Sends run in the server task via
+  httpd_queue_work(), one message in flight per client. While a client's message is still going
+  out its frames keep queueing, and a full queue is decimated, every second frame is dropped and the
+  client falls back to half its rate until it catches up. Nothing waits for a client.
+*/
+
+#define LIVE_STREAM_QUEUE_FRAMES CONFIG_LIVE_STREAM_QUEUE_FRAMES
+#define LIVE_STREAM_FRAME_JSON_MAX 80 // [time,p0..p4], with all the values at their longest
+#define LIVE_STREAM_STATE_SECTIONS (TELEMETRY_RELAYS | TELEMETRY_CONTROLLER)
+#define LIVE_STREAM_STATE_SIZE 512
+#define LIVE_STREAM_MESSAGE_SIZE (LIVE_STREAM_QUEUE_FRAMES * LIVE_STREAM_FRAME_JSON_MAX + LIVE_STREAM_STATE_SIZE + 64)
+#define LIVE_STREAM_SETTINGS_MAX 32
+#define LIVE_STREAM_MAX_BATCH_MS 10000
+#define LIVE_STREAM_LOG_INTERVAL_S 60
+#define LIVE_STREAM_CPU_CORE 0 // with the server
+#define LIVE_STREAM_TASK_PRIORITY 1
+
+typedef struct stream_frame
+{
+  uint32_t time_ms; // esp_timer time
+  pressure_value_t pressure[SENSORS_COUNT];
+} stream_frame_t;
+
+typedef struct stream_client
+{
+  int fd; // -1 if the slot is free
+  httpd_handle_t server;
+  uint8_t step;           // fast frames per queued one, as the client asked
+  uint8_t effective_step; // raised while the client falls behind
+  uint8_t phase;
+  uint16_t batch_ms;
+  int64_t next_batch_us;
+  bool in_flight;
+  uint16_t head;
+  uint16_t count;
+  uint32_t dropped; // since the last message
+  bool state_sent;
+  uint32_t state_seq; // sent last
+  stream_frame_t queue[LIVE_STREAM_QUEUE_FRAMES];
+} stream_client_t;
+
+/*
+  Declarations
+*/
+static void stream_sample_cb(const pressure_aggregate_t *sample, void *arg);
+static void live_stream_task(void *arg);
+static void client_tick(uint8_t slot, const stream_frame_t *frame, int64_t now);
+static void queue_push(stream_client_t *client, const stream_frame_t *frame);
+static void send_batch_work(void *arg);
+static size_t format_batch(uint8_t count, uint16_t dt, uint32_t dropped, bool with_state);
+static esp_err_t stream_ws_handler(httpd_req_t *req);
+static esp_err_t client_settings(httpd_req_t *req, const char *settings);
+static void session_closed(int sockfd);
+static esp_err_t stats_get_handler(httpd_req_t *req);
+
+static const httpd_uri_t endpoints[] = {
+    {.uri = "/api/v1/stream", .method = HTTP_GET, .handler = stream_ws_handler, .is_websocket = true},
+    {.uri = "/api/v1/stream/stats", .method = HTTP_GET, .handler = stats_get_handler}};
+
+static volatile pressure_value_t latest[SENSORS_COUNT];
+
+static stream_client_t clients[CONFIG_LIVE_STREAM_MAX_CLIENTS];
+static portMUX_TYPE clients_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static live_stream_stats_t stats;
+
+// used by the server task only
+static stream_frame_t batch[LIVE_STREAM_QUEUE_FRAMES];
+static char message[LIVE_STREAM_MESSAGE_SIZE];
+static telemetry_snapshot_t snapshot;
+static char state[LIVE_STREAM_STATE_SIZE];
+static size_t state_length;
+static uint32_t state_seq;
+
+void live_stream_init()
+{
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    latest[i] = PRESSURE_SENSOR_ABSENT;
+
+  for (uint8_t i = 0; i < CONFIG_LIVE_STREAM_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+
+  pressure_stream_subscribe(PRESSURE_RATE_FAST, stream_sample_cb, NULL);
+}
+
+void live_stream_start()
+{
+  for (uint8_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++)
+    http_server_register(&endpoints[i]);
+
+  http_server_on_close(session_closed);
+
+  xTaskCreatePinnedToCore(live_stream_task, "live stream", 3072, NULL, LIVE_STREAM_TASK_PRIORITY, NULL, LIVE_STREAM_CPU_CORE);
+
+  ESP_LOGI(TAG, "Started, %d clients x %d frames, %d bytes of buffers",
+           CONFIG_LIVE_STREAM_MAX_CLIENTS, LIVE_STREAM_QUEUE_FRAMES, sizeof(clients) + sizeof(batch) + sizeof(message));
+}
+
+void live_stream_get_stats(live_stream_stats_t *out)
+{
+  portENTER_CRITICAL(&clients_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&clients_lock);
+}
+
+static void stream_sample_cb(const pressure_aggregate_t *sample, void *arg)
+{
+  latest[sample->index] = sample->mean;
+}
+
+static void live_stream_task(void *arg)
+{
+  TickType_t last_wake = xTaskGetTickCount();
+  int64_t next_second  = esp_timer_get_time() + 1000000;
+  uint64_t last_bytes  = 0;
+  uint32_t seconds     = 0;
+
+  for (;;)
+  {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PRESSURE_MEASURE_CYCLE_MS));
+
+    int64_t now          = esp_timer_get_time();
+    stream_frame_t frame = {.time_ms = now / 1000};
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+      frame.pressure[i] = latest[i];
+
+    for (uint8_t i = 0; i < CONFIG_LIVE_STREAM_MAX_CLIENTS; i++)
+      client_tick(i, &frame, now);
+
+    if (now < next_second)
+      continue;
+
+    next_second += 1000000;
+
+    portENTER_CRITICAL(&clients_lock);
+    stats.bytes_per_sec         = stats.bytes - last_bytes;
+    last_bytes                  = stats.bytes;
+    live_stream_stats_t current = stats;
+    portEXIT_CRITICAL(&clients_lock);
+
+    if (++seconds % LIVE_STREAM_LOG_INTERVAL_S == 0 && current.clients > 0)
+      ESP_LOGI(TAG, "%d clients, %u bytes/s, %u messages, %u frames, %u dropped, %u send errors",
+               current.clients, current.bytes_per_sec, current.messages, current.frames, current.dropped, current.send_errors);
+  }
+}
+
+static void client_tick(uint8_t slot, const stream_frame_t *frame, int64_t now)
+{
+  stream_client_t *client = &clients[slot];
+  httpd_handle_t server   = NULL;
+
+  portENTER_CRITICAL(&clients_lock);
+
+  if (client->fd >= 0)
+  {
+    if (++client->phase >= client->effective_step)
+    {
+      client->phase = 0;
+      queue_push(client, frame);
+    }
+
+    if (!client->in_flight && now >= client->next_batch_us && (client->count > 0 || client->dropped > 0))
+    {
+      client->in_flight     = true;
+      client->next_batch_us = now + client->batch_ms * 1000LL;
+      server                = client->server;
+    }
+  }
+
+  portEXIT_CRITICAL(&clients_lock);
+
+  if (server != NULL && httpd_queue_work(server, send_batch_work, (void *)(uintptr_t)slot) != ESP_OK)
+  {
+    portENTER_CRITICAL(&clients_lock);
+    client->in_flight = false;
+    portEXIT_CRITICAL(&clients_lock);
+  }
+}
+
+// Under clients_lock
+static void queue_push(stream_client_t *client, const stream_frame_t *frame)
+{
+  if (client->count == LIVE_STREAM_QUEUE_FRAMES)
+  {
+    // keep every second frame, compacting towards the head never overwrites a frame not moved yet
+    uint16_t kept = 0;
+
+    for (uint16_t i = 0; i < client->count; i += 2)
+      client->queue[(client->head + kept++) % LIVE_STREAM_QUEUE_FRAMES] = client->queue[(client->head + i) % LIVE_STREAM_QUEUE_FRAMES];
+
+    client->dropped += client->count - kept;
+    stats.dropped += client->count - kept;
+    client->count = kept;
+
+    client->effective_step = client->effective_step * 2 < PRESSURE_SAMPLES_PER_SEC ? client->effective_step * 2 : PRESSURE_SAMPLES_PER_SEC;
+  }
+
+  client->queue[(client->head + client->count) % LIVE_STREAM_QUEUE_FRAMES] = *frame;
+  client->count++;
+  stats.frames++;
+}
+
+// Runs in the server task, as do the handlers and the close callback, so the slot can't be taken
+// by another client while the message goes out
+static void send_batch_work(void *arg)
+{
+  stream_client_t *client = &clients[(uintptr_t)arg];
+  // reads the controller event group, not allowed under the spinlock
+  uint32_t current_seq = telemetry_state_seq();
+
+  portENTER_CRITICAL(&clients_lock);
+
+  int fd                = client->fd;
+  httpd_handle_t server = client->server;
+  uint8_t count         = client->count;
+  uint32_t dropped      = client->dropped;
+  uint16_t dt           = client->effective_step * PRESSURE_MEASURE_CYCLE_MS;
+  bool with_state       = !client->state_sent || client->state_seq != current_seq;
+
+  for (uint8_t i = 0; i < count; i++)
+    batch[i] = client->queue[(client->head + i) % LIVE_STREAM_QUEUE_FRAMES];
+
+  client->head    = (client->head + count) % LIVE_STREAM_QUEUE_FRAMES;
+  client->count   = 0;
+  client->dropped = 0;
+
+  // caught up, try the next faster rate
+  if (client->effective_step > client->step && count < LIVE_STREAM_QUEUE_FRAMES / 4)
+    client->effective_step = client->effective_step / 2 > client->step ? client->effective_step / 2 : client->step;
+
+  portEXIT_CRITICAL(&clients_lock);
+
+  if (fd < 0)
+    return;
+
+  // serialized once per change for all the clients
+  if (with_state && (state_length == 0 || state_seq != current_seq))
+  {
+    telemetry_get_snapshot(&snapshot);
+
+    state_length = telemetry_to_json(&snapshot, LIVE_STREAM_STATE_SECTIONS, state, sizeof(state));
+    state_seq    = current_seq;
+
+    if (state_length == 0)
+      ESP_LOGE(TAG, "The state does not fit %d bytes", sizeof(state));
+  }
+
+  size_t length = format_batch(count, dt, dropped, with_state && state_length > 0);
+
+  httpd_ws_frame_t ws_frame = {
+      .final   = true,
+      .type    = HTTPD_WS_TYPE_TEXT,
+      .payload = (uint8_t *)message,
+      .len     = length};
+
+  esp_err_t err = httpd_ws_send_frame_async(server, fd, &ws_frame);
+
+  portENTER_CRITICAL(&clients_lock);
+
+  client->in_flight = false;
+
+  if (err == ESP_OK)
+  {
+    stats.messages++;
+    stats.bytes += length;
+
+    if (with_state && state_length > 0)
+    {
+      client->state_sent = true;
+      client->state_seq  = current_seq;
+    }
+  }
+  else
+  {
+    stats.send_errors++;
+    stats.clients--;
+    client->fd = -1;
+  }
+
+  portEXIT_CRITICAL(&clients_lock);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Client %d is gone: %s", fd, esp_err_to_name(err));
+    httpd_sess_trigger_close(server, fd);
+  }
+  else
+  {
+    // the server counts received requests only, a stream session would be the first to purge
+    httpd_sess_update_lru_counter(server, fd);
+  }
+}
+
+static size_t format_batch(uint8_t count, uint16_t dt, uint32_t dropped, bool with_state)
+{
+  size_t length = snprintf(message, sizeof(message), "{\"dt\":%u,\"dropped\":%u,\"frames\":[", dt, dropped);
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const stream_frame_t *frame = &batch[i];
+
+    length += snprintf(message + length, sizeof(message) - length, "%s[%u,%d,%d,%d,%d,%d]",
+                       i > 0 ? "," : "", frame->time_ms,
+                       frame->pressure[0], frame->pressure[1], frame->pressure[2], frame->pressure[3], frame->pressure[4]);
+  }
+
+  length += snprintf(message + length, sizeof(message) - length, "]%s%s}", with_state ? ",\"state\":" : "", with_state ? state : "");
+
+  return length;
+}
+
+static esp_err_t stream_ws_handler(httpd_req_t *req)
+{
+  char settings[LIVE_STREAM_SETTINGS_MAX] = "";
+
+  // the handshake, settings may come in the query
+  if (req->method == HTTP_GET)
+  {
+    httpd_req_get_url_query_str(req, settings, sizeof(settings));
+    return client_settings(req, settings);
+  }
+
+  httpd_ws_frame_t ws_frame = {.payload = (uint8_t *)settings};
+
+  esp_err_t err = httpd_ws_recv_frame(req, &ws_frame, sizeof(settings) - 1);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Can't receive a frame: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  if (ws_frame.type != HTTPD_WS_TYPE_TEXT)
+    return ESP_OK;
+
+  settings[ws_frame.len] = '\0';
+
+  return client_settings(req, settings);
+}
+
+// Takes a free slot for a new client, so the stream starts at the defaults even without settings
+static esp_err_t client_settings(httpd_req_t *req, const char *settings)
+{
+  int fd = httpd_req_to_sockfd(req);
+  char value[8];
+
+  uint8_t rate      = PRESSURE_SAMPLES_PER_SEC;
+  uint32_t batch_ms = CONFIG_LIVE_STREAM_BATCH_MS;
+
+  if (httpd_query_key_value(settings, "rate", value, sizeof(value)) == ESP_OK)
+  {
+    int requested = atoi(value);
+    rate          = requested < 1 ? 1 : requested > PRESSURE_SAMPLES_PER_SEC ? PRESSURE_SAMPLES_PER_SEC : requested;
+  }
+
+  if (httpd_query_key_value(settings, "batch", value, sizeof(value)) == ESP_OK)
+    batch_ms = atoi(value);
+
+  uint8_t step = PRESSURE_SAMPLES_PER_SEC / rate;
+  // a batch has to fit the queue
+  uint32_t max_batch_ms = LIVE_STREAM_QUEUE_FRAMES * step * PRESSURE_MEASURE_CYCLE_MS;
+
+  if (max_batch_ms > LIVE_STREAM_MAX_BATCH_MS)
+    max_batch_ms = LIVE_STREAM_MAX_BATCH_MS;
+
+  batch_ms = batch_ms < PRESSURE_MEASURE_CYCLE_MS ? PRESSURE_MEASURE_CYCLE_MS : batch_ms > max_batch_ms ? max_batch_ms : batch_ms;
+
+  stream_client_t *client = NULL;
+  stream_client_t *vacant = NULL;
+
+  portENTER_CRITICAL(&clients_lock);
+
+  for (uint8_t i = 0; i < CONFIG_LIVE_STREAM_MAX_CLIENTS; i++)
+  {
+    if (clients[i].fd == fd)
+      client = &clients[i];
+    else if (clients[i].fd < 0 && vacant == NULL)
+      vacant = &clients[i];
+  }
+
+  if (client == NULL && vacant != NULL)
+  {
+    client             = vacant;
+    client->fd         = fd;
+    client->server     = req->handle;
+    client->head       = 0;
+    client->count      = 0;
+    client->dropped    = 0;
+    client->in_flight  = false;
+    client->state_sent = false;
+    stats.clients++;
+  }
+
+  if (client != NULL)
+  {
+    client->step           = step;
+    client->effective_step = step;
+    client->phase          = 0;
+    client->batch_ms       = batch_ms;
+    client->next_batch_us  = esp_timer_get_time() + batch_ms * 1000LL;
+  }
+
+  portEXIT_CRITICAL(&clients_lock);
+
+  if (client == NULL)
+  {
+    ESP_LOGW(TAG, "No free slot for client %d", fd);
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(TAG, "Client %d: %d frames/s, %u ms batches", fd, PRESSURE_SAMPLES_PER_SEC / step, batch_ms);
+
+  return ESP_OK;
+}
+
+static void session_closed(int sockfd)
+{
+  portENTER_CRITICAL(&clients_lock);
+
+  for (uint8_t i = 0; i < CONFIG_LIVE_STREAM_MAX_CLIENTS; i++)
+  {
+    if (clients[i].fd == sockfd)
+    {
+      clients[i].fd = -1;
+      stats.clients--;
+    }
+  }
+
+  portEXIT_CRITICAL(&clients_lock);
+}
+
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+  live_stream_stats_t current;
+  char body[192];
+
+  live_stream_get_stats(&current);
+
+  snprintf(body, sizeof(body),
+           "{\"clients\":%u,\"messages\":%u,\"bytes\":%llu,\"bytes_per_sec\":%u,\"frames\":%u,\"dropped\":%u,\"send_errors\":%u}",
+           current.clients, current.messages, current.bytes, current.bytes_per_sec, current.frames, current.dropped, current.send_errors);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  return httpd_resp_send(req, body, strlen(body));
+}
@@ -0,0 +1,38 @@
+#ifndef _LIVE_STREAM_H_
+#define _LIVE_STREAM_H_
+
+#include <stdint.h>
+
+/*
+  WebSocket at /api/v1/stream. A client is served from its handshake or its first message on, and
+  sets its rate and batch interval in the URL query or in a text message, both as "rate=5&batch=500".
+  The rate is frames per second from 1 to the full measure rate, batch is milliseconds between
+  messages. Every message is a JSON text frame
+
+    {"dt":40,"dropped":0,"frames":[[time_ms,p0,p1,p2,p3,p4],...],"state":{...}}
+
+  where time_ms is the device uptime, p are Pa or negative sensor states, dt is the nominal frame
+  spacing and dropped counts frames lost since the previous message. The first message and every
+  one after a relay or controller change carry "state", the relays and controller sections of
+  /api/v1/snapshot.
+*/
+
+typedef struct live_stream_stats
+{
+  uint8_t clients;
+  uint32_t messages;
+  uint64_t bytes;
+  uint32_t bytes_per_sec; // over the last second
+  uint32_t frames;        // queued to clients
+  uint32_t dropped;       // discarded by decimation of a full client queue
+  uint32_t send_errors;
+} live_stream_stats_t;
+
+// Subscribes to the sensor stream, call before measure_start()
+void live_stream_init();
+// Registers the endpoints and starts sending, call after http_server_start()
+void live_stream_start();
+
+void live_stream_get_stats(live_stream_stats_t *stats);
+
+#endif // _LIVE_STREAM_H_
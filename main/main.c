@@ -15,8 +15,21 @@
 #include <time.h>
 
 #include "button.h"
+#include "dashboard.h"
+#include "history.h"
+#include "http_server.h"
+#include "live_stream.h"
+#include "metrics.h"
+#include "modbus_server.h"
+#include "mqtt_publisher.h"
+#include "ota.h"
 #include "pressure_sensors.h"
 #include "relay_control.h"
+#include "rest_api.h"
+#include "rollup.h"
+#include "telemetry.h"
+#include "tslog.h"
+#include "udp_telemetry.h"
 #include "ui.h"
 #include "wifi.h"
 
@@ -44,16 +57,35 @@ void app_main(void)
   // ESP_ERROR_CHECK(esp_timer_start_periodic(stats_timer, 10000 * 1000)); //1000ms (expressed as microseconds)
 
   ESP_ERROR_CHECK(esp_event_loop_create_default());
+  metrics_init();
 
   nvs_init();
-
-  wifi_init();
+  wifi_reclaim_bt_memory();
 
   uiTaskHandle = gui_start();
   // button_init(uiTaskHandle);
 
   relay_control_start();
+
+  history_init();
+  tslog_start();
+  rollup_start();
+  telemetry_start();
+  live_stream_init();
+  mqtt_publisher_start();
+  udp_telemetry_start();
+  ota_init();
   measure_start();
+
+  wifi_start();
+
+  http_server_start();
+  rest_api_start();
+  live_stream_start();
+  dashboard_start();
+  metrics_start();
+  modbus_server_start();
+  ota_start();
 }
 
 void nvs_init()
@@ -0,0 +1,479 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "compressor_health.h"
+#include "http_server.h"
+#include "metrics.h"
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "relay_control.h"
+#include "screens.h"
+#include "ui_perf.h"
+
+static const char *TAG = "METRICS";
+
+/*
+  The registry is written from the hot paths with relaxed atomics only. A scrape renders into one
+  reused buffer and sends it as a chunk whenever it fills up, so the page size is not limited by
+  the buffer. Histogram buckets are kept as they fall and summed up while rendering.
+
+  Histogram sums are 32 bit in a unit of their own, a sum wraps after about 49 days of cycles in
+  ms and Prometheus takes the wrap for a counter reset.
+*/
+
+#define METRICS_PREFIX "pressure_controller_"
+#define METRICS_MAX_SLOTS (RELAYS_COUNT > SENSORS_COUNT ? RELAYS_COUNT : SENSORS_COUNT)
+#define METRICS_HISTOGRAM_BUCKETS 10 // +Inf is on top
+#define METRICS_MAX_TASKS 32
+
+typedef struct metric_def
+{
+  const char *name;
+  const char *type;
+  uint8_t slots;
+  const char *label;
+  const char *help;
+} metric_def_t;
+
+typedef struct metric_histogram
+{
+  const char *name;
+  const char *help;
+  uint32_t bounds_us[METRICS_HISTOGRAM_BUCKETS];
+  uint32_t sum_unit_us;
+  atomic_uint buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+  atomic_uint sum;
+} metric_histogram_t;
+
+typedef struct metrics_writer
+{
+  httpd_req_t *req;
+  size_t length;
+  esp_err_t err;
+} metrics_writer_t;
+
+/*
+  Declarations
+*/
+static void dispatched_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static esp_err_t metrics_get_handler(httpd_req_t *req);
+static void render_pressure(metrics_writer_t *w);
+static void render_relays(metrics_writer_t *w);
+static void render_registry(metrics_writer_t *w);
+static void render_histograms(metrics_writer_t *w);
+static void render_system(metrics_writer_t *w);
+static void render_tasks(metrics_writer_t *w);
+static void render_wifi(metrics_writer_t *w);
+static void render_screens(metrics_writer_t *w);
+static void render_ui_perf(metrics_writer_t *w);
+static void family(metrics_writer_t *w, const char *name, const char *type, const char *help);
+static void out(metrics_writer_t *w, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void flush(metrics_writer_t *w);
+
+#define DEF_METRIC(id, name, type, slots, label, help) [METRIC_##id] = {name, type, slots, label, help},
+
+static const metric_def_t registry_defs[METRICS_COUNT] = {_METRICS(DEF_METRIC)};
+
+static atomic_uint registry[METRICS_COUNT][METRICS_MAX_SLOTS];
+
+static metric_histogram_t histograms[METRIC_HISTOGRAMS_COUNT] = {
+    [METRIC_HISTOGRAM_MEASURE_CYCLE] = {
+        .name        = "measure_cycle_seconds",
+        .help        = "Time between two measure cycle starts",
+        .bounds_us   = {40000, 42000, 44000, 46000, 48000, 50000, 60000, 80000, 100000, 200000},
+        .sum_unit_us = 1000},
+    [METRIC_HISTOGRAM_MEASURE_JITTER] = {
+        .name        = "measure_cycle_jitter_seconds",
+        .help        = "Difference between two consecutive cycle times",
+        .bounds_us   = {100, 250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000},
+        .sum_unit_us = 10},
+};
+
+static const httpd_uri_t metrics_uri = {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_get_handler};
+
+// used by the server task only
+static char buffer[CONFIG_METRICS_BUFFER_SIZE];
+static TaskStatus_t tasks[METRICS_MAX_TASKS];
+
+void metrics_init()
+{
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, ESP_EVENT_ANY_ID, dispatched_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAYS_EVENTS, ESP_EVENT_ANY_ID, dispatched_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAY_CONTROL_EVENTS, ESP_EVENT_ANY_ID, dispatched_handler, NULL, NULL);
+}
+
+void metrics_start()
+{
+  http_server_register(&metrics_uri);
+}
+
+void metrics_add(metric_id_t id, uint8_t slot, uint32_t value)
+{
+  atomic_fetch_add_explicit(&registry[id][slot], value, memory_order_relaxed);
+}
+
+void metrics_set(metric_id_t id, uint8_t slot, uint32_t value)
+{
+  atomic_store_explicit(&registry[id][slot], value, memory_order_relaxed);
+}
+
+void metrics_set_max(metric_id_t id, uint8_t slot, uint32_t value)
+{
+  unsigned int current = atomic_load_explicit(&registry[id][slot], memory_order_relaxed);
+
+  while (value > current && !atomic_compare_exchange_weak_explicit(&registry[id][slot], &current, value, memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+void metrics_observe(metric_histogram_id_t id, uint32_t value_us)
+{
+  metric_histogram_t *histogram = &histograms[id];
+  uint8_t bucket                = 0;
+
+  while (bucket < METRICS_HISTOGRAM_BUCKETS && value_us > histogram->bounds_us[bucket])
+    bucket++;
+
+  atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->sum, (value_us + histogram->sum_unit_us / 2) / histogram->sum_unit_us, memory_order_relaxed);
+}
+
+void metrics_event_posted(esp_err_t err)
+{
+  if (err != ESP_OK)
+  {
+    metrics_add(METRIC_EVENTS_POST_FAILED, 0, 1);
+    return;
+  }
+
+  uint32_t posted     = atomic_fetch_add_explicit(&registry[METRIC_EVENTS_POSTED][0], 1, memory_order_relaxed) + 1;
+  uint32_t dispatched = atomic_load_explicit(&registry[METRIC_EVENTS_DISPATCHED][0], memory_order_relaxed);
+
+  // the loop task may count the dispatch before the poster counts the post
+  int32_t depth = (int32_t)(posted - dispatched);
+
+  if (depth > 0)
+    metrics_set_max(METRIC_EVENTS_DEPTH_MAX, 0, depth);
+}
+
+// The loop calls every handler of an event right after taking it from the queue
+static void dispatched_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  metrics_add(METRIC_EVENTS_DISPATCHED, 0, 1);
+}
+
+/*
+  Rendering
+*/
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+  int64_t started    = esp_timer_get_time();
+  metrics_writer_t w = {.req = req, .err = ESP_OK};
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+  render_pressure(&w);
+  render_relays(&w);
+  render_registry(&w);
+  render_histograms(&w);
+  render_system(&w);
+  render_tasks(&w);
+  render_wifi(&w);
+  render_screens(&w);
+  render_ui_perf(&w);
+
+  family(&w, "scrape_duration_seconds", "gauge", "Time spent rendering this page");
+  out(&w, METRICS_PREFIX "scrape_duration_seconds %.6f\n", (esp_timer_get_time() - started) / 1e6);
+
+  flush(&w);
+
+  if (w.err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Scrape failed: %s", esp_err_to_name(w.err));
+    return w.err;
+  }
+
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void render_pressure(metrics_writer_t *w)
+{
+  pressure_value_t pressures[SENSORS_COUNT];
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    pressures[i] = get_pressure(i);
+
+  family(w, "pressure_pa", "gauge", "Channel pressure, absent while the sensor is not ok");
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    if (pressures[i] >= 0)
+      out(w, METRICS_PREFIX "pressure_pa{channel=\"%d\"} %d\n", i, pressures[i]);
+  }
+
+  family(w, "sensor_state", "gauge", "0 ok, 1 absent, 2 overloaded, 3 reference power error");
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    uint8_t state = pressures[i] >= 0 ? 0 : pressures[i] == PRESSURE_SENSOR_ABSENT ? 1 : pressures[i] == PRESSURE_SENSOR_OVERLOAD ? 2 : 3;
+    out(w, METRICS_PREFIX "sensor_state{channel=\"%d\"} %d\n", i, state);
+  }
+
+  relay_control_state_t controller;
+
+  if (!relay_control_get_state(&controller))
+    return;
+
+  compressor_health_t health;
+  compressor_health_get(&health);
+
+  family(w, "compressor_runs_total", "counter", "Compressor runs seen by the health monitor");
+  out(w, METRICS_PREFIX "compressor_runs_total %u\n", health.runs_total);
+
+  family(w, "compressor_degradation_percent", "gauge", "How much slower the pump fills near the high mark than its baseline");
+  out(w, METRICS_PREFIX "compressor_degradation_percent %d\n", health.degradation);
+
+  family(w, "compressor_top_fill_rate_pa_per_second", "gauge", "Fill rate just under the high mark");
+  out(w, METRICS_PREFIX "compressor_top_fill_rate_pa_per_second{window=\"baseline\"} %d\n", health.baseline_top_fill_rate);
+  out(w, METRICS_PREFIX "compressor_top_fill_rate_pa_per_second{window=\"recent\"} %d\n", health.recent_top_fill_rate);
+}
+
+static void render_relays(metrics_writer_t *w)
+{
+  family(w, "relay_state", "gauge", "1 if the relay is ON");
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    out(w, METRICS_PREFIX "relay_state{relay=\"%d\"} %d\n", i, relay_get_state(i) == RELAY_ON);
+
+  family(w, "relay_on_seconds_total", "counter", "Time the relay has been ON");
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    out(w, METRICS_PREFIX "relay_on_seconds_total{relay=\"%d\"} %.3f\n", i, relay_get_on_time_ms(i) / 1000.0);
+}
+
+static void render_registry(metrics_writer_t *w)
+{
+  for (uint8_t id = 0; id < METRICS_COUNT; id++)
+  {
+    const metric_def_t *def = &registry_defs[id];
+
+    family(w, def->name, def->type, def->help);
+
+    for (uint8_t slot = 0; slot < def->slots; slot++)
+    {
+      uint32_t value = atomic_load_explicit(&registry[id][slot], memory_order_relaxed);
+
+      if (def->label != NULL)
+        out(w, METRICS_PREFIX "%s{%s=\"%d\"} %u\n", def->name, def->label, slot, value);
+      else
+        out(w, METRICS_PREFIX "%s %u\n", def->name, value);
+    }
+  }
+
+  uint32_t posted     = atomic_load_explicit(&registry[METRIC_EVENTS_POSTED][0], memory_order_relaxed);
+  uint32_t dispatched = atomic_load_explicit(&registry[METRIC_EVENTS_DISPATCHED][0], memory_order_relaxed);
+
+  family(w, "event_queue_depth", "gauge", "Application events waiting in the default loop");
+  out(w, METRICS_PREFIX "event_queue_depth %d\n", (int32_t)(posted - dispatched) > 0 ? (int32_t)(posted - dispatched) : 0);
+}
+
+static void render_histograms(metrics_writer_t *w)
+{
+  for (uint8_t id = 0; id < METRIC_HISTOGRAMS_COUNT; id++)
+  {
+    metric_histogram_t *histogram = &histograms[id];
+    uint32_t count                = 0;
+
+    family(w, histogram->name, "histogram", histogram->help);
+
+    for (uint8_t bucket = 0; bucket <= METRICS_HISTOGRAM_BUCKETS; bucket++)
+    {
+      count += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+
+      if (bucket < METRICS_HISTOGRAM_BUCKETS)
+        out(w, METRICS_PREFIX "%s_bucket{le=\"%.4f\"} %u\n", histogram->name, histogram->bounds_us[bucket] / 1e6, count);
+      else
+        out(w, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %u\n", histogram->name, count);
+    }
+
+    uint32_t sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+
+    out(w, METRICS_PREFIX "%s_sum %.6f\n", histogram->name, (double)sum * histogram->sum_unit_us / 1e6);
+    out(w, METRICS_PREFIX "%s_count %u\n", histogram->name, count);
+  }
+}
+
+static void render_system(metrics_writer_t *w)
+{
+  family(w, "uptime_seconds", "counter", "Time since boot");
+  out(w, METRICS_PREFIX "uptime_seconds %lld\n", esp_timer_get_time() / 1000000);
+
+  family(w, "heap_free_bytes", "gauge", "Free heap");
+  out(w, METRICS_PREFIX "heap_free_bytes %u\n", esp_get_free_heap_size());
+
+  family(w, "heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+  out(w, METRICS_PREFIX "heap_min_free_bytes %u\n", esp_get_minimum_free_heap_size());
+
+  family(w, "heap_largest_free_block_bytes", "gauge", "Largest allocatable 8-bit block");
+  out(w, METRICS_PREFIX "heap_largest_free_block_bytes %u\n", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+static void render_tasks(metrics_writer_t *w)
+{
+  UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, NULL);
+
+  if (count == 0)
+  {
+    ESP_LOGW(TAG, "More than %d tasks, stacks are not reported", METRICS_MAX_TASKS);
+    return;
+  }
+
+  family(w, "task_stack_free_min_bytes", "gauge", "Stack high water mark, the least free stack a task ever had");
+
+  for (UBaseType_t i = 0; i < count; i++)
+    out(w, METRICS_PREFIX "task_stack_free_min_bytes{task=\"%s\"} %u\n", tasks[i].pcTaskName, tasks[i].usStackHighWaterMark);
+}
+
+static void render_wifi(metrics_writer_t *w)
+{
+  wifi_ap_record_t ap;
+  bool connected = esp_wifi_sta_get_ap_info(&ap) == ESP_OK;
+
+  family(w, "wifi_connected", "gauge", "1 while associated with an access point");
+  out(w, METRICS_PREFIX "wifi_connected %d\n", connected);
+
+  if (!connected)
+    return;
+
+  family(w, "wifi_rssi_dbm", "gauge", "Signal strength of the access point");
+  out(w, METRICS_PREFIX "wifi_rssi_dbm %d\n", ap.rssi);
+}
+
+static void render_screens(metrics_writer_t *w)
+{
+  screen_stats_t stats[SCREENS_COUNT];
+
+  for (uint8_t i = 0; i < SCREENS_COUNT; i++)
+    screens_get_stats(i, &stats[i]);
+
+  family(w, "ui_screen_builds_total", "counter", "Times the screen was built");
+
+  for (uint8_t i = 0; i < SCREENS_COUNT; i++)
+  {
+    if (screens_get_name(i) != NULL)
+      out(w, METRICS_PREFIX "ui_screen_builds_total{screen=\"%s\"} %u\n", screens_get_name(i), stats[i].builds);
+  }
+
+  family(w, "ui_screen_lvgl_heap_peak_bytes", "gauge", "Most LVGL heap in use while the screen was shown");
+
+  for (uint8_t i = 0; i < SCREENS_COUNT; i++)
+  {
+    if (stats[i].builds > 0)
+      out(w, METRICS_PREFIX "ui_screen_lvgl_heap_peak_bytes{screen=\"%s\"} %u\n", screens_get_name(i), stats[i].mem_peak);
+  }
+}
+
+// The GUI task stack is in task_stack_free_min_bytes with the others
+static void render_ui_perf(metrics_writer_t *w)
+{
+  static const uint16_t bounds_ms[] = UI_PERF_HISTOGRAM_BOUNDS_MS;
+  ui_perf_stats_t s;
+  uint32_t count = 0;
+
+  ui_perf_get(&s);
+
+  family(w, "ui_frame_seconds", "histogram", "Render and flush time of the display refreshes");
+
+  // the last bucket takes the rest, it is +Inf
+  for (uint8_t bucket = 0; bucket < UI_PERF_HISTOGRAM_BUCKETS; bucket++)
+  {
+    count += s.frame_histogram[bucket];
+
+    if (bucket < UI_PERF_HISTOGRAM_BUCKETS - 1)
+      out(w, METRICS_PREFIX "ui_frame_seconds_bucket{le=\"%.3f\"} %u\n", bounds_ms[bucket] / 1e3, count);
+    else
+      out(w, METRICS_PREFIX "ui_frame_seconds_bucket{le=\"+Inf\"} %u\n", count);
+  }
+
+  out(w, METRICS_PREFIX "ui_frame_seconds_sum %.6f\n", s.frame_us_total / 1e6);
+  out(w, METRICS_PREFIX "ui_frame_seconds_count %u\n", count);
+
+  family(w, "ui_frame_max_seconds", "gauge", "Longest display refresh");
+  out(w, METRICS_PREFIX "ui_frame_max_seconds %.6f\n", s.frame_us_max / 1e6);
+
+  family(w, "ui_frame_pixels_total", "counter", "Pixels redrawn, per frame with ui_frame_seconds_count");
+  out(w, METRICS_PREFIX "ui_frame_pixels_total %llu\n", s.px_total);
+
+  family(w, "ui_frame_pixels_max", "gauge", "Most pixels redrawn by a refresh");
+  out(w, METRICS_PREFIX "ui_frame_pixels_max %u\n", s.px_max);
+
+  family(w, "ui_handler_calls_total", "counter", "lv_task_handler() calls of the GUI task");
+  out(w, METRICS_PREFIX "ui_handler_calls_total %u\n", s.handler_calls);
+
+  family(w, "ui_handler_seconds_total", "counter", "Time spent in lv_task_handler(), flushes included");
+  out(w, METRICS_PREFIX "ui_handler_seconds_total %.6f\n", s.handler_us_total / 1e6);
+
+  family(w, "ui_handler_max_seconds", "gauge", "Longest lv_task_handler() call");
+  out(w, METRICS_PREFIX "ui_handler_max_seconds %.6f\n", s.handler_us_max / 1e6);
+
+  family(w, "ui_lvgl_heap_used_bytes", "gauge", "LVGL heap in use");
+  out(w, METRICS_PREFIX "ui_lvgl_heap_used_bytes %u\n", s.lv_mem_used);
+
+  family(w, "ui_lvgl_heap_peak_bytes", "gauge", "Most LVGL heap in use since boot");
+  out(w, METRICS_PREFIX "ui_lvgl_heap_peak_bytes %u\n", s.lv_mem_max_used);
+
+  family(w, "ui_lvgl_heap_fragmentation_percent", "gauge", "LVGL heap fragmentation");
+  out(w, METRICS_PREFIX "ui_lvgl_heap_fragmentation_percent %u\n", s.lv_mem_frag);
+}
+
+static void family(metrics_writer_t *w, const char *name, const char *type, const char *help)
+{
+  out(w, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+}
+
+static void out(metrics_writer_t *w, const char *format, ...)
+{
+  va_list args;
+
+  // a second attempt goes to the flushed buffer
+  for (uint8_t attempt = 0; attempt < 2 && w->err == ESP_OK; attempt++)
+  {
+    size_t left = sizeof(buffer) - w->length;
+
+    va_start(args, format);
+    int length = vsnprintf(buffer + w->length, left, format, args);
+    va_end(args);
+
+    if (length >= 0 && length < left)
+    {
+      w->length += length;
+      return;
+    }
+
+    if (w->length == 0)
+      break;
+
+    flush(w);
+  }
+
+  if (w->err == ESP_OK)
+    ESP_LOGE(TAG, "A line does not fit %d bytes", sizeof(buffer));
+}
+
+static void flush(metrics_writer_t *w)
+{
+  if (w->length > 0 && w->err == ESP_OK)
+    w->err = httpd_resp_send_chunk(w->req, buffer, w->length);
+
+  w->length = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "relay.h"
+#include "rollup.h"
+
+/*
+  A fixed registry of counters and gauges, plain atomics updated lock-free from any task. Every
+  metric has a number of slots for its label values, channel or relay index. Everything else the
+  /metrics endpoint reports (pressure, heap, stacks, RSSI) is read when it is scraped.
+*/
+
+// id, name, type, slots, label, help
+#define _METRICS(METRIC)                                                                                                        \
+  METRIC(RELAY_STARTS, "relay_starts_total", "counter", RELAYS_COUNT, "relay", "Relay OFF to ON switches")                      \
+  METRIC(WIFI_DISCONNECTS, "wifi_disconnects_total", "counter", 1, NULL, "WiFi station disconnects")                            \
+  METRIC(WIFI_HINT_HITS, "wifi_hint_hits_total", "counter", 1, NULL, "Connects to the cached access point")                     \
+  METRIC(WIFI_HINT_MISSES, "wifi_hint_misses_total", "counter", 1, NULL, "Failed connects to the cached access point")          \
+  METRIC(EVENTS_POSTED, "events_posted_total", "counter", 1, NULL, "Application events posted to the default loop")             \
+  METRIC(EVENTS_POST_FAILED, "events_post_failures_total", "counter", 1, NULL, "Application events lost on a full loop")        \
+  METRIC(EVENTS_DISPATCHED, "events_dispatched_total", "counter", 1, NULL, "Application events taken by the default loop")      \
+  METRIC(EVENTS_DEPTH_MAX, "event_queue_depth_max", "gauge", 1, NULL, "Most application events waiting in the default loop")    \
+  METRIC(BOOT_FIRST_READING_MS, "boot_first_reading_milliseconds", "gauge", 1, NULL, "App start to the first pressure reading") \
+  METRIC(BOOT_IP_MS, "boot_ip_milliseconds", "gauge", 1, NULL, "App start to the first IP address")                             \
+  METRIC(WIFI_CONNECT_MS, "wifi_connect_milliseconds", "gauge", 1, NULL, "Last connect attempt start to an IP address")         \
+  METRIC(BT_RELEASED_BYTES, "bt_released_bytes", "gauge", 1, NULL, "Heap given back by the Bluetooth controller and host")      \
+  METRIC(ROLLUP_FLASH_ERRORS, "rollup_flash_errors_total", "counter", ROLLUP_TIERS_COUNT, "tier", "Failed erases and writes")   \
+  METRIC(ROLLUP_SKIPPED_SLOTS, "rollup_skipped_slots_total", "counter", ROLLUP_TIERS_COUNT, "tier", "Periods not stored")       \
+  METRIC(ROLLUP_DROPPED, "rollup_dropped_total", "counter", 1, NULL, "1 second aggregates lost on a full rollup queue")
+
+#define DEF_METRIC_ID(id, name, type, slots, label, help) METRIC_##id,
+
+typedef enum metric_id
+{
+  _METRICS(DEF_METRIC_ID)
+      METRICS_COUNT
+} metric_id_t;
+
+typedef enum metric_histogram_id
+{
+  METRIC_HISTOGRAM_MEASURE_CYCLE,  // time between two measure cycle starts
+  METRIC_HISTOGRAM_MEASURE_JITTER, // difference between two consecutive cycle times
+  METRIC_HISTOGRAMS_COUNT
+} metric_histogram_id_t;
+
+void metrics_add(metric_id_t id, uint8_t slot, uint32_t value);
+void metrics_set(metric_id_t id, uint8_t slot, uint32_t value);
+void metrics_set_max(metric_id_t id, uint8_t slot, uint32_t value);
+void metrics_observe(metric_histogram_id_t id, uint32_t value_us);
+
+// Counts an application event post, call with the esp_event_post() result
+void metrics_event_posted(esp_err_t err);
+
+// Counts the events taken by the loop, call before anything posts
+void metrics_init();
+// Registers GET /metrics, call after http_server_start()
+void metrics_start();
+
+#endif // _METRICS_H_
@@ -0,0 +1,645 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "modbus_server.h"
+#include "relay_control.h"
+#include "telemetry.h"
+
+static const char *TAG = "MODBUS";
+
+/*
+  One task serves every connection with select(), a request is answered before the next one is
+  read. Reads are built from telemetry_get_snapshot() and the controller settings, which never
+  wait on the control task, writes go through the relay_control setters.
+*/
+
+#define MODBUS_MBAP_SIZE 7
+#define MODBUS_PDU_MAX 253
+#define MODBUS_ADU_MAX (MODBUS_MBAP_SIZE + MODBUS_PDU_MAX)
+#define MODBUS_READ_BITS_MAX 2000
+#define MODBUS_READ_REGISTERS_MAX 125
+#define MODBUS_WRITE_BITS_MAX 1968
+#define MODBUS_WRITE_REGISTERS_MAX 123
+#define MODBUS_IDLE_TIMEOUT_US (60 * 1000000LL)
+#define MODBUS_STATS_INTERVAL_US (60 * 1000000LL)
+
+enum modbus_functions
+{
+  MODBUS_READ_COILS               = 0x01,
+  MODBUS_READ_HOLDING_REGISTERS   = 0x03,
+  MODBUS_READ_INPUT_REGISTERS     = 0x04,
+  MODBUS_WRITE_SINGLE_COIL        = 0x05,
+  MODBUS_WRITE_SINGLE_REGISTER    = 0x06,
+  MODBUS_WRITE_MULTIPLE_COILS     = 0x0F,
+  MODBUS_WRITE_MULTIPLE_REGISTERS = 0x10
+};
+
+enum modbus_exceptions
+{
+  MODBUS_OK                    = 0,
+  MODBUS_ILLEGAL_FUNCTION      = 0x01,
+  MODBUS_ILLEGAL_DATA_ADDRESS  = 0x02,
+  MODBUS_ILLEGAL_DATA_VALUE    = 0x03,
+  MODBUS_SERVER_DEVICE_FAILURE = 0x04
+};
+
+typedef struct modbus_client
+{
+  int sock;
+  int64_t active_at;
+  uint16_t length;
+  uint8_t buf[MODBUS_ADU_MAX];
+} modbus_client_t;
+
+/*
+  Declarations
+*/
+static void modbus_server_task(void *arg);
+static void accept_client(int listen_sock);
+static void read_client(modbus_client_t *client);
+static void close_client(modbus_client_t *client);
+static uint16_t handle_request(const uint8_t *request, uint16_t length, uint8_t *response);
+static uint8_t read_coils(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length);
+static uint8_t read_registers(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length);
+static uint8_t write_coils(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length);
+static uint8_t write_registers(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length);
+static void fill_coils(uint8_t *coils);
+static void fill_input_registers(uint16_t *registers);
+static bool fill_holding_registers(uint16_t *registers);
+static uint16_t get_u16(const uint8_t *buf);
+static void put_u16(uint8_t *buf, uint16_t value);
+static void put_i32(uint16_t *registers, int32_t value);
+static int32_t get_i32(const uint16_t *registers);
+
+static modbus_client_t clients[CONFIG_MODBUS_SERVER_MAX_CLIENTS];
+static uint8_t response[MODBUS_ADU_MAX];
+
+static modbus_server_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void modbus_server_start()
+{
+  if (CONFIG_MODBUS_SERVER_PORT == 0)
+  {
+    ESP_LOGI(TAG, "Disabled");
+    return;
+  }
+
+  for (uint8_t i = 0; i < CONFIG_MODBUS_SERVER_MAX_CLIENTS; i++)
+    clients[i].sock = -1;
+
+  xTaskCreatePinnedToCore(modbus_server_task, "modbus server", 4096, NULL, 1, NULL, 0);
+}
+
+void modbus_server_get_stats(modbus_server_stats_t *out)
+{
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+static void modbus_server_task(void *arg)
+{
+  int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+  if (listen_sock < 0)
+  {
+    ESP_LOGE(TAG, "Can't create a socket: errno %d", errno);
+    vTaskDelete(NULL);
+  }
+
+  struct sockaddr_in address = {
+      .sin_family      = AF_INET,
+      .sin_port        = htons(CONFIG_MODBUS_SERVER_PORT),
+      .sin_addr.s_addr = htonl(INADDR_ANY)};
+
+  int reuse = 1;
+  setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if (bind(listen_sock, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listen_sock, 2) != 0)
+  {
+    ESP_LOGE(TAG, "Can't listen on port %d: errno %d", CONFIG_MODBUS_SERVER_PORT, errno);
+    close(listen_sock);
+    vTaskDelete(NULL);
+  }
+
+  ESP_LOGI(TAG, "Listening on port %d, up to %d clients", CONFIG_MODBUS_SERVER_PORT, CONFIG_MODBUS_SERVER_MAX_CLIENTS);
+
+  int64_t stats_logged_at = esp_timer_get_time();
+
+  while (1)
+  {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listen_sock, &readable);
+
+    int max_sock = listen_sock;
+
+    for (uint8_t i = 0; i < CONFIG_MODBUS_SERVER_MAX_CLIENTS; i++)
+    {
+      if (clients[i].sock < 0)
+        continue;
+
+      FD_SET(clients[i].sock, &readable);
+      max_sock = clients[i].sock > max_sock ? clients[i].sock : max_sock;
+    }
+
+    struct timeval timeout = {.tv_sec = 1};
+
+    if (select(max_sock + 1, &readable, NULL, NULL, &timeout) < 0)
+    {
+      ESP_LOGE(TAG, "select() failed: errno %d", errno);
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+
+    if (FD_ISSET(listen_sock, &readable))
+      accept_client(listen_sock);
+
+    int64_t now = esp_timer_get_time();
+
+    for (uint8_t i = 0; i < CONFIG_MODBUS_SERVER_MAX_CLIENTS; i++)
+    {
+      modbus_client_t *client = &clients[i];
+
+      if (client->sock < 0)
+        continue;
+
+      if (FD_ISSET(client->sock, &readable))
+        read_client(client);
+      else if (now - client->active_at > MODBUS_IDLE_TIMEOUT_US)
+      {
+        ESP_LOGI(TAG, "Closing idle client %d", client->sock);
+        close_client(client);
+      }
+    }
+
+    if (now - stats_logged_at >= MODBUS_STATS_INTERVAL_US)
+    {
+      modbus_server_stats_t current;
+      modbus_server_get_stats(&current);
+
+      ESP_LOGI(TAG, "%u requests, %u exceptions, %u writes, handle avg %u us max %u us, %u connections, %u rejected",
+               current.requests, current.exceptions, current.writes,
+               current.requests > 0 ? (uint32_t)(current.handle_us_total / current.requests) : 0, current.handle_us_max,
+               current.connections, current.rejected);
+
+      stats_logged_at = now;
+    }
+  }
+}
+
+static void accept_client(int listen_sock)
+{
+  int sock = accept(listen_sock, NULL, NULL);
+
+  if (sock < 0)
+    return;
+
+  for (uint8_t i = 0; i < CONFIG_MODBUS_SERVER_MAX_CLIENTS; i++)
+  {
+    if (clients[i].sock >= 0)
+      continue;
+
+    // a stuck master must not hold up the others
+    struct timeval send_timeout = {.tv_sec = 1};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    clients[i] = (modbus_client_t){.sock = sock, .active_at = esp_timer_get_time()};
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.connections++;
+    portEXIT_CRITICAL(&stats_lock);
+
+    ESP_LOGI(TAG, "Client %d connected", sock);
+    return;
+  }
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.rejected++;
+  portEXIT_CRITICAL(&stats_lock);
+
+  ESP_LOGW(TAG, "No free slot, closing the connection");
+  close(sock);
+}
+
+// Several requests may come in one read and a request may be split over reads
+static void read_client(modbus_client_t *client)
+{
+  int received = recv(client->sock, client->buf + client->length, sizeof(client->buf) - client->length, 0);
+
+  if (received <= 0)
+  {
+    ESP_LOGI(TAG, "Client %d disconnected", client->sock);
+    close_client(client);
+    return;
+  }
+
+  client->length += received;
+  client->active_at = esp_timer_get_time();
+
+  while (client->length >= MODBUS_MBAP_SIZE)
+  {
+    uint16_t protocol = get_u16(client->buf + 2);
+    uint16_t length   = get_u16(client->buf + 4); // unit id and PDU
+
+    if (protocol != 0 || length < 2 || length > MODBUS_PDU_MAX + 1)
+    {
+      ESP_LOGW(TAG, "Client %d sent a broken frame, closing", client->sock);
+      close_client(client);
+      return;
+    }
+
+    uint16_t frame_length = 6 + length;
+
+    if (client->length < frame_length)
+      return;
+
+    int64_t started = esp_timer_get_time();
+
+    memcpy(response, client->buf, MODBUS_MBAP_SIZE);
+
+    uint16_t pdu_length = handle_request(client->buf + MODBUS_MBAP_SIZE, length - 1, response + MODBUS_MBAP_SIZE);
+    put_u16(response + 4, pdu_length + 1);
+
+    uint32_t handle_us = esp_timer_get_time() - started;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.requests++;
+    stats.exceptions += (response[MODBUS_MBAP_SIZE] & 0x80) != 0;
+    stats.handle_us_total += handle_us;
+    stats.handle_us_max = handle_us > stats.handle_us_max ? handle_us : stats.handle_us_max;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (send(client->sock, response, MODBUS_MBAP_SIZE + pdu_length, 0) != MODBUS_MBAP_SIZE + pdu_length)
+    {
+      ESP_LOGW(TAG, "Can't answer client %d: errno %d", client->sock, errno);
+      close_client(client);
+      return;
+    }
+
+    client->length -= frame_length;
+    memmove(client->buf, client->buf + frame_length, client->length);
+  }
+}
+
+static void close_client(modbus_client_t *client)
+{
+  close(client->sock);
+  client->sock   = -1;
+  client->length = 0;
+}
+
+// Returns the response PDU length
+static uint16_t handle_request(const uint8_t *request, uint16_t length, uint8_t *response)
+{
+  uint16_t response_length = 0;
+  uint8_t exception;
+
+  switch (request[0])
+  {
+  case MODBUS_READ_COILS:
+    exception = read_coils(request, length, response, &response_length);
+    break;
+
+  case MODBUS_READ_HOLDING_REGISTERS:
+  case MODBUS_READ_INPUT_REGISTERS:
+    exception = read_registers(request, length, response, &response_length);
+    break;
+
+  case MODBUS_WRITE_SINGLE_COIL:
+  case MODBUS_WRITE_MULTIPLE_COILS:
+    exception = write_coils(request, length, response, &response_length);
+    break;
+
+  case MODBUS_WRITE_SINGLE_REGISTER:
+  case MODBUS_WRITE_MULTIPLE_REGISTERS:
+    exception = write_registers(request, length, response, &response_length);
+    break;
+
+  default:
+    exception = MODBUS_ILLEGAL_FUNCTION;
+  }
+
+  if (exception != MODBUS_OK)
+  {
+    response[0] = request[0] | 0x80;
+    response[1] = exception;
+    return 2;
+  }
+
+  return response_length;
+}
+
+static uint8_t read_coils(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length)
+{
+  if (length != 5)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  uint16_t address = get_u16(request + 1);
+  uint16_t count   = get_u16(request + 3);
+
+  if (count == 0 || count > MODBUS_READ_BITS_MAX)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  if (address + count > MODBUS_COIL_COUNT)
+    return MODBUS_ILLEGAL_DATA_ADDRESS;
+
+  uint8_t coils[MODBUS_COIL_COUNT];
+  fill_coils(coils);
+
+  uint8_t bytes = (count + 7) / 8;
+
+  response[0] = request[0];
+  response[1] = bytes;
+  memset(response + 2, 0, bytes);
+
+  for (uint16_t i = 0; i < count; i++)
+    response[2 + i / 8] |= coils[address + i] << (i % 8);
+
+  *response_length = 2 + bytes;
+
+  return MODBUS_OK;
+}
+
+static uint8_t read_registers(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length)
+{
+  if (length != 5)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  uint16_t address = get_u16(request + 1);
+  uint16_t count   = get_u16(request + 3);
+
+  if (count == 0 || count > MODBUS_READ_REGISTERS_MAX)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  uint16_t registers[(int)MODBUS_IR_COUNT > (int)MODBUS_HR_COUNT ? MODBUS_IR_COUNT : MODBUS_HR_COUNT];
+  uint16_t registers_count;
+
+  if (request[0] == MODBUS_READ_INPUT_REGISTERS)
+  {
+    registers_count = MODBUS_IR_COUNT;
+
+    if (address + count > registers_count)
+      return MODBUS_ILLEGAL_DATA_ADDRESS;
+
+    fill_input_registers(registers);
+  }
+  else
+  {
+    registers_count = MODBUS_HR_COUNT;
+
+    if (address + count > registers_count)
+      return MODBUS_ILLEGAL_DATA_ADDRESS;
+
+    if (!fill_holding_registers(registers))
+      return MODBUS_SERVER_DEVICE_FAILURE;
+  }
+
+  response[0] = request[0];
+  response[1] = count * 2;
+
+  for (uint16_t i = 0; i < count; i++)
+    put_u16(response + 2 + i * 2, registers[address + i]);
+
+  *response_length = 2 + count * 2;
+
+  return MODBUS_OK;
+}
+
+// Everything is checked before anything is applied, so a rejected request changes nothing
+static uint8_t write_coils(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length)
+{
+  uint8_t coils[MODBUS_COIL_COUNT];
+  uint16_t address, count;
+
+  if (length < 5)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  address = get_u16(request + 1);
+
+  if (request[0] == MODBUS_WRITE_SINGLE_COIL)
+  {
+    uint16_t value = get_u16(request + 3);
+
+    if (length != 5 || (value != 0xFF00 && value != 0x0000))
+      return MODBUS_ILLEGAL_DATA_VALUE;
+
+    count = 1;
+  }
+  else
+  {
+    count = get_u16(request + 3);
+
+    if (length < 6 || count == 0 || count > MODBUS_WRITE_BITS_MAX || request[5] != (count + 7) / 8 || length != 6 + request[5])
+      return MODBUS_ILLEGAL_DATA_VALUE;
+  }
+
+  if (address + count > MODBUS_COIL_COUNT)
+    return MODBUS_ILLEGAL_DATA_ADDRESS;
+
+  fill_coils(coils);
+
+  uint8_t written[MODBUS_COIL_COUNT];
+  memcpy(written, coils, sizeof(coils));
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    if (request[0] == MODBUS_WRITE_SINGLE_COIL)
+      written[address + i] = request[3] == 0xFF;
+    else
+      written[address + i] = (request[6 + i / 8] >> (i % 8)) & 1;
+  }
+
+  relay_control_state_t controller;
+
+  if (!relay_control_get_state(&controller))
+    return MODBUS_SERVER_DEVICE_FAILURE;
+
+  bool manual          = written[MODBUS_COIL_MANUAL_OVERRIDE];
+  uint8_t relay_coil   = MODBUS_COIL_RELAYS + controller.relay_index;
+  bool relay_written   = address <= relay_coil && relay_coil < address + count;
+  bool relay_commanded = relay_written && (manual || written[relay_coil] != coils[relay_coil]);
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+  {
+    uint8_t coil = MODBUS_COIL_RELAYS + i;
+
+    if (coil != relay_coil && written[coil] != coils[coil])
+      return MODBUS_ILLEGAL_DATA_ADDRESS;
+  }
+
+  if (relay_commanded && !manual)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  if (relay_control_set_override(manual) != ESP_OK ||
+      (relay_commanded && relay_control_set_manual_relay(written[relay_coil]) != ESP_OK))
+    return MODBUS_SERVER_DEVICE_FAILURE;
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.writes++;
+  portEXIT_CRITICAL(&stats_lock);
+
+  // both write functions echo the address and the value or count
+  memcpy(response, request, 5);
+  *response_length = 5;
+
+  return MODBUS_OK;
+}
+
+static uint8_t write_registers(const uint8_t *request, uint16_t length, uint8_t *response, uint16_t *response_length)
+{
+  uint16_t registers[MODBUS_HR_COUNT];
+  uint16_t address, count;
+  const uint8_t *values;
+
+  if (length < 5)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  address = get_u16(request + 1);
+
+  if (request[0] == MODBUS_WRITE_SINGLE_REGISTER)
+  {
+    if (length != 5)
+      return MODBUS_ILLEGAL_DATA_VALUE;
+
+    count  = 1;
+    values = request + 3;
+  }
+  else
+  {
+    count = get_u16(request + 3);
+
+    if (length < 6 || count == 0 || count > MODBUS_WRITE_REGISTERS_MAX || request[5] != count * 2 || length != 6 + request[5])
+      return MODBUS_ILLEGAL_DATA_VALUE;
+
+    values = request + 6;
+  }
+
+  if (address + count > MODBUS_HR_COUNT)
+    return MODBUS_ILLEGAL_DATA_ADDRESS;
+
+  // a single half of a 32-bit mark is combined with the current other half
+  if (!fill_holding_registers(registers))
+    return MODBUS_SERVER_DEVICE_FAILURE;
+
+  for (uint16_t i = 0; i < count; i++)
+    registers[address + i] = get_u16(values + i * 2);
+
+  relay_control_settings_t settings = {
+      .pressure_low_mark  = get_i32(registers + MODBUS_HR_LOW_MARK),
+      .pressure_high_mark = get_i32(registers + MODBUS_HR_HIGH_MARK),
+      .max_on_time_s      = registers[MODBUS_HR_MAX_ON_TIME],
+      .min_off_time_s     = registers[MODBUS_HR_MIN_OFF_TIME]};
+
+  esp_err_t err = relay_control_set_settings(&settings);
+
+  if (err == ESP_ERR_INVALID_ARG)
+    return MODBUS_ILLEGAL_DATA_VALUE;
+
+  if (err != ESP_OK)
+    return MODBUS_SERVER_DEVICE_FAILURE;
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.writes++;
+  portEXIT_CRITICAL(&stats_lock);
+
+  memcpy(response, request, 5);
+  *response_length = 5;
+
+  return MODBUS_OK;
+}
+
+static void fill_coils(uint8_t *coils)
+{
+  relay_control_state_t controller;
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    coils[MODBUS_COIL_RELAYS + i] = relay_get_state(i) == RELAY_ON;
+
+  coils[MODBUS_COIL_MANUAL_OVERRIDE] = relay_control_get_state(&controller) && controller.manual_override;
+}
+
+static void fill_input_registers(uint16_t *registers)
+{
+  static telemetry_snapshot_t snapshot;
+
+  telemetry_get_snapshot(&snapshot);
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    put_i32(registers + MODBUS_IR_PRESSURE + i * 2, snapshot.channels[i].pressure);
+    put_i32(registers + MODBUS_IR_PRESSURE_1S + i * 2, snapshot.channels[i].last_1s.mean);
+  }
+
+  registers[MODBUS_IR_RELAYS] = 0;
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    registers[MODBUS_IR_RELAYS] |= (snapshot.relays[i] == RELAY_ON) << i;
+
+  const relay_control_state_t *c = &snapshot.controller;
+
+  registers[MODBUS_IR_CONTROLLER] = 0;
+
+  if (snapshot.controller_running)
+  {
+    registers[MODBUS_IR_CONTROLLER] = MODBUS_CONTROLLER_RUNNING |
+                                      (c->relay_on ? MODBUS_CONTROLLER_RELAY_ON : 0) |
+                                      (c->under_low_mark ? MODBUS_CONTROLLER_UNDER_LOW_MARK : 0) |
+                                      (c->above_high_mark ? MODBUS_CONTROLLER_ABOVE_HIGH_MARK : 0) |
+                                      (c->max_on_time_exceeded ? MODBUS_CONTROLLER_MAX_ON_EXCEEDED : 0) |
+                                      (c->min_off_time_passed ? MODBUS_CONTROLLER_MIN_OFF_PASSED : 0) |
+                                      (c->manual_override ? MODBUS_CONTROLLER_MANUAL_OVERRIDE : 0);
+  }
+
+  put_i32(registers + MODBUS_IR_UPTIME, snapshot.uptime_ms / 1000);
+  put_i32(registers + MODBUS_IR_SEQ, snapshot.seq);
+
+  registers[MODBUS_IR_DEGRADATION] = snapshot.controller_running ? snapshot.health.degradation : 0;
+}
+
+static bool fill_holding_registers(uint16_t *registers)
+{
+  relay_control_settings_t settings;
+
+  if (!relay_control_get_settings(&settings))
+    return false;
+
+  put_i32(registers + MODBUS_HR_LOW_MARK, settings.pressure_low_mark);
+  put_i32(registers + MODBUS_HR_HIGH_MARK, settings.pressure_high_mark);
+  registers[MODBUS_HR_MAX_ON_TIME]  = settings.max_on_time_s;
+  registers[MODBUS_HR_MIN_OFF_TIME] = settings.min_off_time_s;
+
+  return true;
+}
+
+static uint16_t get_u16(const uint8_t *buf)
+{
+  return buf[0] << 8 | buf[1];
+}
+
+static void put_u16(uint8_t *buf, uint16_t value)
+{
+  buf[0] = value >> 8;
+  buf[1] = value;
+}
+
+static void put_i32(uint16_t *registers, int32_t value)
+{
+  registers[0] = (uint32_t)value >> 16;
+  registers[1] = (uint32_t)value;
+}
+
+static int32_t get_i32(const uint16_t *registers)
+{
+  return (int32_t)((uint32_t)registers[0] << 16 | registers[1]);
+}
@@ -0,0 +1,92 @@
+#ifndef _MODBUS_SERVER_H_
+#define _MODBUS_SERVER_H_
+
+#include <stdint.h>
+
+#include "pressure_sensors.h"
+#include "relay.h"
+
+/*
+  Modbus TCP server on CONFIG_MODBUS_SERVER_PORT, any unit id is answered. 32-bit values take
+  two registers, the high word first. Pressures are Pa, or negative sensor states.
+
+  Input registers (4):
+    0..9    int32   fast pressure of sensor n at 2n
+    10..19  int32   last 1 s mean of sensor n at 10 + 2n
+    20      bits    relay n is ON
+    21      bits    controller, enum modbus_controller_bits
+    22..23  uint32  uptime, s
+    24..25  uint32  telemetry sequence, changes whenever anything else does
+    26              compressor degradation, %
+
+  Holding registers (3, 6, 16), a write is validated and applied as a whole, see
+  relay_control_set_settings():
+    0..1    int32   pressure low mark, Pa
+    2..3    int32   pressure high mark, Pa
+    4               max ON time, s
+    5               min OFF time, s
+
+  Coils (1, 5, 15):
+    0..1    relay n is ON, the controlled relay is writable under the manual override
+    2       manual override
+
+  A coil write that leaves a read-only coil as it is succeeds, so a block can be read, changed
+  and written back.
+*/
+
+enum modbus_input_registers
+{
+  MODBUS_IR_PRESSURE    = 0,
+  MODBUS_IR_PRESSURE_1S = MODBUS_IR_PRESSURE + SENSORS_COUNT * 2,
+  MODBUS_IR_RELAYS      = MODBUS_IR_PRESSURE_1S + SENSORS_COUNT * 2,
+  MODBUS_IR_CONTROLLER,
+  MODBUS_IR_UPTIME,
+  MODBUS_IR_SEQ         = MODBUS_IR_UPTIME + 2,
+  MODBUS_IR_DEGRADATION = MODBUS_IR_SEQ + 2,
+  MODBUS_IR_COUNT
+};
+
+enum modbus_controller_bits
+{
+  MODBUS_CONTROLLER_RUNNING         = 0x01,
+  MODBUS_CONTROLLER_RELAY_ON        = 0x02,
+  MODBUS_CONTROLLER_UNDER_LOW_MARK  = 0x04,
+  MODBUS_CONTROLLER_ABOVE_HIGH_MARK = 0x08,
+  MODBUS_CONTROLLER_MAX_ON_EXCEEDED = 0x10,
+  MODBUS_CONTROLLER_MIN_OFF_PASSED  = 0x20,
+  MODBUS_CONTROLLER_MANUAL_OVERRIDE = 0x40
+};
+
+enum modbus_holding_registers
+{
+  MODBUS_HR_LOW_MARK     = 0,
+  MODBUS_HR_HIGH_MARK    = 2,
+  MODBUS_HR_MAX_ON_TIME  = 4,
+  MODBUS_HR_MIN_OFF_TIME = 5,
+  MODBUS_HR_COUNT
+};
+
+enum modbus_coils
+{
+  MODBUS_COIL_RELAYS          = 0,
+  MODBUS_COIL_MANUAL_OVERRIDE = MODBUS_COIL_RELAYS + RELAYS_COUNT,
+  MODBUS_COIL_COUNT
+};
+
+typedef struct modbus_server_stats
+{
+  uint32_t connections;
+  uint32_t rejected; // connections refused as all the slots were taken
+  uint32_t requests;
+  uint32_t exceptions;
+  uint32_t writes; // accepted
+  uint64_t handle_us_total;
+  uint32_t handle_us_max;
+} modbus_server_stats_t;
+
+// Call after wifi_init()
+void modbus_server_start();
+
+void modbus_server_get_stats(modbus_server_stats_t *stats);
+
+#endif // _MODBUS_SERVER_H_
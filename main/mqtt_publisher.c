@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+
+#include "mqtt_publisher.h"
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "tslog.h"
+
+#include "utils.h"
+
+static const char *TAG = "MQTT";
+
+/*
+  Records wait in a bounded RAM ring until the broker acknowledges the message they went out in.
+  Every record has a sequence number, a message covers a range of them and its PUBACK moves the
+  ring head past the range. A full ring drops its oldest record, and since tslog keeps the same
+  aggregates and transitions in flash, only the time range of the dropped records is remembered
+  and is published later from the log. That backlog is older than anything in RAM, so it goes
+  first, and both are drained one message per CONFIG_MQTT_PUBLISHER_DRAIN_INTERVAL_MS at most,
+  so a long outage doesn't flood the broker and WiFi on reconnect.
+
+  The log holds rows of changes only, replayed messages are sparser than the live ones.
+*/
+
+#define MQTT_RELAYS_PART_SIZE 512
+#define MQTT_ENVELOPE_SIZE 64
+#define MQTT_SAMPLES_PART_SIZE (CONFIG_MQTT_PUBLISHER_PAYLOAD_SIZE - MQTT_RELAYS_PART_SIZE - 2 * MQTT_ENVELOPE_SIZE)
+#define MQTT_COPY_CHUNK 16
+#define MQTT_REPLAY_WINDOW_S 60
+#define MQTT_PUBACK_TIMEOUT_US (30 * 1000000LL)
+#define MQTT_STATS_INTERVAL_US (60 * 1000000LL)
+
+typedef enum
+{
+  RECORD_SAMPLE,
+  RECORD_RELAY
+} record_type_t;
+
+typedef struct mqtt_record
+{
+  uint32_t time; // tslog_time()
+  uint8_t type;  // record_type_t
+  uint8_t index; // channel or relay
+  uint8_t state; // relay_state_t
+  pressure_value_t mean;
+  pressure_value_t min;
+  pressure_value_t max;
+} mqtt_record_t;
+
+typedef struct mqtt_batch
+{
+  uint32_t t0;
+  size_t samples_length;
+  size_t relays_length;
+  uint16_t records;
+} mqtt_batch_t;
+
+typedef struct mqtt_pending
+{
+  bool active;
+  int msg_id;
+  int64_t sent_at;
+  bool from_backlog;
+  uint32_t next; // the first record sequence or backlog time after the message
+  uint16_t records;
+  size_t length;
+} mqtt_pending_t;
+
+/*
+  Declarations
+*/
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void relay_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void queue_push(const mqtt_record_t *record);
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+static void published(int msg_id);
+static void complete_pending();
+static void mqtt_publisher_task(void *arg);
+static bool publish_next(bool *full);
+static bool build_from_queue(mqtt_pending_t *message, bool *full);
+static bool build_from_backlog(mqtt_pending_t *message, bool *full);
+static void replay_row(const tslog_row_t *row, void *arg);
+static void batch_begin(mqtt_batch_t *batch, uint32_t t0);
+static bool batch_add(mqtt_batch_t *batch, const mqtt_record_t *record);
+static size_t batch_end(mqtt_batch_t *batch, uint32_t seq);
+
+static esp_mqtt_client_handle_t client;
+static TaskHandle_t publisher_task;
+static bool connected;
+
+static mqtt_record_t *records;
+static uint32_t head_seq; // the oldest record in RAM
+static uint32_t tail_seq; // the next record to push
+static bool has_backlog;
+static uint32_t backlog_from;
+static uint32_t backlog_to;
+static mqtt_pending_t pending;
+static int early_puback = -1;
+static portMUX_TYPE queue_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t message_seq;
+static char payload[CONFIG_MQTT_PUBLISHER_PAYLOAD_SIZE];
+static char relays_part[MQTT_RELAYS_PART_SIZE];
+
+static mqtt_publisher_stats_t stats;
+
+void mqtt_publisher_start()
+{
+  if (strlen(CONFIG_MQTT_PUBLISHER_BROKER_URI) == 0)
+  {
+    ESP_LOGI(TAG, "No broker configured, publishing is disabled");
+    return;
+  }
+
+  records = calloc(CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS, sizeof(mqtt_record_t));
+  ESP_MEM_CHECK(TAG, records, return);
+
+  esp_mqtt_client_config_t config = {.uri = CONFIG_MQTT_PUBLISHER_BROKER_URI};
+
+  client = esp_mqtt_client_init(&config);
+  ESP_MEM_CHECK(TAG, client, return);
+
+  ESP_ERROR_CHECK(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
+
+  xTaskCreate(mqtt_publisher_task, "mqtt pub", 4096, NULL, 1, &publisher_task);
+
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1S, aggregate_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAYS_EVENTS, ESP_EVENT_ANY_ID, relay_handler, NULL, NULL);
+
+  // reconnects by itself, WiFi may come up later
+  ESP_ERROR_CHECK(esp_mqtt_client_start(client));
+
+  ESP_LOGI(TAG, "Publishing to %s every %d s, %d records queue",
+           CONFIG_MQTT_PUBLISHER_BROKER_URI, CONFIG_MQTT_PUBLISHER_INTERVAL_S, CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS);
+}
+
+void mqtt_publisher_get_stats(mqtt_publisher_stats_t *out)
+{
+  portENTER_CRITICAL(&queue_lock);
+
+  *out             = stats;
+  out->queue_depth = tail_seq - head_seq;
+  out->backlog_s   = has_backlog ? backlog_to - backlog_from + 1 : 0;
+
+  portEXIT_CRITICAL(&queue_lock);
+}
+
+/*
+  Sources
+*/
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  pressure_aggregate_t *aggregate = (pressure_aggregate_t *)event_data;
+
+  mqtt_record_t record = {
+      .time  = tslog_time(),
+      .type  = RECORD_SAMPLE,
+      .index = aggregate->index,
+      .mean  = aggregate->mean,
+      .min   = aggregate->count > 0 ? aggregate->min : aggregate->mean,
+      .max   = aggregate->count > 0 ? aggregate->max : aggregate->mean};
+
+  queue_push(&record);
+}
+
+static void relay_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  mqtt_record_t record = {
+      .time  = tslog_time(),
+      .type  = RECORD_RELAY,
+      .index = *(uint8_t *)event_data,
+      .state = event_id == RELAY_TURNED_ON ? RELAY_ON : RELAY_OFF};
+
+  queue_push(&record);
+}
+
+static void queue_push(const mqtt_record_t *record)
+{
+  portENTER_CRITICAL(&queue_lock);
+
+  if (tail_seq - head_seq == CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS)
+  {
+    // the log has it, keep the time range only
+    uint32_t time = records[head_seq % CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS].time;
+
+    if (!has_backlog)
+      backlog_from = time;
+
+    has_backlog = true;
+    backlog_to  = time > backlog_to ? time : backlog_to;
+    head_seq++;
+    stats.overflowed++;
+  }
+
+  records[tail_seq++ % CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS] = *record;
+
+  portEXIT_CRITICAL(&queue_lock);
+}
+
+/*
+  Client
+*/
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+  esp_mqtt_event_handle_t event = event_data;
+
+  switch (event_id)
+  {
+  case MQTT_EVENT_CONNECTED:
+    ESP_LOGI(TAG, "Connected");
+    connected = true;
+    xTaskNotifyGive(publisher_task);
+    break;
+
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGI(TAG, "Disconnected");
+    connected = false;
+    break;
+
+  case MQTT_EVENT_PUBLISHED:
+    published(event->msg_id);
+    xTaskNotifyGive(publisher_task);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// The client resends an unacknowledged message itself after a reconnect, so a pending message
+// stays pending over a disconnect and is only built again if its PUBACK never comes
+static void published(int msg_id)
+{
+  portENTER_CRITICAL(&queue_lock);
+
+  // the publish call has not returned the id yet
+  if (pending.active && pending.msg_id < 0)
+    early_puback = msg_id;
+  else if (pending.active && pending.msg_id == msg_id)
+    complete_pending();
+
+  portEXIT_CRITICAL(&queue_lock);
+}
+
+// Under queue_lock
+static void complete_pending()
+{
+  uint32_t latency = esp_timer_get_time() - pending.sent_at;
+
+  if (pending.from_backlog)
+  {
+    backlog_from = pending.next;
+    has_backlog  = backlog_from <= backlog_to;
+  }
+  else if ((int32_t)(pending.next - head_seq) > 0)
+    head_seq = pending.next;
+
+  stats.published++;
+  stats.records += pending.records;
+  stats.bytes += pending.length;
+  stats.latency_us_total += latency;
+  stats.latency_us_max = latency > stats.latency_us_max ? latency : stats.latency_us_max;
+
+  pending.active = false;
+}
+
+static void mqtt_publisher_task(void *arg)
+{
+  int64_t next_publish    = esp_timer_get_time() + CONFIG_MQTT_PUBLISHER_INTERVAL_S * 1000000LL;
+  int64_t stats_logged_at = esp_timer_get_time();
+  bool draining           = false;
+
+  while (1)
+  {
+    int64_t now  = esp_timer_get_time();
+    int64_t wait = next_publish > now ? next_publish - now : 0;
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000) + 1);
+
+    now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&queue_lock);
+
+    bool busy = pending.active;
+
+    if (busy && now - pending.sent_at > MQTT_PUBACK_TIMEOUT_US)
+    {
+      pending.active = false;
+      stats.timeouts++;
+      busy = false;
+    }
+
+    portEXIT_CRITICAL(&queue_lock);
+
+    if (now - stats_logged_at >= MQTT_STATS_INTERVAL_US)
+    {
+      mqtt_publisher_stats_t current;
+      mqtt_publisher_get_stats(&current);
+
+      ESP_LOGI(TAG, "%u messages, %u records, %llu bytes, %u bytes/record, latency avg %u us max %u us, queue %d, backlog %u s, %u overflowed, %u timeouts",
+               current.published, current.records, current.bytes,
+               current.records > 0 ? (uint32_t)(current.bytes / current.records) : 0,
+               current.published > 0 ? (uint32_t)(current.latency_us_total / current.published) : 0,
+               current.latency_us_max, current.queue_depth, current.backlog_s, current.overflowed, current.timeouts);
+
+      stats_logged_at = now;
+    }
+
+    if (!connected || busy || now < next_publish)
+      continue;
+
+    bool full = false;
+
+    if (!publish_next(&full))
+    {
+      next_publish = now + CONFIG_MQTT_PUBLISHER_INTERVAL_S * 1000000LL;
+      continue;
+    }
+
+    // more than a message waits: a backlog to drain, at the capped rate
+    draining     = full || has_backlog;
+    next_publish = now + (draining ? CONFIG_MQTT_PUBLISHER_DRAIN_INTERVAL_MS * 1000LL : CONFIG_MQTT_PUBLISHER_INTERVAL_S * 1000000LL);
+  }
+}
+
+static bool publish_next(bool *full)
+{
+  mqtt_pending_t message = {0};
+
+  bool built = has_backlog ? build_from_backlog(&message, full) : build_from_queue(&message, full);
+
+  if (!built)
+    return false;
+
+  message.sent_at = esp_timer_get_time();
+  message.active  = true;
+  message.msg_id  = -1;
+
+  portENTER_CRITICAL(&queue_lock);
+  pending      = message;
+  early_puback = -1;
+  portEXIT_CRITICAL(&queue_lock);
+
+  int msg_id = esp_mqtt_client_publish(client, CONFIG_MQTT_PUBLISHER_TOPIC, payload, message.length, 1, 0);
+
+  // the PUBACK may have come before the call returned
+  portENTER_CRITICAL(&queue_lock);
+
+  pending.msg_id = msg_id;
+  pending.active = msg_id >= 0;
+
+  if (pending.active && early_puback == msg_id)
+    complete_pending();
+
+  portEXIT_CRITICAL(&queue_lock);
+
+  if (msg_id < 0)
+    ESP_LOGW(TAG, "Can't publish %d records", message.records);
+
+  return msg_id >= 0;
+}
+
+/*
+  Payload
+*/
+static bool build_from_queue(mqtt_pending_t *message, bool *full)
+{
+  mqtt_record_t chunk[MQTT_COPY_CHUNK];
+  mqtt_batch_t batch;
+  bool started = false;
+
+  portENTER_CRITICAL(&queue_lock);
+  uint32_t next = head_seq;
+  portEXIT_CRITICAL(&queue_lock);
+
+  while (!*full)
+  {
+    uint8_t count = 0;
+
+    // the ring may drop records meanwhile, copy a chunk under the lock and format it outside
+    portENTER_CRITICAL(&queue_lock);
+
+    if ((int32_t)(head_seq - next) > 0)
+      next = head_seq;
+
+    while (count < MQTT_COPY_CHUNK && next + count != tail_seq)
+    {
+      chunk[count] = records[(next + count) % CONFIG_MQTT_PUBLISHER_QUEUE_RECORDS];
+      count++;
+    }
+
+    portEXIT_CRITICAL(&queue_lock);
+
+    if (count == 0)
+      break;
+
+    if (!started)
+    {
+      batch_begin(&batch, chunk[0].time);
+      started = true;
+    }
+
+    for (uint8_t i = 0; i < count && !*full; i++)
+    {
+      if (batch_add(&batch, &chunk[i]))
+        next++;
+      else
+        *full = true;
+    }
+  }
+
+  if (!started || batch.records == 0)
+    return false;
+
+  message->from_backlog = false;
+  message->next         = next;
+  message->records      = batch.records;
+  message->length       = batch_end(&batch, message_seq++);
+
+  return true;
+}
+
+typedef struct replay
+{
+  mqtt_batch_t batch;
+  bool full;
+  uint32_t stopped_at;
+} replay_t;
+
+static bool build_from_backlog(mqtt_pending_t *message, bool *full)
+{
+  replay_t replay;
+  uint32_t next;
+
+  // windows with nothing logged are skipped without a message, steady pressure logs no rows
+  for (;;)
+  {
+    portENTER_CRITICAL(&queue_lock);
+    bool pending  = has_backlog;
+    uint32_t from = backlog_from;
+    uint32_t to   = backlog_to;
+    portEXIT_CRITICAL(&queue_lock);
+
+    if (!pending)
+      return build_from_queue(message, full);
+
+    if (to - from >= MQTT_REPLAY_WINDOW_S)
+      to = from + MQTT_REPLAY_WINDOW_S - 1;
+
+    replay = (replay_t){.full = false};
+
+    batch_begin(&replay.batch, from);
+    tslog_query(from, to, replay_row, &replay);
+
+    // a second which did not fit goes again in the next message, unless it was the first one
+    next = !replay.full ? to + 1 : replay.stopped_at > from ? replay.stopped_at : from + 1;
+
+    if (replay.batch.records > 0)
+      break;
+
+    portENTER_CRITICAL(&queue_lock);
+    backlog_from = next;
+    has_backlog  = backlog_from <= backlog_to;
+    portEXIT_CRITICAL(&queue_lock);
+  }
+
+  message->from_backlog = true;
+  message->next         = next;
+  message->records      = replay.batch.records;
+  message->length       = batch_end(&replay.batch, message_seq++);
+
+  *full = true;
+
+  return true;
+}
+
+static void replay_row(const tslog_row_t *row, void *arg)
+{
+  replay_t *replay = arg;
+
+  if (replay->full)
+    return;
+
+  mqtt_record_t record = {.time = row->time};
+
+  if (row->relay_index != TSLOG_NO_RELAY_EVENT)
+  {
+    record.type  = RECORD_RELAY;
+    record.index = row->relay_index;
+    record.state = row->relay_state;
+
+    replay->full = !batch_add(&replay->batch, &record);
+  }
+
+  for (uint8_t i = 0; i < SENSORS_COUNT && !replay->full; i++)
+  {
+    if ((row->changed & (1 << i)) == 0)
+      continue;
+
+    record.type  = RECORD_SAMPLE;
+    record.index = i;
+    record.mean  = row->values[i].mean;
+    record.min   = row->values[i].min;
+    record.max   = row->values[i].max;
+
+    replay->full = !batch_add(&replay->batch, &record);
+  }
+
+  if (replay->full)
+    replay->stopped_at = row->time;
+}
+
+static void batch_begin(mqtt_batch_t *batch, uint32_t t0)
+{
+  batch->t0             = t0;
+  batch->samples_length = 0;
+  batch->relays_length  = 0;
+  batch->records        = 0;
+}
+
+// Samples go straight to the payload after its head, relays to a part of their own
+static bool batch_add(mqtt_batch_t *batch, const mqtt_record_t *record)
+{
+  int32_t dt = record->time - batch->t0;
+  size_t left;
+  int length;
+
+  if (record->type == RECORD_SAMPLE)
+  {
+    left   = MQTT_SAMPLES_PART_SIZE - batch->samples_length;
+    length = snprintf(payload + MQTT_ENVELOPE_SIZE + batch->samples_length, left, "%s[%d,%u,%d,%d,%d]",
+                      batch->samples_length > 0 ? "," : "", dt, record->index, record->mean, record->min, record->max);
+
+    if (length >= left)
+      return false;
+
+    batch->samples_length += length;
+  }
+  else
+  {
+    left   = sizeof(relays_part) - batch->relays_length;
+    length = snprintf(relays_part + batch->relays_length, left, "%s[%d,%u,%u]",
+                      batch->relays_length > 0 ? "," : "", dt, record->index, record->state);
+
+    if (length >= left)
+      return false;
+
+    batch->relays_length += length;
+  }
+
+  batch->records++;
+
+  return true;
+}
+
+// Puts the head right before the samples and appends the relays, returns the payload length
+static size_t batch_end(mqtt_batch_t *batch, uint32_t seq)
+{
+  char head[MQTT_ENVELOPE_SIZE];
+  int head_length = snprintf(head, sizeof(head), "{\"seq\":%u,\"t0\":%u,\"s\":[", seq, batch->t0);
+
+  char *start = payload + MQTT_ENVELOPE_SIZE - head_length;
+  memcpy(start, head, head_length);
+
+  size_t length = head_length + batch->samples_length;
+  length += sprintf(start + length, "],\"r\":[%.*s]}", batch->relays_length, relays_part);
+
+  // messages always go from the start of the buffer
+  memmove(payload, start, length + 1);
+
+  return length;
+}
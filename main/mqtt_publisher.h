@@ -0,0 +1,34 @@
+#ifndef _MQTT_PUBLISHER_H_
+#define _MQTT_PUBLISHER_H_
+
+#include <stdint.h>
+
+/*
+  Publishes 1 second aggregates and relay transitions to CONFIG_MQTT_PUBLISHER_TOPIC, QoS 1,
+  one message per interval:
+
+    {"seq":12,"t0":1602000000,"s":[[dt,channel,mean,min,max],...],"r":[[dt,relay,state],...]}
+
+  t0 is tslog_time() of the first record, dt are seconds from it, pressure is Pa or a negative
+  sensor state. Delivery is at least once, a message may come again after a reconnect.
+*/
+
+typedef struct mqtt_publisher_stats
+{
+  uint32_t published;        // acknowledged messages
+  uint32_t records;          // in acknowledged messages
+  uint64_t bytes;            // payload bytes of acknowledged messages
+  uint32_t latency_us_max;   // publish to PUBACK
+  uint64_t latency_us_total;
+  uint32_t timeouts;         // messages built again for the lack of PUBACK
+  uint16_t queue_depth;      // records in RAM
+  uint32_t overflowed;       // records left to the flash log as the RAM queue was full
+  uint32_t backlog_s;        // seconds of the flash log still to publish
+} mqtt_publisher_stats_t;
+
+// Call before measure_start(), does nothing without a broker configured
+void mqtt_publisher_start();
+
+void mqtt_publisher_get_stats(mqtt_publisher_stats_t *stats);
+
+#endif // _MQTT_PUBLISHER_H_
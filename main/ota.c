@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_app_format.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "http_server.h"
+#include "ota.h"
+#include "pressure_sensors.h"
+#include "relay_control.h"
+
+static const char *TAG = "OTA";
+
+/*
+  The upload runs in the HTTP server task, below the sensor tasks, so the measure loop keeps its
+  pace on the CPU. What it cannot avoid are the flash erase and writes, which stop the cache of
+  both cores for a moment, so the loop is timed for the length of every upload by the stream of
+  sensor 0 and the result is logged and returned.
+*/
+
+#define OTA_CHUNK_SIZE 4096 // a flash sector
+#define OTA_RECV_RETRIES 5
+#define OTA_RESTART_DELAY_US (1000 * 1000LL)
+#define OTA_TOKEN_SIZE 65
+#define OTA_TIMED_SENSOR 0
+#define OTA_LATE_INTERVAL_US (PRESSURE_MEASURE_CYCLE_MS * 1000 * 3 / 2)
+#define OTA_SELF_TEST_MIN_CYCLES (PRESSURE_SAMPLES_PER_SEC * 10) // 10 seconds
+#define OTA_SELF_TEST_LATE_PERCENT 5
+
+/*
+  Declarations
+*/
+static esp_err_t ota_post_handler(httpd_req_t *req);
+static esp_err_t ota_get_handler(httpd_req_t *req);
+static const char *receive_image(httpd_req_t *req, esp_ota_handle_t handle, uint32_t *flash_us);
+static size_t receive_chunk(httpd_req_t *req, size_t remaining);
+static bool image_matches(const uint8_t *data, size_t length);
+static bool token_valid(httpd_req_t *req);
+static esp_err_t send_error(httpd_req_t *req, const char *status, const char *message);
+static void restart(void *arg);
+static void timing_cb(const pressure_aggregate_t *sample, void *arg);
+static void self_test_task(void *arg);
+static const char *self_test();
+static const char *image_state(const esp_partition_t *partition);
+
+static const httpd_uri_t endpoints[] = {
+    {.uri = "/api/v1/ota", .method = HTTP_POST, .handler = ota_post_handler},
+    {.uri = "/api/v1/ota", .method = HTTP_GET, .handler = ota_get_handler}};
+
+static uint8_t chunk[OTA_CHUNK_SIZE];
+static char response[384];
+
+static ota_upload_stats_t last_upload;
+static bool uploaded;
+
+// measure loop timing while an upload runs
+static volatile bool timing;
+static int64_t timed_at_us;
+static ota_upload_stats_t timed;
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void ota_init()
+{
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+
+  ESP_LOGI(TAG, "Running %s from %s", esp_ota_get_app_description()->version, running->label);
+
+  pressure_stream_subscribe(PRESSURE_RATE_FAST, timing_cb, NULL);
+
+  if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY)
+  {
+    ESP_LOGW(TAG, "New firmware, confirming it after the self-test");
+    xTaskCreate(self_test_task, "ota self-test", 3072, NULL, 1, NULL);
+  }
+}
+
+void ota_start()
+{
+  for (uint8_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++)
+    http_server_register(&endpoints[i]);
+
+  if (strlen(CONFIG_OTA_UPLOAD_TOKEN) == 0)
+    ESP_LOGW(TAG, "No upload token set, uploads are refused");
+}
+
+bool ota_get_last_upload(ota_upload_stats_t *stats)
+{
+  portENTER_CRITICAL(&timing_lock);
+  *stats    = last_upload;
+  bool done = uploaded;
+  portEXIT_CRITICAL(&timing_lock);
+
+  return done;
+}
+
+static esp_err_t ota_post_handler(httpd_req_t *req)
+{
+  // anyone on the network could flash the device without a token
+  if (strlen(CONFIG_OTA_UPLOAD_TOKEN) == 0)
+    return send_error(req, "403 Forbidden", "Set the OTA upload token in the firmware to enable uploads");
+
+  if (!token_valid(req))
+    return send_error(req, "401 Unauthorized", "Wrong X-OTA-Token");
+
+  const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+  if (partition == NULL)
+    return send_error(req, "500 Internal Server Error", "No OTA partition");
+
+  if (req->content_len == 0 || req->content_len > partition->size)
+  {
+    snprintf(response, sizeof(response), "Send the image as the body, up to %u bytes", partition->size);
+    return send_error(req, "400 Bad Request", response);
+  }
+
+  ESP_LOGI(TAG, "Receiving %u bytes into %s", req->content_len, partition->label);
+
+  int64_t started = esp_timer_get_time();
+
+  portENTER_CRITICAL(&timing_lock);
+  timed       = (ota_upload_stats_t){0};
+  timed_at_us = 0;
+  portEXIT_CRITICAL(&timing_lock);
+  timing = true;
+
+  // only the image size is erased, not the whole slot
+  esp_ota_handle_t handle;
+  esp_err_t err = esp_ota_begin(partition, req->content_len, &handle);
+
+  uint32_t flash_us = esp_timer_get_time() - started;
+
+  if (err != ESP_OK)
+  {
+    timing = false;
+    ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+    return send_error(req, "500 Internal Server Error", "Can't start the update");
+  }
+
+  const char *error = receive_image(req, handle, &flash_us);
+
+  // validates the whole image, a signed one as well if secure boot is on
+  err    = esp_ota_end(handle);
+  timing = false;
+
+  if (error != NULL)
+  {
+    ESP_LOGE(TAG, "Upload failed: %s", error);
+    return send_error(req, "400 Bad Request", error);
+  }
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Image is not valid: %s", esp_err_to_name(err));
+    return send_error(req, "400 Bad Request", "Image is not valid");
+  }
+
+  err = esp_ota_set_boot_partition(partition);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "esp_ota_set_boot_partition failed: %s", esp_err_to_name(err));
+    return send_error(req, "500 Internal Server Error", "Can't set the boot partition");
+  }
+
+  ota_upload_stats_t stats;
+
+  portENTER_CRITICAL(&timing_lock);
+  stats = timed;
+  portEXIT_CRITICAL(&timing_lock);
+
+  stats.bytes       = req->content_len;
+  stats.duration_ms = (esp_timer_get_time() - started) / 1000;
+  stats.flash_ms    = flash_us / 1000;
+
+  portENTER_CRITICAL(&timing_lock);
+  last_upload = stats;
+  uploaded    = true;
+  portEXIT_CRITICAL(&timing_lock);
+
+  ESP_LOGI(TAG, "%u bytes in %u ms, %u ms of it flash, measure loop: %u cycles, %u late, max %u us",
+           stats.bytes, stats.duration_ms, stats.flash_ms, stats.cycles, stats.late_cycles, stats.max_interval_us);
+
+  snprintf(response, sizeof(response),
+           "{\"partition\":\"%s\",\"bytes\":%u,\"duration_ms\":%u,\"flash_ms\":%u,"
+           "\"loop\":{\"cycles\":%u,\"late\":%u,\"max_interval_us\":%u},\"restarting\":true}",
+           partition->label, stats.bytes, stats.duration_ms, stats.flash_ms,
+           stats.cycles, stats.late_cycles, stats.max_interval_us);
+
+  httpd_resp_set_type(req, "application/json");
+  err = httpd_resp_sendstr(req, response);
+
+  // the response has to leave before the restart
+  const esp_timer_create_args_t timer_args = {.callback = &restart, .name = "ota restart"};
+  esp_timer_handle_t timer;
+
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+  ESP_ERROR_CHECK(esp_timer_start_once(timer, OTA_RESTART_DELAY_US));
+
+  return err;
+}
+
+static esp_err_t ota_get_handler(httpd_req_t *req)
+{
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  const esp_partition_t *next    = esp_ota_get_next_update_partition(NULL);
+  const esp_app_desc_t *app      = esp_ota_get_app_description();
+  ota_upload_stats_t stats;
+  bool done = ota_get_last_upload(&stats);
+
+  int length = snprintf(response, sizeof(response),
+                        "{\"version\":\"%s\",\"built\":\"%s %s\",\"running\":\"%s\",\"state\":\"%s\",\"next\":\"%s\"",
+                        app->version, app->date, app->time, running->label, image_state(running),
+                        next != NULL ? next->label : "");
+
+  if (done && length < sizeof(response))
+    length += snprintf(response + length, sizeof(response) - length,
+                       ",\"last_upload\":{\"bytes\":%u,\"duration_ms\":%u,\"flash_ms\":%u,"
+                       "\"loop\":{\"cycles\":%u,\"late\":%u,\"max_interval_us\":%u}}",
+                       stats.bytes, stats.duration_ms, stats.flash_ms,
+                       stats.cycles, stats.late_cycles, stats.max_interval_us);
+
+  if (length + 1 >= sizeof(response))
+    return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+
+  strcat(response, "}");
+
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, response);
+}
+
+// Returns an error message or NULL once the whole body is written
+static const char *receive_image(httpd_req_t *req, esp_ota_handle_t handle, uint32_t *flash_us)
+{
+  size_t received = 0;
+
+  while (received < req->content_len)
+  {
+    size_t length = receive_chunk(req, req->content_len - received);
+
+    if (length == 0)
+      return "Receive failed";
+
+    // the first chunk holds the app description, a wrong file is refused before it is written
+    if (received == 0 && !image_matches(chunk, length))
+      return "Not a firmware image of this project";
+
+    int64_t write_started = esp_timer_get_time();
+    esp_err_t err         = esp_ota_write(handle, chunk, length);
+    *flash_us += esp_timer_get_time() - write_started;
+
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "esp_ota_write failed: %s", esp_err_to_name(err));
+      return "Flash write failed";
+    }
+
+    received += length;
+  }
+
+  return NULL;
+}
+
+// Fills the chunk, or takes the rest of the body, so the flash gets whole sectors
+static size_t receive_chunk(httpd_req_t *req, size_t remaining)
+{
+  size_t wanted   = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+  size_t length   = 0;
+  uint8_t retries = 0;
+
+  while (length < wanted)
+  {
+    int received = httpd_req_recv(req, (char *)chunk + length, wanted - length);
+
+    if (received == HTTPD_SOCK_ERR_TIMEOUT && ++retries < OTA_RECV_RETRIES)
+      continue;
+
+    if (received <= 0)
+      return 0;
+
+    length += received;
+  }
+
+  return length;
+}
+
+static bool image_matches(const uint8_t *data, size_t length)
+{
+  const size_t desc_offset = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t);
+
+  if (length < desc_offset + sizeof(esp_app_desc_t) || data[0] != ESP_IMAGE_HEADER_MAGIC)
+    return false;
+
+  esp_app_desc_t desc;
+  memcpy(&desc, data + desc_offset, sizeof(desc));
+
+  if (desc.magic_word != ESP_APP_DESC_MAGIC_WORD)
+    return false;
+
+  ESP_LOGI(TAG, "Image %s %s built %s %s", desc.project_name, desc.version, desc.date, desc.time);
+
+  return strncmp(desc.project_name, esp_ota_get_app_description()->project_name, sizeof(desc.project_name)) == 0;
+}
+
+static bool token_valid(httpd_req_t *req)
+{
+  char token[OTA_TOKEN_SIZE];
+
+  if (httpd_req_get_hdr_value_str(req, "X-OTA-Token", token, sizeof(token)) != ESP_OK)
+    return false;
+
+  return strcmp(token, CONFIG_OTA_UPLOAD_TOKEN) == 0;
+}
+
+static esp_err_t send_error(httpd_req_t *req, const char *status, const char *message)
+{
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, "text/plain");
+  return httpd_resp_sendstr(req, message);
+}
+
+static void restart(void *arg)
+{
+  ESP_LOGW(TAG, "Restarting into the new firmware");
+  esp_restart();
+}
+
+static void timing_cb(const pressure_aggregate_t *sample, void *arg)
+{
+  if (!timing || sample->index != OTA_TIMED_SENSOR)
+    return;
+
+  portENTER_CRITICAL(&timing_lock);
+
+  if (timed_at_us != 0)
+  {
+    uint32_t interval_us = sample->timestamp_us - timed_at_us;
+
+    timed.cycles++;
+    timed.late_cycles += interval_us > OTA_LATE_INTERVAL_US;
+    timed.max_interval_us = interval_us > timed.max_interval_us ? interval_us : timed.max_interval_us;
+  }
+
+  timed_at_us = sample->timestamp_us;
+
+  portEXIT_CRITICAL(&timing_lock);
+}
+
+static void self_test_task(void *arg)
+{
+  int64_t deadline = esp_timer_get_time() + CONFIG_OTA_SELF_TEST_TIMEOUT_S * 1000000LL;
+  const char *failure;
+
+  while ((failure = self_test()) != NULL && esp_timer_get_time() < deadline)
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+  if (failure == NULL)
+  {
+    ESP_LOGI(TAG, "Self-test passed, firmware confirmed");
+    esp_ota_mark_app_valid_cancel_rollback();
+  }
+  else
+  {
+    ESP_LOGE(TAG, "Self-test failed: %s, rolling back", failure);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+
+  vTaskDelete(NULL);
+}
+
+// NULL once the measure loop keeps its pace and the controller gets readings
+static const char *self_test()
+{
+  pressure_loop_stats_t loop;
+  relay_control_state_t controller;
+
+  pressure_get_loop_stats(&loop);
+
+  if (loop.cycles < OTA_SELF_TEST_MIN_CYCLES)
+    return "the measure loop has not run long enough";
+
+  if (loop.late * 100 > loop.cycles * OTA_SELF_TEST_LATE_PERCENT)
+    return "the measure loop is late";
+
+  if (!relay_control_get_state(&controller))
+    return "the controller is not running";
+
+  if (get_pressure(controller.pressure_sensor_index) < 0)
+    return "the controlled sensor has no reading";
+
+  return NULL;
+}
+
+static const char *image_state(const esp_partition_t *partition)
+{
+  esp_ota_img_states_t state;
+
+  if (esp_ota_get_state_partition(partition, &state) != ESP_OK)
+    return "not_set"; // flashed over USB
+
+  switch (state)
+  {
+  case ESP_OTA_IMG_NEW:
+    return "new";
+  case ESP_OTA_IMG_PENDING_VERIFY:
+    return "pending_verify";
+  case ESP_OTA_IMG_VALID:
+    return "valid";
+  case ESP_OTA_IMG_INVALID:
+    return "invalid";
+  case ESP_OTA_IMG_ABORTED:
+    return "aborted";
+  default:
+    return "undefined";
+  }
+}
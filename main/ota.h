@@ -0,0 +1,37 @@
+#ifndef _OTA_H_
+#define _OTA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  Firmware update over HTTP into the inactive ota_0/ota_1 slot:
+
+    curl --data-binary @build/pressure_monitor.bin http://<device>/api/v1/ota
+
+  The image is written as it arrives, validated, set to boot and the device restarts. The new
+  firmware boots pending verification and confirms itself once the measure loop and the
+  controller pass the self-test, otherwise it marks itself invalid and the previous one boots
+  again. A crash before the confirmation rolls back in the bootloader.
+*/
+
+typedef struct ota_upload_stats
+{
+  uint32_t bytes;
+  uint32_t duration_ms;
+  uint32_t flash_ms; // esp_ota_begin() erase and the writes
+  // measure loop while the upload ran, by the timestamps of sensor 0
+  uint32_t cycles;
+  uint32_t late_cycles; // more than half a cycle late
+  uint32_t max_interval_us;
+} ota_upload_stats_t;
+
+// Call before measure_start(), starts the self-test of a pending firmware
+void ota_init();
+// Call after http_server_start()
+void ota_start();
+
+// false until the first upload
+bool ota_get_last_upload(ota_upload_stats_t *stats);
+
+#endif // _OTA_H_
@@ -0,0 +1,118 @@
+#include "pressure_filters.h"
+
+void moving_average_init(moving_average_t *filter, uint8_t taps)
+{
+  filter->taps = taps > MOVING_AVERAGE_MAX_TAPS ? MOVING_AVERAGE_MAX_TAPS : taps;
+  moving_average_reset(filter);
+}
+
+void moving_average_reset(moving_average_t *filter)
+{
+  filter->sum   = 0;
+  filter->head  = 0;
+  filter->count = 0;
+}
+
+pressure_value_t moving_average_add(moving_average_t *filter, pressure_value_t value)
+{
+  if (filter->count == filter->taps)
+  {
+    filter->sum -= filter->values[filter->head];
+  }
+  else
+  {
+    filter->count++;
+  }
+
+  filter->values[filter->head] = value;
+  filter->sum += value;
+  filter->head = (filter->head + 1) % filter->taps;
+
+  return filter->sum / filter->count;
+}
+
+static void aggregator_reset(aggregator_t *aggregator)
+{
+  aggregator->sum    = 0;
+  aggregator->min    = INT32_MAX;
+  aggregator->max    = INT32_MIN;
+  aggregator->count  = 0;
+  aggregator->inputs = 0;
+}
+
+void aggregator_init(aggregator_t *aggregator, uint16_t ratio)
+{
+  aggregator->ratio      = ratio;
+  aggregator->last_state = PRESSURE_SENSOR_ABSENT;
+  aggregator_reset(aggregator);
+}
+
+// returns true when the window is complete and should be dumped
+bool aggregator_add_sample(aggregator_t *aggregator, pressure_value_t value)
+{
+  if (value < 0)
+  {
+    aggregator->last_state = value;
+  }
+  else
+  {
+    aggregator->sum += value;
+    aggregator->count++;
+
+    if (value < aggregator->min)
+      aggregator->min = value;
+
+    if (value > aggregator->max)
+      aggregator->max = value;
+  }
+
+  return ++aggregator->inputs >= aggregator->ratio;
+}
+
+// merges a finer aggregate into the coarser one, the mean is weighted by samples count
+bool aggregator_add(aggregator_t *aggregator, const pressure_aggregate_t *input)
+{
+  if (input->count == 0)
+  {
+    aggregator->last_state = input->mean;
+  }
+  else
+  {
+    aggregator->sum += (int64_t)input->mean * input->count;
+    aggregator->count += input->count;
+
+    if (input->min < aggregator->min)
+      aggregator->min = input->min;
+
+    if (input->max > aggregator->max)
+      aggregator->max = input->max;
+  }
+
+  return ++aggregator->inputs >= aggregator->ratio;
+}
+
+void aggregator_dump(aggregator_t *aggregator, pressure_aggregate_t *output)
+{
+  output->count = aggregator->count;
+
+  if (aggregator->count > 0)
+  {
+    output->mean = (aggregator->sum + aggregator->count / 2) / aggregator->count;
+    output->min  = aggregator->min;
+    output->max  = aggregator->max;
+  }
+  else
+  {
+    output->mean = output->min = output->max = aggregator->last_state;
+  }
+
+  aggregator_reset(aggregator);
+}
+
+pressure_value_t pressure_round(pressure_value_t value, pressure_value_t resolution)
+{
+  if (value < 0)
+    return value;
+
+  return (value + resolution / 2) / resolution * resolution;
+}
@@ -0,0 +1,45 @@
+#ifndef _PRESSURE_FILTERS_H_
+#define _PRESSURE_FILTERS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pressure_sensors.h"
+
+#define MOVING_AVERAGE_MAX_TAPS 8
+
+// Boxcar FIR, one output per input sample
+typedef struct moving_average
+{
+  pressure_value_t values[MOVING_AVERAGE_MAX_TAPS];
+  int32_t sum;
+  uint8_t taps;
+  uint8_t head;
+  uint8_t count;
+} moving_average_t;
+
+// Integrate-and-dump stage with min/max tracking, one output per window.
+// Sensor states (negative values) are not averaged: a window without valid samples dumps the last state.
+typedef struct aggregator
+{
+  int64_t sum;
+  pressure_value_t min;
+  pressure_value_t max;
+  pressure_value_t last_state;
+  uint32_t count; // valid samples
+  uint16_t inputs;
+  uint16_t ratio; // inputs per output
+} aggregator_t;
+
+void moving_average_init(moving_average_t *filter, uint8_t taps);
+void moving_average_reset(moving_average_t *filter);
+pressure_value_t moving_average_add(moving_average_t *filter, pressure_value_t value);
+
+void aggregator_init(aggregator_t *aggregator, uint16_t ratio);
+bool aggregator_add_sample(aggregator_t *aggregator, pressure_value_t value);
+bool aggregator_add(aggregator_t *aggregator, const pressure_aggregate_t *input);
+void aggregator_dump(aggregator_t *aggregator, pressure_aggregate_t *output);
+
+pressure_value_t pressure_round(pressure_value_t value, pressure_value_t resolution);
+
+#endif // _PRESSURE_FILTERS_H_
@@ -16,8 +16,11 @@
 #include "esp_adc_cal.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 
 #include "stor.h"
+#include "metrics.h"
+#include "pressure_filters.h"
 #include "pressure_sensors.h"
 
 static const char *TAG = "SENSORS";
@@ -29,22 +32,43 @@ _PRESSURE_SENSORS_EVENTS(DEF_EVENT)
 
 #define SENSORS_STORE "sensors"
 
-#define SENSOR_MAX_PRESSURE 1200000 // Pa
-
 #define SENSOR_VOLTAGE_SHIFT_DELIMETER 1000000000000000
 
 #define SENSOR_MIN_PRESSURE_V_COEFF 0.1
 #define SENSOR_MAX_PRESSURE_V_COEFF 0.9
 
-#define PRESSURE_HISTORY_TLS_INDEX 1
-#define PRESSURE_HISTORY_VALUES_COUNT 25
-#define PRESSURE_MEASURE_CYCLE_MS 40 // in miliseconds
+#define FAST_STREAM_TAPS 5 // moving average over 200 ms
+#define UI_STREAM_DECIMATION 2
+#define AGGREGATE_1M_RATIO 60 // 1 second aggregates per minute
+#define MAX_STREAM_SUBSCRIBERS 8
+
+#define EVENT_POST_TIMEOUT (PRESSURE_MEASURE_CYCLE_MS / 4 * 3 / portTICK_PERIOD_MS)
 
 #define DEFAULT_VREF 1100 // Use adc2_vref_to_gpio() to obtain a better estimate
 #define NO_OF_SAMPLES 128 // Multisampling
 
+typedef struct sensor_state
+{
+    sensor_pressure_t fast; // last posted values
+    sensor_pressure_t ui;
+    moving_average_t fast_filter;
+    uint8_t ui_phase;
+    aggregator_t aggregate_1s;
+    aggregator_t aggregate_1m;
+} sensor_state_t;
+
+typedef struct stream_subscriber
+{
+    pressure_rate_t rate;
+    pressure_stream_cb_t cb;
+    void *arg;
+} stream_subscriber_t;
+
 static TaskHandle_t sensor_tasks[SENSORS_COUNT];
 
+static stream_subscriber_t stream_subscribers[MAX_STREAM_SUBSCRIBERS];
+static uint8_t stream_subscribers_count = 0;
+
 static const adc_channel_t sensor_channels[] = {
     ADC_CHANNEL_0, // GPIO36
     ADC_CHANNEL_3, // GPIO39
@@ -75,7 +99,10 @@ static const adc_unit_t unit = ADC_UNIT_1;
 
 static double channel_voltage_shift[SENSORS_COUNT] = {[0 ... SENSORS_COUNT - 1] = 1.0};
 
-static pressure_value_t pressures[SENSORS_COUNT] = {PRESSURE_SENSOR_ABSENT};
+static pressure_value_t pressures[SENSORS_COUNT] = {[0 ... SENSORS_COUNT - 1] = PRESSURE_SENSOR_ABSENT};
+
+static pressure_loop_stats_t loop_stats;
+static portMUX_TYPE loop_stats_lock = portMUX_INITIALIZER_UNLOCKED;
 
 /**********************
  *  STATIC PROTOTYPES
@@ -83,12 +110,15 @@ static pressure_value_t pressures[SENSORS_COUNT] = {PRESSURE_SENSOR_ABSENT};
 uint32_t measure_absolute_voltage(adc_channel_t channel);
 pressure_value_t get_pressure(uint8_t index);
 uint32_t calc_actual_voltage(uint32_t voltage, double div);
-void freePressureHistory(int index, void *pressure_history);
 void do_calibrate_sensor(uint8_t index);
 pressure_value_t calc_pressure(uint8_t index, uint32_t voltage, uint32_t reference_voltage);
 void measure_init();
 uint32_t measure_reference_voltage();
-void measure_sensor_pressure(sensor_pressure_t *sensor);
+void measure_sensor_pressure(sensor_state_t *sensor);
+void process_sample(sensor_state_t *sensor, int64_t timestamp_us, pressure_value_t pressure);
+static void note_first_reading(int64_t timestamp_us);
+void notify_stream_subscribers(const pressure_aggregate_t *sample);
+void post_if_changed(sensor_pressure_t *last, int32_t event_id, pressure_value_t pressure);
 void measure_sensor_pressure_task(void *pvParameters);
 void measure_reference_voltage_task(void *pvParameters);
 
@@ -101,13 +131,21 @@ void measure_start()
 {
     measure_init();
 
-    sensor_pressure_t *sensor;
+    sensor_state_t *sensor;
     char name[12];
 
     for (int i = 0; i < SENSORS_COUNT; i++)
     {
-        sensor = calloc(sizeof(sensor_pressure_t), 1);
-        sensor->index = i;
+        sensor = calloc(sizeof(sensor_state_t), 1);
+        ESP_MEM_CHECK(TAG, sensor, abort());
+
+        sensor->fast.index = sensor->ui.index = i;
+        sensor->fast.pressure = sensor->ui.pressure = PRESSURE_SENSOR_ABSENT;
+
+        moving_average_init(&sensor->fast_filter, FAST_STREAM_TAPS);
+        aggregator_init(&sensor->aggregate_1s, PRESSURE_SAMPLES_PER_SEC);
+        aggregator_init(&sensor->aggregate_1m, AGGREGATE_1M_RATIO);
+
         sprintf(name, "CH_%d", (int)(sensor_channels[i]));
         xTaskCreate(measure_sensor_pressure_task, name, 4096 * 2, sensor, 2, &sensor_tasks[i]);
     }
@@ -156,9 +194,15 @@ uint32_t calc_actual_voltage(uint32_t voltage, double div)
     return (uint32_t)round(voltage / div / 1) * 1;
 }
 
-void freePressureHistory(int index, void *pressure_history)
+void pressure_stream_subscribe(pressure_rate_t rate, pressure_stream_cb_t cb, void *arg)
 {
-    free(pressure_history);
+    if (stream_subscribers_count >= MAX_STREAM_SUBSCRIBERS)
+    {
+        ESP_LOGE(TAG, "Too many stream subscribers, rate %d subscription is dropped", rate);
+        return;
+    }
+
+    stream_subscribers[stream_subscribers_count++] = (stream_subscriber_t){.rate = rate, .cb = cb, .arg = arg};
 }
 
 void do_calibrate_sensor(uint8_t index)
@@ -210,30 +254,8 @@ int32_t calc_pressure(uint8_t index, uint32_t voltage, uint32_t reference_voltag
     }
     else
     {
-        // pressure = (voltage < min_voltage) ? 0 : round((double)(voltage - min_voltage) / max_voltage * SENSOR_MAX_PRESSURE / 1000) * 1000;
-
-        uint32_t *current_pressure_index, *pressure_history;
-        // let's have current_pressure_index point to the first element of the array
-        current_pressure_index = pressure_history = pvTaskGetThreadLocalStoragePointer(NULL, PRESSURE_HISTORY_TLS_INDEX);
-
-        if (!pressure_history)
-        {
-            current_pressure_index = pressure_history = (uint32_t *)calloc(sizeof(uint32_t), PRESSURE_HISTORY_VALUES_COUNT + 1);
-            *current_pressure_index = PRESSURE_HISTORY_VALUES_COUNT;
-
-            vTaskSetThreadLocalStoragePointerAndDelCallback(NULL, PRESSURE_HISTORY_TLS_INDEX, pressure_history, freePressureHistory);
-        }
-
-        *current_pressure_index = ++(*current_pressure_index) < PRESSURE_HISTORY_VALUES_COUNT ? *current_pressure_index : 1;
-
-        *(pressure_history + *current_pressure_index) = (voltage < min_voltage) ? 0 : round((double)(voltage - min_voltage) / (max_voltage - min_voltage) * SENSOR_MAX_PRESSURE / 1000) * 1000;
-
-        for (int i = 1; i <= PRESSURE_HISTORY_VALUES_COUNT; i++)
-        {
-            pressure += *(pressure_history + i);
-        }
-
-        pressure = round(pressure / PRESSURE_HISTORY_VALUES_COUNT / 1000) * 1000;
+        // averaging is done by the stream filters, see process_sample()
+        pressure = (voltage < min_voltage) ? 0 : round((double)(voltage - min_voltage) / (max_voltage - min_voltage) * SENSOR_MAX_PRESSURE);
     }
 
     return pressure;
@@ -269,19 +291,40 @@ uint32_t measure_reference_voltage()
     return calc_actual_voltage(measured_voltage, ref_voltage_div);
 }
 
-void measure_sensor_pressure(sensor_pressure_t *sensor)
+// Nothing on the boot path should hold the loop up, the delay to the first reading shows it
+static void note_first_reading(int64_t timestamp_us)
 {
-    uint8_t channel = sensor_channels[sensor->index];
+    bool first = false;
+
+    portENTER_CRITICAL(&loop_stats_lock);
+    if (loop_stats.first_reading_ms == 0)
+    {
+        loop_stats.first_reading_ms = timestamp_us / 1000;
+        first = true;
+    }
+    portEXIT_CRITICAL(&loop_stats_lock);
+
+    if (first)
+    {
+        ESP_LOGI(TAG, "First reading %lld ms after the app start", timestamp_us / 1000);
+        metrics_set(METRIC_BOOT_FIRST_READING_MS, 0, timestamp_us / 1000);
+    }
+}
+
+void measure_sensor_pressure(sensor_state_t *sensor)
+{
+    uint8_t channel = sensor_channels[sensor->fast.index];
 
     uint32_t measured_voltage, actual_voltage;
     pressure_value_t pressure;
 
-    measured_voltage = measure_absolute_voltage(channel);
+    int64_t timestamp_us = esp_timer_get_time();
+    measured_voltage     = measure_absolute_voltage(channel);
 
     if (measured_voltage > 0)
     {
         actual_voltage = calc_actual_voltage(measured_voltage, input_voltage_div);
-        pressure = calc_pressure(sensor->index, actual_voltage, reference_voltage);
+        pressure = calc_pressure(sensor->fast.index, actual_voltage, reference_voltage);
     }
     else
     {
@@ -289,23 +332,111 @@ void measure_sensor_pressure(sensor_pressure_t *sensor)
         pressure = PRESSURE_SENSOR_ABSENT;
     }
 
-    if (sensor->pressure != pressure)
+    ESP_LOGV(TAG, "\tCh: %d, MeasuredV: %04d mV, ActualV: %04d mV, RefV: %04d mV, Pressure: %06d Pa",
+             (int)channel, measured_voltage,
+             actual_voltage, reference_voltage,
+             pressure);
+
+    process_sample(sensor, timestamp_us, pressure);
+}
+
+// Decimation pipeline: raw -> moving average (fast) -> every 2nd (UI)
+//                      raw -> integrate and dump (1 s) -> integrate and dump (1 min)
+void process_sample(sensor_state_t *sensor, int64_t timestamp_us, pressure_value_t pressure)
+{
+    uint8_t index = sensor->fast.index;
+    pressure_value_t fast;
+
+    if (loop_stats.first_reading_ms == 0)
+        note_first_reading(timestamp_us);
+
+    pressure_aggregate_t raw = {
+        .index = index,
+        .rate = PRESSURE_RATE_RAW,
+        .count = pressure < 0 ? 0 : 1,
+        .timestamp_us = timestamp_us,
+        .mean = pressure,
+        .min = pressure,
+        .max = pressure};
+
+    notify_stream_subscribers(&raw);
+
+    if (pressure < 0)
     {
-        sensor->pressure = pressure;
+        moving_average_reset(&sensor->fast_filter);
+        fast = pressure;
+    }
+    else
+    {
+        fast = pressure_round(moving_average_add(&sensor->fast_filter, pressure), PRESSURE_RESOLUTION);
+    }
+
+    pressures[index] = fast;
+
+    pressure_aggregate_t sample = {
+        .index = index,
+        .rate = PRESSURE_RATE_FAST,
+        .count = fast < 0 ? 0 : 1,
+        .timestamp_us = timestamp_us,
+        .mean = fast,
+        .min = fast,
+        .max = fast};
+
+    notify_stream_subscribers(&sample);
+    post_if_changed(&sensor->fast, PRESSURE_SENSOR_VALUE_CHANGED, fast);
 
-        esp_event_post(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_VALUE_CHANGED, sensor, sizeof(sensor_pressure_t), PRESSURE_MEASURE_CYCLE_MS / 4 * 3 / portTICK_PERIOD_MS);
+    if (++sensor->ui_phase >= UI_STREAM_DECIMATION)
+    {
+        sensor->ui_phase = 0;
+        sample.rate = PRESSURE_RATE_UI;
+
+        notify_stream_subscribers(&sample);
+        post_if_changed(&sensor->ui, PRESSURE_SENSOR_UI_VALUE_CHANGED, fast);
+    }
+
+    if (aggregator_add_sample(&sensor->aggregate_1s, pressure))
+    {
+        pressure_aggregate_t second = {.index = index, .rate = PRESSURE_RATE_1S, .timestamp_us = timestamp_us};
+        aggregator_dump(&sensor->aggregate_1s, &second);
 
-        ESP_LOGI(TAG, "\tCh: %d, MeasuredV: %04d mV, ActualV: %04d mV, RefV: %04d mV, Pressure: %06d Pa",
-                 (int)channel, measured_voltage,
-                 actual_voltage, reference_voltage,
-                 pressure);
+        notify_stream_subscribers(&second);
+        metrics_event_posted(esp_event_post(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1S, &second, sizeof(pressure_aggregate_t), EVENT_POST_TIMEOUT));
+
+        ESP_LOGD(TAG, "Ch: %d, 1s: %06d Pa [%06d..%06d], %d samples", (int)sensor_channels[index], second.mean, second.min, second.max, second.count);
+
+        if (aggregator_add(&sensor->aggregate_1m, &second))
+        {
+            pressure_aggregate_t minute = {.index = index, .rate = PRESSURE_RATE_1M, .timestamp_us = timestamp_us};
+            aggregator_dump(&sensor->aggregate_1m, &minute);
+
+            notify_stream_subscribers(&minute);
+            metrics_event_posted(esp_event_post(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1M, &minute, sizeof(pressure_aggregate_t), EVENT_POST_TIMEOUT));
+        }
+    }
+}
+
+void notify_stream_subscribers(const pressure_aggregate_t *sample)
+{
+    for (uint8_t i = 0; i < stream_subscribers_count; i++)
+    {
+        if (stream_subscribers[i].rate == sample->rate)
+            stream_subscribers[i].cb(sample, stream_subscribers[i].arg);
+    }
+}
+
+void post_if_changed(sensor_pressure_t *last, int32_t event_id, pressure_value_t pressure)
+{
+    if (last->pressure != pressure)
+    {
+        last->pressure = pressure;
+
+        metrics_event_posted(esp_event_post(PRESSURE_SENSORS_EVENTS, event_id, last, sizeof(sensor_pressure_t), EVENT_POST_TIMEOUT));
     }
 }
 
 void measure_sensor_pressure_task(void *pvParameters)
 {
-    sensor_pressure_t *sensor = (sensor_pressure_t *)pvParameters;
-    sensor->pressure = PRESSURE_SENSOR_ABSENT;
+    sensor_state_t *sensor = (sensor_state_t *)pvParameters;
 
     uint32_t ulNotifiedValue;
 
@@ -325,7 +456,7 @@ void measure_sensor_pressure_task(void *pvParameters)
         if ((ulNotifiedValue & PRESSURE_SENSOR_CALIBRATION_REQUESTED) != 0)
         {
             ESP_LOGI(TAG, "Got calibration notif");
-            do_calibrate_sensor(sensor->index);
+            do_calibrate_sensor(sensor->fast.index);
         }
     }
 }
@@ -333,8 +464,36 @@ void measure_sensor_pressure_task(void *pvParameters)
 void measure_reference_voltage_task(void *pvParameters)
 {
     {
+        int64_t last_cycle_us     = 0;
+        uint32_t last_interval_us = 0;
+
         while (1)
         {
+            int64_t now_us = esp_timer_get_time();
+
+            if (last_cycle_us != 0)
+            {
+                uint32_t interval_us = now_us - last_cycle_us;
+
+                portENTER_CRITICAL(&loop_stats_lock);
+                loop_stats.cycles++;
+
+                if (interval_us > PRESSURE_MEASURE_CYCLE_MS * 1000 * 3 / 2 + portTICK_PERIOD_MS * 1000)
+                    loop_stats.late++;
+
+                if (interval_us > loop_stats.max_interval_us)
+                    loop_stats.max_interval_us = interval_us;
+                portEXIT_CRITICAL(&loop_stats_lock);
+
+                metrics_observe(METRIC_HISTOGRAM_MEASURE_CYCLE, interval_us);
+
+                if (last_interval_us != 0)
+                    metrics_observe(METRIC_HISTOGRAM_MEASURE_JITTER, interval_us > last_interval_us ? interval_us - last_interval_us : last_interval_us - interval_us);
+
+                last_interval_us = interval_us;
+            }
+
+            last_cycle_us = now_us;
 
             reference_voltage = measure_reference_voltage();
 
@@ -354,6 +513,13 @@ pressure_value_t get_pressure(uint8_t index)
     return pressures[index];
 }
 
+void pressure_get_loop_stats(pressure_loop_stats_t *stats)
+{
+    portENTER_CRITICAL(&loop_stats_lock);
+    *stats = loop_stats;
+    portEXIT_CRITICAL(&loop_stats_lock);
+}
+
 void calibrate_sensor(uint8_t index)
 {
     if (sensor_tasks[index] != NULL)
@@ -17,6 +17,40 @@ typedef struct sensor_pressure
   pressure_value_t pressure;
 } sensor_pressure_t;
 
+// Output rates of the sampling pipeline, every rate is decimated from the same raw stream
+typedef enum pressure_rate
+{
+  PRESSURE_RATE_FAST, // every measure cycle (25 Hz), short moving average, for control and fast cutoff
+  PRESSURE_RATE_UI,   // fast stream decimated by 2 (12.5 Hz)
+  PRESSURE_RATE_1S,   // 1 second aggregates of the raw stream
+  PRESSURE_RATE_1M,   // 1 minute aggregates of the 1 second ones
+  PRESSURE_RATE_RAW,  // every measure cycle, unfiltered, for analysis
+  PRESSURE_RATES_COUNT
+} pressure_rate_t;
+
+typedef struct pressure_aggregate
+{
+  uint8_t index;
+  uint8_t rate;          // pressure_rate_t
+  uint16_t count;        // valid samples in the window, 0 if the sensor was absent\overloaded the whole window
+  int64_t timestamp_us;  // end of the window, esp_timer time
+  pressure_value_t mean; // holds the sensor state if count is 0
+  pressure_value_t min;
+  pressure_value_t max;
+} pressure_aggregate_t;
+
+// Pacing of the measure cycle, for checking that nothing else starves it
+typedef struct pressure_loop_stats
+{
+  uint32_t cycles;
+  uint32_t late;             // cycles which started more than half a cycle late
+  uint32_t max_interval_us;  // between two cycle starts
+  uint32_t first_reading_ms; // since the app started, 0 until then
+} pressure_loop_stats_t;
+
+// Called from the sensor task for every sample of the subscribed rate, must be short and must not block
+typedef void (*pressure_stream_cb_t)(const pressure_aggregate_t *sample, void *arg);
+
 enum pressure_sensor_states
 {
   PRESSURE_REFERENCE_POWER_ERROR = INT8_MIN,
@@ -26,10 +60,20 @@ enum pressure_sensor_states
 
 #define SENSORS_COUNT 5
 
-#define _PRESSURE_SENSORS_EVENTS(EVENT) \
-  EVENT(PRESSURE_SENSOR_REF_V_MEASURED) \
-  EVENT(PRESSURE_SENSOR_VALUE_CHANGED)  \
-  EVENT(PRESSURE_SENSOR_CALIBRATION_REQUESTED)
+#define PRESSURE_MEASURE_CYCLE_MS 40 // in miliseconds
+#define PRESSURE_SAMPLES_PER_SEC (1000 / PRESSURE_MEASURE_CYCLE_MS)
+#define PRESSURE_RESOLUTION 1000 // Pa, fast and UI streams are rounded to it
+#define SENSOR_MAX_PRESSURE 1200000 // Pa, full scale of the sensors
+
+// PRESSURE_SENSOR_VALUE_CHANGED carries the fast stream, PRESSURE_SENSOR_UI_VALUE_CHANGED the UI one,
+// both as sensor_pressure_t and only on change. Aggregate events carry pressure_aggregate_t for every window.
+#define _PRESSURE_SENSORS_EVENTS(EVENT)        \
+  EVENT(PRESSURE_SENSOR_REF_V_MEASURED)        \
+  EVENT(PRESSURE_SENSOR_VALUE_CHANGED)         \
+  EVENT(PRESSURE_SENSOR_CALIBRATION_REQUESTED) \
+  EVENT(PRESSURE_SENSOR_UI_VALUE_CHANGED)      \
+  EVENT(PRESSURE_SENSOR_AGGREGATE_1S)          \
+  EVENT(PRESSURE_SENSOR_AGGREGATE_1M)
 
 enum SENSOR_EVENTS
 {
@@ -41,7 +85,11 @@ _PRESSURE_SENSORS_EVENTS(DEF_EVENT_EXTERN)
 
 void measure_start();
 
+// Subscriptions should be made before measure_start()
+void pressure_stream_subscribe(pressure_rate_t rate, pressure_stream_cb_t cb, void *arg);
+
 pressure_value_t get_pressure(uint8_t index);
+void pressure_get_loop_stats(pressure_loop_stats_t *stats);
 void calibrate_sensor(uint8_t index);
 
 #endif // _PRESSURE_SENSORS_H_
\ No newline at end of file
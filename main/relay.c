@@ -11,15 +11,19 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 
+#include "metrics.h"
 #include "relay.h"
 
 #define RELAY_1_PIN CONFIG_SOCKET_1_CONTROL_PIN
 #define RELAY_2_PIN CONFIG_SOCKET_2_CONTROL_PIN
-#define RELAYS_COUNT 2
 
 ESP_EVENT_DEFINE_BASE(RELAYS_EVENTS);
 
+// relay events
+_RELAYS_EVENTS(DEF_EVENT)
+
 static relay_t relays[] = {
     {.control_pin = RELAY_1_PIN, .state = RELAY_OFF},
     {.control_pin = RELAY_2_PIN, .state = RELAY_OFF}};
@@ -27,13 +31,41 @@ static relay_t relays[] = {
 void relay_turn_on(uint8_t index)
 {
   gpio_set_level(relays[index].control_pin, RELAY_ON);
-  esp_event_post(RELAYS_EVENTS, RELAY_ON, &index, sizeof(uint8_t), portMAX_DELAY);
+
+  if (relays[index].state != RELAY_ON)
+  {
+    relays[index].turned_on_at = esp_timer_get_time();
+    metrics_add(METRIC_RELAY_STARTS, index, 1);
+  }
+
+  relays[index].state = RELAY_ON;
+  metrics_event_posted(esp_event_post(RELAYS_EVENTS, RELAY_TURNED_ON, &index, sizeof(uint8_t), portMAX_DELAY));
 }
 
 void relay_turn_off(uint8_t index)
 {
   gpio_set_level(relays[index].control_pin, RELAY_OFF);
-  esp_event_post(RELAYS_EVENTS, RELAY_OFF, &index, sizeof(uint8_t), portMAX_DELAY);
+
+  if (relays[index].state == RELAY_ON)
+    relays[index].on_time_ms += (esp_timer_get_time() - relays[index].turned_on_at) / 1000;
+
+  relays[index].state = RELAY_OFF;
+  metrics_event_posted(esp_event_post(RELAYS_EVENTS, RELAY_TURNED_OFF, &index, sizeof(uint8_t), portMAX_DELAY));
+}
+
+relay_state_t relay_get_state(uint8_t index)
+{
+  return relays[index].state;
+}
+
+uint32_t relay_get_on_time_ms(uint8_t index)
+{
+  relay_t relay = relays[index];
+
+  if (relay.state != RELAY_ON)
+    return relay.on_time_ms;
+
+  return relay.on_time_ms + (esp_timer_get_time() - relay.turned_on_at) / 1000;
 }
 
 void relays_init()
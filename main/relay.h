@@ -6,6 +6,8 @@
 
 #include "utils.h" // events declaration macroses etc
 
+#define RELAYS_COUNT 2
+
 typedef enum
 {
   RELAY_OFF = (uint8_t)0,
@@ -16,6 +18,8 @@ typedef struct relay
 {
   gpio_num_t control_pin;
   relay_state_t state;
+  int64_t turned_on_at; // esp_timer time
+  uint32_t on_time_ms;  // completed ON periods
 } relay_t;
 
 ESP_EVENT_DECLARE_BASE(RELAYS_EVENTS);
@@ -35,5 +39,7 @@ _RELAYS_EVENTS(DEF_EVENT_EXTERN)
 void relays_init();
 void relay_turn_on(uint8_t index);
 void relay_turn_off(uint8_t index);
+relay_state_t relay_get_state(uint8_t index);
+uint32_t relay_get_on_time_ms(uint8_t index); // since boot, the current ON period included
 
 #endif // _RELAY_H_
\ No newline at end of file
@@ -1,18 +1,22 @@
 #include "esp_event.h"
+#include "esp_log.h"
 #include "esp_task.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 
+#include "compressor_health.h"
+#include "metrics.h"
 #include "pressure_sensors.h"
 #include "relay.h"
 #include "relay_control.h"
+#include "stor.h"
 
 #include "utils.h"
 
 static const char *TAG = "RELAY_CTRL";
 
-#define MAX_ON_TIME_MS 5 * 60 * 1000  // 5 minutes in ms
-#define MIN_OFF_TIME_MS 5 * 60 * 1000 // 5 minutes in ms
+#define MAX_ON_TIME_S (5 * 60)  // 5 minutes
+#define MIN_OFF_TIME_S (5 * 60) // 5 minutes
 
 #define PRESSURE_SENSOR_INDEX 0
 #define RELAY_INDEX 0
@@ -20,13 +24,26 @@ static const char *TAG = "RELAY_CTRL";
 #define PRESSURE_LOW_MARK 250000  // pa
 #define PRESSURE_HIGH_MARK 820000 // pa
 
+#define RELAY_CONTROL_STORE "relay_ctrl"
+#define LOW_MARK_KEY "low_mark"
+#define HIGH_MARK_KEY "high_mark"
+#define MAX_ON_TIME_KEY "max_on_s"
+#define MIN_OFF_TIME_KEY "min_off_s"
+
+ESP_EVENT_DEFINE_BASE(RELAY_CONTROL_EVENTS);
+
+// relay control events
+_RELAY_CONTROL_EVENTS(DEF_EVENT)
+
 enum relay_control_flags
 {
   PRESSURE_UNDER_LOW_MARK  = 0x001,
   PRESSURE_ABOVE_HIGH_MARK = 0x002,
   MAX_ON_PERIOD_EXCEEDED   = 0x004,
   MIN_OFF_PERIOD_EXCEEDED  = 0x008,
-  RELAY_IS_ON              = 0x010
+  RELAY_IS_ON              = 0x010,
+  MANUAL_OVERRIDE          = 0x020,
+  MANUAL_RELAY_ON          = 0x040
 };
 
 typedef struct relay_controller
@@ -34,10 +51,7 @@ typedef struct relay_controller
   EventGroupHandle_t event_group;
   uint8_t relay_index;
   uint8_t pressure_sensor_index;
-  pressure_value_t pressure_low_mark;
-  pressure_value_t pressure_high_mark;
-  uint64_t max_on_time_ms;
-  uint64_t min_off_time_ms;
+  relay_control_settings_t settings; // under settings_lock, changed at runtime
   esp_timer_handle_t timer;
 } Relay_controller_t;
 
@@ -47,6 +61,9 @@ typedef struct relay_controller
 void relay_control_task(void *pvParameter);
 
 static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void update_marks(Relay_controller_t *relay_controller, pressure_value_t pressure);
+static bool settings_valid(const relay_control_settings_t *settings);
+static void load_settings(relay_control_settings_t *settings);
 
 static void pressure_went_under_low_mark(Relay_controller_t *relay_controller);
 static void pressure_went_above_low_mark(Relay_controller_t *relay_controller);
@@ -63,6 +80,9 @@ static void off_timer_finished(void *relay_controller);
 static void turn_relay_on(Relay_controller_t *relay_controller);
 static void turn_relay_off(Relay_controller_t *relay_controller);
 
+static Relay_controller_t *running_controller;
+static portMUX_TYPE settings_lock = portMUX_INITIALIZER_UNLOCKED;
+
 void relay_control_start()
 {
   xTaskCreate(relay_control_task, "relay ctrl", 4096 * 2, NULL, 0, NULL);
@@ -75,12 +95,10 @@ void relay_control_task(void *pvParameter)
   Relay_controller_t relay_controller = {
       .relay_index           = RELAY_INDEX,
       .pressure_sensor_index = PRESSURE_SENSOR_INDEX,
-      .pressure_low_mark     = PRESSURE_LOW_MARK,
-      .pressure_high_mark    = PRESSURE_HIGH_MARK,
-      .max_on_time_ms        = MAX_ON_TIME_MS,
-      .min_off_time_ms       = MIN_OFF_TIME_MS,
       .timer                 = NULL};
 
+  load_settings(&relay_controller.settings);
+
   relay_controller.event_group = xEventGroupCreate();
 
   ESP_MEM_CHECK(TAG, relay_controller.event_group, abort());
@@ -89,6 +107,12 @@ void relay_control_task(void *pvParameter)
 
   esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_VALUE_CHANGED, pressure_sensor_update_handler, &relay_controller, NULL);
 
+  compressor_health_start(relay_controller.relay_index, relay_controller.pressure_sensor_index,
+                          relay_controller.settings.pressure_low_mark, relay_controller.settings.pressure_high_mark);
+
+  // health is readable once the controller is
+  running_controller = &relay_controller;
+
   EventBits_t uxBits, lastBits = 0;
 
   ESP_LOGI(TAG, "Started");
@@ -99,7 +123,7 @@ void relay_control_task(void *pvParameter)
   {
     uxBits = xEventGroupWaitBits(
         relay_controller.event_group,
-        PRESSURE_UNDER_LOW_MARK | PRESSURE_ABOVE_HIGH_MARK | MAX_ON_PERIOD_EXCEEDED | MIN_OFF_PERIOD_EXCEEDED,
+        PRESSURE_UNDER_LOW_MARK | PRESSURE_ABOVE_HIGH_MARK | MAX_ON_PERIOD_EXCEEDED | MIN_OFF_PERIOD_EXCEEDED | MANUAL_OVERRIDE | MANUAL_RELAY_ON,
         pdFALSE,
         pdFALSE,
         portMAX_DELAY);
@@ -110,8 +134,12 @@ void relay_control_task(void *pvParameter)
       lastBits = uxBits;
     }
 
+    // under the manual override the operator's command takes the place of the low mark
+    EventBits_t demand = (uxBits & MANUAL_OVERRIDE) == MANUAL_OVERRIDE ? MANUAL_RELAY_ON : PRESSURE_UNDER_LOW_MARK;
+
     if ((uxBits & RELAY_IS_ON) != RELAY_IS_ON && // relay is OFF
-        ((uxBits & (PRESSURE_UNDER_LOW_MARK | MIN_OFF_PERIOD_EXCEEDED)) == (PRESSURE_UNDER_LOW_MARK | MIN_OFF_PERIOD_EXCEEDED)))
+        ((uxBits & (demand | MIN_OFF_PERIOD_EXCEEDED)) == (demand | MIN_OFF_PERIOD_EXCEEDED)) &&
+        (uxBits & PRESSURE_ABOVE_HIGH_MARK) != PRESSURE_ABOVE_HIGH_MARK)
     {
       ESP_LOGI(TAG, "Turning ON");
       turn_relay_on(&relay_controller);
@@ -122,16 +150,164 @@ void relay_control_task(void *pvParameter)
         ((uxBits & MAX_ON_PERIOD_EXCEEDED) == MAX_ON_PERIOD_EXCEEDED ||
 
          ((uxBits & MIN_OFF_PERIOD_EXCEEDED) == MIN_OFF_PERIOD_EXCEEDED &&
-          (uxBits & PRESSURE_UNDER_LOW_MARK) != PRESSURE_UNDER_LOW_MARK) ||
+          (uxBits & demand) != demand) ||
+
+         (uxBits & (MANUAL_OVERRIDE | MANUAL_RELAY_ON)) == MANUAL_OVERRIDE ||
 
          (uxBits & PRESSURE_ABOVE_HIGH_MARK) == PRESSURE_ABOVE_HIGH_MARK))
     {
       ESP_LOGI(TAG, "Turning OFF");
       turn_relay_off(&relay_controller);
+
+      if ((uxBits & MAX_ON_PERIOD_EXCEEDED) == MAX_ON_PERIOD_EXCEEDED)
+      {
+        ESP_LOGW(TAG, "Max ON time exceeded");
+        // a manual command does not outlive the watchdog, the operator has to give it again
+        xEventGroupClearBits(relay_controller.event_group, MANUAL_RELAY_ON);
+        metrics_event_posted(esp_event_post(RELAY_CONTROL_EVENTS, RELAY_CONTROL_MAX_ON_TIME_EXCEEDED, &relay_controller.relay_index, sizeof(uint8_t), portMAX_DELAY));
+      }
     }
   }
 }
 
+bool relay_control_get_state(relay_control_state_t *state)
+{
+  Relay_controller_t *controller = running_controller;
+
+  if (controller == NULL)
+    return false;
+
+  EventBits_t bits = xEventGroupGetBits(controller->event_group);
+
+  state->relay_index           = controller->relay_index;
+  state->pressure_sensor_index = controller->pressure_sensor_index;
+
+  portENTER_CRITICAL(&settings_lock);
+  state->pressure_low_mark  = controller->settings.pressure_low_mark;
+  state->pressure_high_mark = controller->settings.pressure_high_mark;
+  portEXIT_CRITICAL(&settings_lock);
+
+  state->relay_on              = (bits & RELAY_IS_ON) != 0;
+  state->under_low_mark        = (bits & PRESSURE_UNDER_LOW_MARK) != 0;
+  state->above_high_mark       = (bits & PRESSURE_ABOVE_HIGH_MARK) != 0;
+  state->max_on_time_exceeded  = (bits & MAX_ON_PERIOD_EXCEEDED) != 0;
+  state->min_off_time_passed   = (bits & MIN_OFF_PERIOD_EXCEEDED) != 0;
+  state->manual_override       = (bits & MANUAL_OVERRIDE) != 0;
+
+  return true;
+}
+
+bool relay_control_get_settings(relay_control_settings_t *settings)
+{
+  Relay_controller_t *controller = running_controller;
+
+  if (controller == NULL)
+    return false;
+
+  portENTER_CRITICAL(&settings_lock);
+  *settings = controller->settings;
+  portEXIT_CRITICAL(&settings_lock);
+
+  return true;
+}
+
+esp_err_t relay_control_set_settings(const relay_control_settings_t *settings)
+{
+  Relay_controller_t *controller = running_controller;
+
+  if (controller == NULL)
+    return ESP_ERR_INVALID_STATE;
+
+  if (!settings_valid(settings))
+    return ESP_ERR_INVALID_ARG;
+
+  portENTER_CRITICAL(&settings_lock);
+  relay_control_settings_t previous = controller->settings;
+  controller->settings              = *settings;
+  portEXIT_CRITICAL(&settings_lock);
+
+  bool marks_changed = settings->pressure_low_mark != previous.pressure_low_mark ||
+                       settings->pressure_high_mark != previous.pressure_high_mark;
+
+  // masters rewrite the same setpoints over and over, only changes reach the flash
+  if (!marks_changed && settings->max_on_time_s == previous.max_on_time_s && settings->min_off_time_s == previous.min_off_time_s)
+    return ESP_OK;
+
+  if (marks_changed)
+  {
+    compressor_health_set_marks(settings->pressure_low_mark, settings->pressure_high_mark);
+
+    // the pressure may not change for a while, the marks are checked against the current one
+    update_marks(controller, get_pressure(controller->pressure_sensor_index));
+  }
+
+  if (settings->pressure_low_mark != previous.pressure_low_mark)
+    stor_set_i32(RELAY_CONTROL_STORE, LOW_MARK_KEY, settings->pressure_low_mark);
+
+  if (settings->pressure_high_mark != previous.pressure_high_mark)
+    stor_set_i32(RELAY_CONTROL_STORE, HIGH_MARK_KEY, settings->pressure_high_mark);
+
+  if (settings->max_on_time_s != previous.max_on_time_s)
+    stor_set_i32(RELAY_CONTROL_STORE, MAX_ON_TIME_KEY, settings->max_on_time_s);
+
+  if (settings->min_off_time_s != previous.min_off_time_s)
+    stor_set_i32(RELAY_CONTROL_STORE, MIN_OFF_TIME_KEY, settings->min_off_time_s);
+
+  ESP_LOGI(TAG, "Settings: marks %d..%d Pa, max ON %u s, min OFF %u s",
+           settings->pressure_low_mark, settings->pressure_high_mark, settings->max_on_time_s, settings->min_off_time_s);
+
+  metrics_event_posted(esp_event_post(RELAY_CONTROL_EVENTS, RELAY_CONTROL_SETTINGS_CHANGED, (void *)settings, sizeof(relay_control_settings_t), portMAX_DELAY));
+
+  return ESP_OK;
+}
+
+esp_err_t relay_control_set_override(bool manual)
+{
+  Relay_controller_t *controller = running_controller;
+
+  if (controller == NULL)
+    return ESP_ERR_INVALID_STATE;
+
+  EventBits_t bits = xEventGroupGetBits(controller->event_group);
+
+  if (((bits & MANUAL_OVERRIDE) != 0) == manual)
+    return ESP_OK;
+
+  if (manual)
+  {
+    // bumpless: the relay keeps its state until the operator commands otherwise
+    if ((bits & RELAY_IS_ON) == RELAY_IS_ON)
+      xEventGroupSetBits(controller->event_group, MANUAL_RELAY_ON);
+
+    xEventGroupSetBits(controller->event_group, MANUAL_OVERRIDE);
+  }
+  else
+  {
+    xEventGroupClearBits(controller->event_group, MANUAL_OVERRIDE | MANUAL_RELAY_ON);
+  }
+
+  ESP_LOGW(TAG, "Manual override %s", manual ? "ON" : "OFF");
+
+  metrics_event_posted(esp_event_post(RELAY_CONTROL_EVENTS, RELAY_CONTROL_OVERRIDE_CHANGED, &manual, sizeof(bool), portMAX_DELAY));
+
+  return ESP_OK;
+}
+
+esp_err_t relay_control_set_manual_relay(bool on)
+{
+  Relay_controller_t *controller = running_controller;
+
+  if (controller == NULL || (xEventGroupGetBits(controller->event_group) & MANUAL_OVERRIDE) != MANUAL_OVERRIDE)
+    return ESP_ERR_INVALID_STATE;
+
+  if (on)
+    xEventGroupSetBits(controller->event_group, MANUAL_RELAY_ON);
+  else
+    xEventGroupClearBits(controller->event_group, MANUAL_RELAY_ON);
+
+  return ESP_OK;
+}
+
 static void turn_relay_on(Relay_controller_t *relay_controller)
 {
   xEventGroupClearBits(relay_controller->event_group, MAX_ON_PERIOD_EXCEEDED | MIN_OFF_PERIOD_EXCEEDED);
@@ -156,7 +332,11 @@ static void start_on_timer(Relay_controller_t *relay_controller)
       .arg      = relay_controller,
       .name     = "ON time watchdog"};
 
-  start_timer(&timer_args, &(relay_controller->timer), relay_controller->max_on_time_ms);
+  portENTER_CRITICAL(&settings_lock);
+  uint64_t duration_ms = relay_controller->settings.max_on_time_s * 1000ULL;
+  portEXIT_CRITICAL(&settings_lock);
+
+  start_timer(&timer_args, &(relay_controller->timer), duration_ms);
 }
 
 static void turn_relay_off(Relay_controller_t *relay_controller)
@@ -183,7 +363,11 @@ static void start_off_timer(Relay_controller_t *relay_controller)
       .arg      = relay_controller,
       .name     = "ON time watchdog"};
 
-  start_timer(&timer_args, &(relay_controller->timer), relay_controller->min_off_time_ms);
+  portENTER_CRITICAL(&settings_lock);
+  uint64_t duration_ms = relay_controller->settings.min_off_time_s * 1000ULL;
+  portEXIT_CRITICAL(&settings_lock);
+
+  start_timer(&timer_args, &(relay_controller->timer), duration_ms);
 }
 
 static void pressure_went_under_low_mark(Relay_controller_t *relay_controller)
@@ -211,26 +395,73 @@ static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_ba
   Relay_controller_t *relay_controller = (Relay_controller_t *)event_handler_arg;
   sensor_pressure_t *sensor            = (sensor_pressure_t *)event_data;
 
-  if (sensor->index == relay_controller->pressure_sensor_index && sensor->pressure >= 0)
+  if (sensor->index == relay_controller->pressure_sensor_index)
   {
-    if (sensor->pressure < relay_controller->pressure_low_mark)
-    {
-      pressure_went_under_low_mark(relay_controller);
-    }
-    else
-    {
-      pressure_went_above_low_mark(relay_controller);
-    }
+    update_marks(relay_controller, sensor->pressure);
+  }
+}
 
-    if (sensor->pressure > relay_controller->pressure_high_mark)
-    {
-      pressure_went_above_high_mark(relay_controller);
-    }
-    else
-    {
-      pressure_went_under_high_mark(relay_controller);
-    }
+static void update_marks(Relay_controller_t *relay_controller, pressure_value_t pressure)
+{
+  if (pressure < 0)
+    return;
+
+  portENTER_CRITICAL(&settings_lock);
+  pressure_value_t low_mark  = relay_controller->settings.pressure_low_mark;
+  pressure_value_t high_mark = relay_controller->settings.pressure_high_mark;
+  portEXIT_CRITICAL(&settings_lock);
+
+  if (pressure < low_mark)
+  {
+    pressure_went_under_low_mark(relay_controller);
+  }
+  else
+  {
+    pressure_went_above_low_mark(relay_controller);
+  }
+
+  if (pressure > high_mark)
+  {
+    pressure_went_above_high_mark(relay_controller);
+  }
+  else
+  {
+    pressure_went_under_high_mark(relay_controller);
+  }
+}
+
+static bool settings_valid(const relay_control_settings_t *settings)
+{
+  return settings->pressure_low_mark >= 0 &&
+         settings->pressure_low_mark < settings->pressure_high_mark &&
+         settings->pressure_high_mark <= SENSOR_MAX_PRESSURE &&
+         settings->max_on_time_s >= RELAY_CONTROL_TIME_MIN_S && settings->max_on_time_s <= RELAY_CONTROL_TIME_MAX_S &&
+         settings->min_off_time_s >= RELAY_CONTROL_TIME_MIN_S && settings->min_off_time_s <= RELAY_CONTROL_TIME_MAX_S;
+}
+
+// Stored settings that are not valid any more fall back to the built-in ones as a whole
+static void load_settings(relay_control_settings_t *settings)
+{
+  const relay_control_settings_t defaults = {
+      .pressure_low_mark  = PRESSURE_LOW_MARK,
+      .pressure_high_mark = PRESSURE_HIGH_MARK,
+      .max_on_time_s      = MAX_ON_TIME_S,
+      .min_off_time_s     = MIN_OFF_TIME_S};
+
+  *settings = (relay_control_settings_t){
+      .pressure_low_mark  = stor_get_i32(RELAY_CONTROL_STORE, LOW_MARK_KEY, defaults.pressure_low_mark),
+      .pressure_high_mark = stor_get_i32(RELAY_CONTROL_STORE, HIGH_MARK_KEY, defaults.pressure_high_mark),
+      .max_on_time_s      = stor_get_i32(RELAY_CONTROL_STORE, MAX_ON_TIME_KEY, defaults.max_on_time_s),
+      .min_off_time_s     = stor_get_i32(RELAY_CONTROL_STORE, MIN_OFF_TIME_KEY, defaults.min_off_time_s)};
+
+  if (!settings_valid(settings))
+  {
+    ESP_LOGW(TAG, "Stored settings are not valid, using the defaults");
+    *settings = defaults;
   }
+
+  ESP_LOGI(TAG, "Settings: marks %d..%d Pa, max ON %u s, min OFF %u s",
+           settings->pressure_low_mark, settings->pressure_high_mark, settings->max_on_time_s, settings->min_off_time_s);
 }
 
 static void reset_timer(Relay_controller_t *relay_controller)
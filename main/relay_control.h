@@ -1,6 +1,75 @@
 #ifndef _RELAY_CONTROL_H_
 #define _RELAY_CONTROL_H_
 
+#include <limits.h>
+#include <stdbool.h>
+
+#include "esp_event.h"
+
+#include "pressure_sensors.h"
+#include "utils.h" // events declaration macroses etc
+
+ESP_EVENT_DECLARE_BASE(RELAY_CONTROL_EVENTS);
+
+// RELAY_CONTROL_MAX_ON_TIME_EXCEEDED: the relay was forced OFF before the pressure reached
+// the high mark, carries the relay index as uint8_t
+// RELAY_CONTROL_SETTINGS_CHANGED carries the new relay_control_settings_t
+// RELAY_CONTROL_OVERRIDE_CHANGED carries the manual override as bool
+#define _RELAY_CONTROL_EVENTS(EVENT)        \
+  EVENT(RELAY_CONTROL_MAX_ON_TIME_EXCEEDED) \
+  EVENT(RELAY_CONTROL_SETTINGS_CHANGED)     \
+  EVENT(RELAY_CONTROL_OVERRIDE_CHANGED)
+
+enum RELAY_CONTROL_EVENTS
+{
+  _RELAY_CONTROL_EVENTS(DEF_INT_EVENT)
+      _RELAY_CONTROL_EVENT_LAST = ULONG_MAX
+};
+
+_RELAY_CONTROL_EVENTS(DEF_EVENT_EXTERN)
+
+typedef struct relay_control_settings
+{
+  pressure_value_t pressure_low_mark;  // Pa, the relay goes ON under it
+  pressure_value_t pressure_high_mark; // Pa, and OFF above it
+  uint32_t max_on_time_s;
+  uint32_t min_off_time_s;
+} relay_control_settings_t;
+
+typedef struct relay_control_state
+{
+  uint8_t relay_index;
+  uint8_t pressure_sensor_index;
+  pressure_value_t pressure_low_mark; // Pa
+  pressure_value_t pressure_high_mark;
+  bool relay_on;
+  bool under_low_mark;
+  bool above_high_mark;
+  bool max_on_time_exceeded;
+  bool min_off_time_passed;
+  bool manual_override;
+} relay_control_state_t;
+
 void relay_control_start();
 
+// false until the controller is running
+bool relay_control_get_state(relay_control_state_t *state);
+bool relay_control_get_settings(relay_control_settings_t *settings);
+
+// Validates and applies all the settings at once and stores the changed ones in NVS, a write of
+// the current values does nothing. The timer of the current ON or OFF period keeps its
+// duration, the new ones count from the next period.
+// ESP_ERR_INVALID_ARG if the marks are out of the sensor range or not in order, or a time
+// is out of RELAY_CONTROL_TIME_MIN_S..RELAY_CONTROL_TIME_MAX_S
+#define RELAY_CONTROL_TIME_MIN_S 10
+#define RELAY_CONTROL_TIME_MAX_S (60 * 60)
+esp_err_t relay_control_set_settings(const relay_control_settings_t *settings);
+
+// Under the manual override the relay follows relay_control_set_manual_relay() instead of the
+// low mark, the high mark and the ON/OFF timers still protect the compressor. It starts with
+// the relay state it was entered with and is not kept over a restart.
+esp_err_t relay_control_set_override(bool manual);
+// ESP_ERR_INVALID_STATE outside of the manual override
+esp_err_t relay_control_set_manual_relay(bool on);
+
 #endif // _RELAY_CONTROL_H_
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "http_server.h"
+#include "rest_api.h"
+#include "telemetry.h"
+
+static const char *TAG = "REST";
+
+/*
+  The server runs handlers one at a time in its own task, so a single static response buffer
+  and snapshot serve every request, nothing is allocated per request. The last serialized body
+  is kept with its sequence and sections and is sent again as is until something changes.
+*/
+
+typedef struct
+{
+  uint32_t requests;
+  uint32_t not_modified;
+  uint32_t serialized;
+  uint32_t max_us;
+} rest_stats_t;
+
+/*
+  Declarations
+*/
+static esp_err_t api_get_handler(httpd_req_t *req);
+
+static const httpd_uri_t endpoints[] = {
+    {.uri = "/api/v1/snapshot", .method = HTTP_GET, .handler = api_get_handler, .user_ctx = (void *)TELEMETRY_ALL},
+    {.uri = "/api/v1/pressure", .method = HTTP_GET, .handler = api_get_handler, .user_ctx = (void *)TELEMETRY_PRESSURE},
+    {.uri = "/api/v1/relays", .method = HTTP_GET, .handler = api_get_handler, .user_ctx = (void *)TELEMETRY_RELAYS},
+    {.uri = "/api/v1/controller", .method = HTTP_GET, .handler = api_get_handler, .user_ctx = (void *)TELEMETRY_CONTROLLER},
+    {.uri = "/api/v1/health", .method = HTTP_GET, .handler = api_get_handler, .user_ctx = (void *)TELEMETRY_HEALTH}};
+
+static telemetry_snapshot_t snapshot;
+static char response[CONFIG_REST_API_BUFFER_SIZE];
+static size_t response_length;
+static uint32_t response_seq;
+static uint8_t response_sections; // 0 if the buffer holds nothing
+static char etag[HTTP_SERVER_ETAG_SIZE];
+
+static rest_stats_t stats;
+
+void rest_api_start()
+{
+  for (uint8_t i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); i++)
+    http_server_register(&endpoints[i]);
+
+  ESP_LOGI(TAG, "Started, %d bytes response buffer", sizeof(response));
+}
+
+static esp_err_t api_get_handler(httpd_req_t *req)
+{
+  int64_t started  = esp_timer_get_time();
+  uint8_t sections = (uintptr_t)req->user_ctx;
+  uint32_t seq     = telemetry_seq();
+
+  stats.requests++;
+
+  snprintf(etag, sizeof(etag), "\"%08x\"", seq);
+
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  if (http_server_etag_matches(req, etag))
+  {
+    stats.not_modified++;
+
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+
+  if (response_sections != sections || response_seq != seq)
+  {
+    telemetry_get_snapshot(&snapshot);
+
+    response_length   = telemetry_to_json(&snapshot, sections, response, sizeof(response));
+    response_sections = response_length > 0 ? sections : 0;
+    response_seq      = snapshot.seq;
+
+    stats.serialized++;
+
+    if (response_length == 0)
+    {
+      ESP_LOGE(TAG, "%s does not fit %d bytes", req->uri, sizeof(response));
+      return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+
+    // the snapshot may be newer than the sequence read above
+    snprintf(etag, sizeof(etag), "\"%08x\"", response_seq);
+  }
+
+  httpd_resp_set_type(req, "application/json");
+  esp_err_t err = httpd_resp_send(req, response, response_length);
+
+  uint32_t elapsed = esp_timer_get_time() - started;
+
+  if (elapsed > stats.max_us)
+    stats.max_us = elapsed;
+
+  if (stats.requests % 1000 == 0)
+    ESP_LOGI(TAG, "%u requests, %u not modified, %u serialized, max %u us",
+             stats.requests, stats.not_modified, stats.serialized, stats.max_us);
+
+  return err;
+}
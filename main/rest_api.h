@@ -0,0 +1,8 @@
+#ifndef _REST_API_H_
+#define _REST_API_H_
+
+// GET /api/v1/{snapshot,pressure,relays,controller,health} on the HTTP server, JSON.
+// Every response carries an ETag of the telemetry sequence, If-None-Match gets a 304.
+void rest_api_start();
+
+#endif // _REST_API_H_
@@ -0,0 +1,431 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp32/rom/crc.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "metrics.h"
+#include "pressure_filters.h"
+#include "pressure_sensors.h"
+#include "rollup.h"
+#include "tslog.h"
+
+#include "utils.h"
+
+static const char *TAG = "ROLLUP";
+
+/*
+  RRD-style tiers in the "rollup" partition.
+
+  Every tier is a ring of fixed size slots in its own run of sectors. A slot position is its period
+  number modulo the ring capacity, so any period is found without a search and a query reads exactly
+  the slots it reports. A slot is valid only if it holds the time asked for and its CRC matches, so
+  stale slots of the previous ring turn and torn writes read as gaps.
+
+  A ring has one spare sector on top of its retention, the sector being recycled never holds data
+  inside the retention window. A sector is recycled by the write of its first slot, or later if all
+  it holds is past the retention, as after a restart or a clock jump into the middle of a sector.
+  Otherwise a stale slot is left alone and its period is lost. RAM only holds the accumulators of
+  the periods in progress.
+*/
+
+#define ROLLUP_PARTITION_LABEL "rollup"
+#define ROLLUP_PARTITION_SUBTYPE 0x41
+#define ROLLUP_SECTOR_SIZE 4096
+#define ROLLUP_QUEUE_LENGTH 16
+#define ROLLUP_ERASED_TIME UINT32_MAX
+#define ROLLUP_STORED_RESOLUTION 100 // Pa
+
+typedef struct rollup_tier_config
+{
+  uint16_t period; // seconds
+  uint16_t slots;  // retention
+} rollup_tier_config_t;
+
+static const rollup_tier_config_t tiers_config[ROLLUP_TIERS_COUNT] = {
+    [ROLLUP_TIER_10S] = {.period = 10, .slots = 360},
+    [ROLLUP_TIER_1M]  = {.period = 60, .slots = 1440},
+    [ROLLUP_TIER_15M] = {.period = 900, .slots = 2880},
+};
+
+typedef struct rollup_stored_channel
+{
+  int16_t min; // ROLLUP_STORED_RESOLUTION units or a sensor state
+  int16_t max;
+  int16_t mean;
+  uint16_t count;
+} rollup_stored_channel_t;
+
+typedef struct rollup_slot
+{
+  uint32_t time;
+  rollup_stored_channel_t values[SENSORS_COUNT];
+  uint32_t crc;
+} rollup_slot_t;
+
+#define SLOTS_PER_SECTOR (ROLLUP_SECTOR_SIZE / sizeof(rollup_slot_t))
+
+typedef struct rollup_ring
+{
+  uint32_t address; // in the partition
+  uint16_t sectors;
+  uint32_t capacity; // slots
+  uint32_t open_time;
+  aggregator_t open[SENSORS_COUNT];
+} rollup_ring_t;
+
+/*
+  Declarations
+*/
+static void rollup_task(void *pvParameter);
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+static void add_aggregate(rollup_tier_t tier, const pressure_aggregate_t *aggregate, uint32_t time);
+static bool close_period(rollup_tier_t tier, rollup_slot_t *slot);
+static void write_slot(rollup_tier_t tier, rollup_slot_t *slot);
+static bool read_slot(rollup_tier_t tier, uint32_t time, rollup_point_t *point);
+static bool open_point(rollup_tier_t tier, rollup_point_t *point);
+
+static uint32_t slot_address(rollup_tier_t tier, uint32_t time);
+static bool sector_expired(rollup_tier_t tier, uint32_t sector, uint32_t time);
+static uint32_t slot_crc(rollup_tier_t tier, const rollup_slot_t *slot);
+static bool covers(rollup_tier_t tier, uint32_t now, uint32_t from);
+
+static const esp_partition_t *partition;
+static QueueHandle_t queue;
+static SemaphoreHandle_t rollup_lock;
+
+static rollup_ring_t rings[ROLLUP_TIERS_COUNT];
+
+void rollup_start()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ROLLUP_PARTITION_SUBTYPE, ROLLUP_PARTITION_LABEL);
+
+  if (partition == NULL)
+  {
+    ESP_LOGE(TAG, "No \"%s\" partition, rollups are disabled", ROLLUP_PARTITION_LABEL);
+    return;
+  }
+
+  uint32_t address = 0;
+
+  for (uint8_t tier = 0; tier < ROLLUP_TIERS_COUNT; tier++)
+  {
+    rollup_ring_t *ring = &rings[tier];
+
+    ring->address   = address;
+    ring->sectors   = (tiers_config[tier].slots + SLOTS_PER_SECTOR - 1) / SLOTS_PER_SECTOR + 1;
+    ring->capacity  = ring->sectors * SLOTS_PER_SECTOR;
+    ring->open_time = ROLLUP_ERASED_TIME;
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+      aggregator_init(&ring->open[i], tiers_config[tier].period);
+
+    address += ring->sectors * ROLLUP_SECTOR_SIZE;
+  }
+
+  if (address > partition->size)
+  {
+    ESP_LOGE(TAG, "Tiers need %d bytes, the partition has %d", address, partition->size);
+    partition = NULL;
+    return;
+  }
+
+  rollup_lock = xSemaphoreCreateMutex();
+  queue       = xQueueCreate(ROLLUP_QUEUE_LENGTH, sizeof(pressure_aggregate_t));
+
+  ESP_MEM_CHECK(TAG, rollup_lock && queue, abort());
+
+  xTaskCreate(rollup_task, "rollup", 3072, NULL, 1, NULL);
+
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1S, aggregate_handler, NULL, NULL);
+
+  ESP_LOGI(TAG, "%d tiers in %d bytes of flash, %d bytes of RAM", ROLLUP_TIERS_COUNT, address, sizeof(rings));
+}
+
+rollup_tier_t rollup_select_tier(uint32_t from, uint32_t resolution_s)
+{
+  uint32_t now = tslog_time();
+
+  for (int8_t tier = ROLLUP_TIERS_COUNT - 1; tier >= 0; tier--)
+  {
+    if (tiers_config[tier].period <= resolution_s && covers(tier, now, from))
+      return tier;
+  }
+
+  for (uint8_t tier = 0; tier < ROLLUP_TIERS_COUNT; tier++)
+  {
+    if (covers(tier, now, from))
+      return tier;
+  }
+
+  return ROLLUP_TIERS_COUNT - 1;
+}
+
+size_t rollup_query(uint32_t from, uint32_t to, uint32_t resolution_s, rollup_point_cb_t cb, void *arg)
+{
+  return rollup_query_tier(rollup_select_tier(from, resolution_s), from, to, cb, arg);
+}
+
+size_t rollup_query_tier(rollup_tier_t tier, uint32_t from, uint32_t to, rollup_point_cb_t cb, void *arg)
+{
+  if (partition == NULL || from > to)
+    return 0;
+
+  uint32_t period = tiers_config[tier].period;
+  rollup_point_t point;
+  size_t points = 0;
+
+  xSemaphoreTake(rollup_lock, portMAX_DELAY);
+  uint32_t open_time = rings[tier].open_time;
+  xSemaphoreGive(rollup_lock);
+
+  if (open_time == ROLLUP_ERASED_TIME)
+    open_time = tslog_time() / period * period;
+
+  // the ring can't hold anything older than its capacity
+  uint32_t oldest = open_time > rings[tier].capacity * period ? open_time - rings[tier].capacity * period : 0;
+  uint32_t time   = from < oldest ? oldest : from / period * period;
+
+  for (; time <= to && time < open_time; time += period)
+  {
+    if (read_slot(tier, time, &point))
+    {
+      cb(&point, arg);
+      points++;
+    }
+  }
+
+  if (open_time >= from / period * period && open_time <= to && open_point(tier, &point))
+  {
+    cb(&point, arg);
+    points++;
+  }
+
+  return points;
+}
+
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  if (xQueueSend(queue, event_data, 0) != pdTRUE)
+    metrics_add(METRIC_ROLLUP_DROPPED, 0, 1);
+}
+
+static void rollup_task(void *pvParameter)
+{
+  pressure_aggregate_t aggregate;
+
+  while (1)
+  {
+    if (xQueueReceive(queue, &aggregate, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    uint32_t time = tslog_time();
+
+    for (uint8_t tier = 0; tier < ROLLUP_TIERS_COUNT; tier++)
+      add_aggregate(tier, &aggregate, time);
+  }
+}
+
+static void add_aggregate(rollup_tier_t tier, const pressure_aggregate_t *aggregate, uint32_t time)
+{
+  rollup_ring_t *ring = &rings[tier];
+  uint32_t period_start = time / tiers_config[tier].period * tiers_config[tier].period;
+  rollup_slot_t slot;
+  bool closed = false;
+
+  xSemaphoreTake(rollup_lock, portMAX_DELAY);
+
+  if (ring->open_time != period_start)
+  {
+    closed          = close_period(tier, &slot);
+    ring->open_time = period_start;
+  }
+
+  aggregator_add(&ring->open[aggregate->index], aggregate);
+
+  xSemaphoreGive(rollup_lock);
+
+  // flash is touched outside the lock, queries only wait for the accumulators
+  if (closed)
+    write_slot(tier, &slot);
+}
+
+static rollup_stored_channel_t to_stored(const pressure_aggregate_t *aggregate)
+{
+  rollup_stored_channel_t stored = {.count = aggregate->count > UINT16_MAX ? UINT16_MAX : aggregate->count};
+
+  if (aggregate->count == 0)
+  {
+    stored.min = stored.max = stored.mean = aggregate->mean;
+  }
+  else
+  {
+    stored.min  = (pressure_round(aggregate->min, ROLLUP_STORED_RESOLUTION) / ROLLUP_STORED_RESOLUTION);
+    stored.max  = (pressure_round(aggregate->max, ROLLUP_STORED_RESOLUTION) / ROLLUP_STORED_RESOLUTION);
+    stored.mean = (pressure_round(aggregate->mean, ROLLUP_STORED_RESOLUTION) / ROLLUP_STORED_RESOLUTION);
+  }
+
+  return stored;
+}
+
+static pressure_value_t from_stored(int16_t value)
+{
+  return value < 0 ? value : value * ROLLUP_STORED_RESOLUTION;
+}
+
+// Dumps the open accumulators into a slot, false if nothing was collected
+static bool close_period(rollup_tier_t tier, rollup_slot_t *slot)
+{
+  rollup_ring_t *ring = &rings[tier];
+  bool collected      = false;
+
+  slot->time = ring->open_time;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    pressure_aggregate_t aggregate;
+
+    collected |= ring->open[i].inputs > 0;
+
+    aggregator_dump(&ring->open[i], &aggregate);
+    slot->values[i] = to_stored(&aggregate);
+  }
+
+  return collected && slot->time != ROLLUP_ERASED_TIME;
+}
+
+static void write_slot(rollup_tier_t tier, rollup_slot_t *slot)
+{
+  uint32_t address = slot_address(tier, slot->time);
+  uint32_t stored_time;
+
+  slot->crc = slot_crc(tier, slot);
+
+  esp_partition_read(partition, address, &stored_time, sizeof(stored_time));
+
+  // the same period after a quick restart: the first write wins
+  if (stored_time == slot->time)
+    return;
+
+  esp_err_t err = ESP_OK;
+
+  // a slot of the previous ring turn, the whole sector is recycled unless it holds slots still retained
+  if (stored_time != ROLLUP_ERASED_TIME)
+  {
+    uint32_t sector = address / ROLLUP_SECTOR_SIZE * ROLLUP_SECTOR_SIZE;
+
+    if (address != sector && !sector_expired(tier, sector, slot->time))
+    {
+      ESP_LOGW(TAG, "Tier %d: sector at %d holds retained slots, period %d is lost", tier, sector, slot->time);
+      metrics_add(METRIC_ROLLUP_SKIPPED_SLOTS, tier, 1);
+      return;
+    }
+
+    err = esp_partition_erase_range(partition, sector, ROLLUP_SECTOR_SIZE);
+  }
+
+  if (err == ESP_OK)
+    err = esp_partition_write(partition, address, slot, sizeof(rollup_slot_t));
+
+  // the slot reads as a gap, the controller goes on
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Tier %d slot write failed: %s", tier, esp_err_to_name(err));
+    metrics_add(METRIC_ROLLUP_FLASH_ERRORS, tier, 1);
+  }
+}
+
+static bool read_slot(rollup_tier_t tier, uint32_t time, rollup_point_t *point)
+{
+  rollup_slot_t slot;
+
+  if (esp_partition_read(partition, slot_address(tier, time), &slot, sizeof(slot)) != ESP_OK)
+    return false;
+
+  if (slot.time != time || slot.crc != slot_crc(tier, &slot))
+    return false;
+
+  point->time   = time;
+  point->period = tiers_config[tier].period;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    point->values[i] = (rollup_channel_t){
+        .min   = from_stored(slot.values[i].min),
+        .max   = from_stored(slot.values[i].max),
+        .mean  = from_stored(slot.values[i].mean),
+        .count = slot.values[i].count};
+  }
+
+  return true;
+}
+
+// The period in progress, at the full resolution
+static bool open_point(rollup_tier_t tier, rollup_point_t *point)
+{
+  rollup_ring_t *ring = &rings[tier];
+  bool collected      = false;
+
+  xSemaphoreTake(rollup_lock, portMAX_DELAY);
+
+  point->time   = ring->open_time;
+  point->period = tiers_config[tier].period;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    aggregator_t copy = ring->open[i];
+    pressure_aggregate_t aggregate;
+
+    collected |= copy.inputs > 0;
+
+    aggregator_dump(&copy, &aggregate);
+    point->values[i] = (rollup_channel_t){.min = aggregate.min, .max = aggregate.max, .mean = aggregate.mean, .count = aggregate.count};
+  }
+
+  xSemaphoreGive(rollup_lock);
+
+  return collected && point->time != ROLLUP_ERASED_TIME;
+}
+
+static uint32_t slot_address(rollup_tier_t tier, uint32_t time)
+{
+  uint32_t position = time / tiers_config[tier].period % rings[tier].capacity;
+
+  return rings[tier].address + position / SLOTS_PER_SECTOR * ROLLUP_SECTOR_SIZE + position % SLOTS_PER_SECTOR * sizeof(rollup_slot_t);
+}
+
+// True if every slot of the sector is erased or older than the retention before `time`
+static bool sector_expired(rollup_tier_t tier, uint32_t sector, uint32_t time)
+{
+  uint32_t retention = (uint32_t)tiers_config[tier].slots * tiers_config[tier].period;
+  uint32_t stored_time;
+
+  for (uint32_t i = 0; i < SLOTS_PER_SECTOR; i++)
+  {
+    if (esp_partition_read(partition, sector + i * sizeof(rollup_slot_t), &stored_time, sizeof(stored_time)) != ESP_OK)
+      return false;
+
+    if (stored_time != ROLLUP_ERASED_TIME && (stored_time > time || time - stored_time < retention))
+      return false;
+  }
+
+  return true;
+}
+
+// Seeded with the period, so a slot is never taken for another tier layout
+static uint32_t slot_crc(rollup_tier_t tier, const rollup_slot_t *slot)
+{
+  return crc32_le(tiers_config[tier].period, (const uint8_t *)slot, offsetof(rollup_slot_t, crc));
+}
+
+static bool covers(rollup_tier_t tier, uint32_t now, uint32_t from)
+{
+  return from + (uint32_t)tiers_config[tier].slots * tiers_config[tier].period >= now;
+}
@@ -0,0 +1,45 @@
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pressure_sensors.h"
+
+typedef enum rollup_tier
+{
+  ROLLUP_TIER_10S, // last hour at 10 seconds
+  ROLLUP_TIER_1M,  // last day at 1 minute
+  ROLLUP_TIER_15M, // last month at 15 minutes
+  ROLLUP_TIERS_COUNT
+} rollup_tier_t;
+
+typedef struct rollup_channel
+{
+  pressure_value_t min; // Pa, 100 Pa resolution, or a sensor state if count is 0
+  pressure_value_t max;
+  pressure_value_t mean;
+  uint16_t count; // valid raw samples summarized
+} rollup_channel_t;
+
+typedef struct rollup_point
+{
+  uint32_t time; // tslog_time() of the period start
+  uint16_t period; // seconds
+  rollup_channel_t values[SENSORS_COUNT];
+} rollup_point_t;
+
+typedef void (*rollup_point_cb_t)(const rollup_point_t *point, void *arg);
+
+void rollup_start();
+
+// The coarsest tier with a period not longer than resolution_s which still holds `from`,
+// the finest tier holding `from` if none is fine enough, the longest one otherwise
+rollup_tier_t rollup_select_tier(uint32_t from, uint32_t resolution_s);
+
+// Points are reported oldest first, missing periods are skipped, the period in progress is reported last.
+// Both return the number of points reported.
+size_t rollup_query(uint32_t from, uint32_t to, uint32_t resolution_s, rollup_point_cb_t cb, void *arg);
+size_t rollup_query_tier(rollup_tier_t tier, uint32_t from, uint32_t to, rollup_point_cb_t cb, void *arg);
+
+#endif // _ROLLUP_H_
@@ -0,0 +1,116 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "screens.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+
+static const char *TAG = "SCREENS";
+
+#define SCREENS_MEM_SAMPLE_PERIOD_MS 1000
+
+/*
+  Only the shown screen exists in the LVGL heap: the next one is built on a new screen object,
+  loaded, and the previous one is deleted with all its children. lv_layer_top() and
+  lv_layer_sys() are not screens and keep their objects.
+*/
+
+/*
+  Declarations
+*/
+static void mem_sample_task_cb(lv_task_t *task);
+static uint32_t mem_used();
+
+static const screen_def_t *screens[SCREENS_COUNT];
+static screen_stats_t stats[SCREENS_COUNT];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static screen_id_t active = SCREENS_COUNT;
+static lv_task_t *mem_sample_task;
+
+void screens_register(screen_id_t id, const screen_def_t *def)
+{
+  screens[id] = def;
+}
+
+void screens_show(screen_id_t id, uint32_t arg)
+{
+  lv_obj_t *previous = lv_scr_act();
+
+  if (active < SCREENS_COUNT)
+  {
+    if (screens[active]->destroy != NULL)
+      screens[active]->destroy();
+
+    ESP_LOGI(TAG, "%s left, LVGL heap peak %d bytes", screens[active]->name, stats[active].mem_peak);
+  }
+
+  // the old tree goes first, so the two never take the heap together
+  lv_obj_t *screen = lv_obj_create(NULL, NULL);
+  lv_scr_load(screen);
+  lv_obj_del(previous);
+
+  int64_t started = esp_timer_get_time();
+
+  screens[id]->create(screen, arg);
+  active = id;
+
+  uint32_t build_us = esp_timer_get_time() - started;
+  uint32_t used     = mem_used();
+
+  portENTER_CRITICAL(&stats_lock);
+
+  stats[id].builds++;
+  stats[id].build_us        = build_us;
+  stats[id].mem_after_build = used;
+
+  if (used > stats[id].mem_peak)
+    stats[id].mem_peak = used;
+
+  portEXIT_CRITICAL(&stats_lock);
+
+  if (mem_sample_task == NULL)
+    mem_sample_task = lv_task_create(mem_sample_task_cb, SCREENS_MEM_SAMPLE_PERIOD_MS, LV_TASK_PRIO_LOWEST, NULL);
+
+  ESP_LOGI(TAG, "%s built in %d us, LVGL heap %d bytes", screens[id]->name, build_us, used);
+}
+
+screen_id_t screens_active()
+{
+  return active;
+}
+
+const char *screens_get_name(screen_id_t id)
+{
+  return screens[id] != NULL ? screens[id]->name : NULL;
+}
+
+void screens_get_stats(screen_id_t id, screen_stats_t *out)
+{
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats[id];
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+// Rendering and the screen's own tasks allocate too, the peak is followed while it is shown
+static void mem_sample_task_cb(lv_task_t *task)
+{
+  uint32_t used = mem_used();
+
+  portENTER_CRITICAL(&stats_lock);
+
+  if (active < SCREENS_COUNT && used > stats[active].mem_peak)
+    stats[active].mem_peak = used;
+
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+static uint32_t mem_used()
+{
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+
+  return mon.total_size - mon.free_size;
+}
@@ -0,0 +1,41 @@
+#ifndef _SCREENS_H_
+#define _SCREENS_H_
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+typedef enum screen_id
+{
+  SCREEN_HOME,  // gauges
+  SCREEN_TREND, // arg: sensor index
+  SCREENS_COUNT
+} screen_id_t;
+
+// A screen builds its object tree on a fresh LVGL screen object and forgets it in destroy,
+// the objects themselves are deleted with the screen. Styles shared between builds must be static.
+typedef struct screen_def
+{
+  const char *name;
+  void (*create)(lv_obj_t *screen, uint32_t arg);
+  void (*destroy)(); // optional, drops pointers into the tree and stops the screen lv_tasks
+} screen_def_t;
+
+typedef struct screen_stats
+{
+  uint32_t builds;
+  uint32_t build_us;       // the last one
+  uint32_t mem_after_build; // LVGL heap in use right after the build, bytes
+  uint32_t mem_peak;       // the most LVGL heap seen in use while the screen was shown
+} screen_stats_t;
+
+// GUI task only
+void screens_register(screen_id_t id, const screen_def_t *def);
+void screens_show(screen_id_t id, uint32_t arg);
+screen_id_t screens_active();
+
+// Any task, NULL for a screen not registered yet
+const char *screens_get_name(screen_id_t id);
+void screens_get_stats(screen_id_t id, screen_stats_t *stats);
+
+#endif // _SCREENS_H_
@@ -0,0 +1,244 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "telemetry.h"
+#include "tslog.h"
+
+#include "utils.h"
+
+static const char *TAG = "TELEMETRY";
+
+/*
+  The sequence number moves on every fast pressure change, changed 1 s aggregate, relay transition
+  and controller event, so consumers can tell "nothing changed" without comparing snapshots. The
+  controller flags set by its timers have no events, they are folded into the sequence on read.
+  The state sequence does the same for the relays and the controller alone.
+*/
+
+typedef struct
+{
+  char *buf;
+  size_t size;
+  size_t length;
+} json_writer_t;
+
+/*
+  Declarations
+*/
+static void pressure_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void change_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static uint8_t controller_flags();
+
+static void json_append(json_writer_t *writer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void json_pressure(json_writer_t *writer, const char *name, pressure_value_t value);
+
+static volatile uint32_t seq;
+static volatile uint32_t state_seq;
+
+static pressure_aggregate_t last_1s[SENSORS_COUNT];
+static portMUX_TYPE last_1s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void telemetry_start()
+{
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    last_1s[i] = (pressure_aggregate_t){.index = i, .rate = PRESSURE_RATE_1S, .mean = PRESSURE_SENSOR_ABSENT};
+
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_VALUE_CHANGED, pressure_handler, NULL, NULL);
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1S, aggregate_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAYS_EVENTS, ESP_EVENT_ANY_ID, change_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAY_CONTROL_EVENTS, ESP_EVENT_ANY_ID, change_handler, NULL, NULL);
+
+  ESP_LOGI(TAG, "Started");
+}
+
+uint32_t telemetry_seq()
+{
+  return seq * 32 + controller_flags();
+}
+
+uint32_t telemetry_state_seq()
+{
+  return state_seq * 32 + controller_flags();
+}
+
+void telemetry_get_snapshot(telemetry_snapshot_t *snapshot)
+{
+  // taken first: a change racing with the copy moves it past what the snapshot says
+  snapshot->seq       = telemetry_seq();
+  snapshot->time      = tslog_time();
+  snapshot->uptime_ms = esp_timer_get_time() / 1000;
+
+  portENTER_CRITICAL(&last_1s_lock);
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    snapshot->channels[i].last_1s = last_1s[i];
+  portEXIT_CRITICAL(&last_1s_lock);
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    snapshot->channels[i].pressure = get_pressure(i);
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    snapshot->relays[i] = relay_get_state(i);
+
+  snapshot->controller_running = relay_control_get_state(&snapshot->controller);
+
+  if (snapshot->controller_running)
+    compressor_health_get(&snapshot->health);
+  else
+    memset(&snapshot->health, 0, sizeof(compressor_health_t));
+
+  pressure_get_loop_stats(&snapshot->loop);
+}
+
+size_t telemetry_to_json(const telemetry_snapshot_t *s, uint8_t sections, char *buf, size_t size)
+{
+  json_writer_t writer = {.buf = buf, .size = size, .length = 0};
+  json_writer_t *w     = &writer;
+
+  json_append(w, "{\"seq\":%u,\"time\":%u,\"uptime_ms\":%lld", s->seq, s->time, s->uptime_ms);
+
+  if (sections & TELEMETRY_PRESSURE)
+  {
+    json_append(w, ",\"pressure\":[");
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    {
+      const telemetry_channel_t *c = &s->channels[i];
+
+      json_append(w, "%s{\"index\":%d,", i > 0 ? "," : "", i);
+      json_pressure(w, "value", c->pressure);
+      json_append(w, ",\"last_1s\":{\"count\":%d,", c->last_1s.count);
+      json_pressure(w, "mean", c->last_1s.mean);
+
+      if (c->last_1s.count > 0)
+        json_append(w, ",\"min\":%d,\"max\":%d", c->last_1s.min, c->last_1s.max);
+
+      json_append(w, "}}");
+    }
+
+    json_append(w, "]");
+  }
+
+  if (sections & TELEMETRY_RELAYS)
+  {
+    json_append(w, ",\"relays\":[");
+
+    for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+      json_append(w, "%s%s", i > 0 ? "," : "", s->relays[i] == RELAY_ON ? "true" : "false");
+
+    json_append(w, "]");
+  }
+
+  if ((sections & TELEMETRY_CONTROLLER) && s->controller_running)
+  {
+    const relay_control_state_t *c = &s->controller;
+
+    json_append(w, ",\"controller\":{\"relay\":%d,\"sensor\":%d,\"low_mark\":%d,\"high_mark\":%d,"
+                   "\"relay_on\":%s,\"under_low_mark\":%s,\"above_high_mark\":%s,\"max_on_time_exceeded\":%s,\"min_off_time_passed\":%s,"
+                   "\"manual_override\":%s}",
+                c->relay_index, c->pressure_sensor_index, c->pressure_low_mark, c->pressure_high_mark,
+                c->relay_on ? "true" : "false", c->under_low_mark ? "true" : "false", c->above_high_mark ? "true" : "false",
+                c->max_on_time_exceeded ? "true" : "false", c->min_off_time_passed ? "true" : "false",
+                c->manual_override ? "true" : "false");
+  }
+
+  if ((sections & TELEMETRY_HEALTH) && s->controller_running)
+  {
+    const compressor_health_t *h = &s->health;
+
+    json_append(w, ",\"health\":{\"runs\":%u,\"baseline_top_fill_rate\":%d,\"recent_top_fill_rate\":%d,\"degradation\":%d}",
+                h->runs_total, h->baseline_top_fill_rate, h->recent_top_fill_rate, h->degradation);
+  }
+
+  if (sections & TELEMETRY_LOOP)
+  {
+    json_append(w, ",\"loop\":{\"cycles\":%u,\"late\":%u,\"max_interval_us\":%u,\"first_reading_ms\":%u}",
+                s->loop.cycles, s->loop.late, s->loop.max_interval_us, s->loop.first_reading_ms);
+  }
+
+  json_append(w, "}");
+
+  return writer.length < size ? writer.length : 0;
+}
+
+static void pressure_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  seq++;
+}
+
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  pressure_aggregate_t *aggregate = (pressure_aggregate_t *)event_data;
+  pressure_aggregate_t *last      = &last_1s[aggregate->index];
+
+  // comes every second per channel, a steady one must not move the sequence and the ETags
+  portENTER_CRITICAL(&last_1s_lock);
+  bool changed = aggregate->count != last->count || aggregate->min != last->min ||
+                 aggregate->max != last->max || aggregate->mean != last->mean;
+  *last = *aggregate;
+  portEXIT_CRITICAL(&last_1s_lock);
+
+  if (changed)
+    seq++;
+}
+
+static void change_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  state_seq++;
+  seq++;
+}
+
+static uint8_t controller_flags()
+{
+  relay_control_state_t state;
+
+  if (!relay_control_get_state(&state))
+    return 0;
+
+  return state.relay_on | state.under_low_mark << 1 | state.above_high_mark << 2 |
+         state.max_on_time_exceeded << 3 | state.min_off_time_passed << 4;
+}
+
+// Stops writing at the end of the buffer but keeps counting, so the caller can tell it was cut
+static void json_append(json_writer_t *writer, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+
+  size_t left = writer->length < writer->size ? writer->size - writer->length : 0;
+  int written = vsnprintf(left > 0 ? writer->buf + writer->length : NULL, left, format, args);
+
+  if (written > 0)
+    writer->length += written;
+
+  va_end(args);
+}
+
+// Sensor states are strings, values are Pa
+static void json_pressure(json_writer_t *writer, const char *name, pressure_value_t value)
+{
+  switch (value)
+  {
+  case PRESSURE_REFERENCE_POWER_ERROR:
+    json_append(writer, "\"%s\":\"reference_power_error\"", name);
+    break;
+
+  case PRESSURE_SENSOR_ABSENT:
+    json_append(writer, "\"%s\":\"absent\"", name);
+    break;
+
+  case PRESSURE_SENSOR_OVERLOAD:
+    json_append(writer, "\"%s\":\"overload\"", name);
+    break;
+
+  default:
+    json_append(writer, "\"%s\":%d", name, value);
+    break;
+  }
+}
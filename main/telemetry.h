@@ -0,0 +1,54 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compressor_health.h"
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "relay_control.h"
+
+// Sections of the snapshot, for serializers which only need a part of it
+enum telemetry_sections
+{
+  TELEMETRY_PRESSURE   = 0x01,
+  TELEMETRY_RELAYS     = 0x02,
+  TELEMETRY_CONTROLLER = 0x04,
+  TELEMETRY_HEALTH     = 0x08,
+  TELEMETRY_LOOP       = 0x10,
+  TELEMETRY_ALL        = 0x1F
+};
+
+typedef struct telemetry_channel
+{
+  pressure_value_t pressure; // fast stream, Pa or a sensor state
+  pressure_aggregate_t last_1s;
+} telemetry_channel_t;
+
+// Everything the device knows right now, gathered for the network interfaces
+typedef struct telemetry_snapshot
+{
+  uint32_t seq;    // changes whenever anything below changes
+  uint32_t time;   // tslog_time()
+  int64_t uptime_ms;
+  telemetry_channel_t channels[SENSORS_COUNT];
+  relay_state_t relays[RELAYS_COUNT];
+  bool controller_running; // controller and health are valid
+  relay_control_state_t controller;
+  compressor_health_t health;
+  pressure_loop_stats_t loop;
+} telemetry_snapshot_t;
+
+void telemetry_start();
+
+uint32_t telemetry_seq();
+// Like telemetry_seq() but moves on relay and controller changes only
+uint32_t telemetry_state_seq();
+void telemetry_get_snapshot(telemetry_snapshot_t *snapshot);
+
+// JSON of the requested sections, returns the length or 0 if the buffer is too small
+size_t telemetry_to_json(const telemetry_snapshot_t *snapshot, uint8_t sections, char *buf, size_t size);
+
+#endif // _TELEMETRY_H_
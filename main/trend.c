@@ -0,0 +1,245 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "gauge.h"
+#include "history.h"
+#include "pressure_sensors.h"
+#include "trend.h"
+#include "utils.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+
+static const char *TAG = "TREND";
+
+#define TREND_WINDOW_US (CONFIG_UI_TREND_WINDOW_S * 1000000LL)
+#define TREND_RANGE_MARGIN 10 // kPa above and below the data
+#define TREND_TITLE_HEIGHT 24
+
+/*
+  Every pixel column is a bucket of window / width: the chart keeps the min and the max of
+  the bucket as two series, so short spikes survive any downsampling ratio. The chart is filled
+  from the history once when shown, then a single column is appended per bucket period.
+*/
+
+typedef struct
+{
+  pressure_value_t min;
+  pressure_value_t max;
+} trend_bucket_t;
+
+typedef struct
+{
+  trend_bucket_t *buckets;
+  uint16_t points;
+  int64_t from_us;
+  int64_t bucket_us;
+} trend_fill_t;
+
+/*
+  Declarations
+*/
+static void fill_chart(int64_t now_us);
+static void append_task_cb(lv_task_t *task);
+static void bucket_sample_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg);
+static void single_bucket_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg);
+static void fit_range(lv_coord_t min, lv_coord_t max);
+static void trend_create(lv_obj_t *screen, uint32_t sensor_index);
+static void trend_destroy();
+
+const screen_def_t trend_screen = {
+    .name    = "trend",
+    .create  = trend_create,
+    .destroy = trend_destroy};
+
+static lv_obj_t *title;
+static lv_obj_t *chart;
+static lv_chart_series_t *max_series;
+static lv_chart_series_t *min_series;
+static lv_task_t *append_task;
+
+static uint16_t points;
+static int64_t bucket_us;
+static int64_t next_bucket_end_us;
+static uint8_t shown_index;
+static lv_coord_t range_min;
+static lv_coord_t range_max;
+
+static void trend_create(lv_obj_t *screen, uint32_t sensor_index)
+{
+  shown_index = sensor_index;
+
+  title = lv_label_create(screen, NULL);
+  lv_obj_align(title, NULL, LV_ALIGN_IN_TOP_LEFT, LV_DPX(5), LV_DPX(3));
+
+  lv_label_set_text_fmt(title, "%d: last %d min, kPa", shown_index + 1, CONFIG_UI_TREND_WINDOW_S / 60);
+
+  chart = lv_chart_create(screen, NULL);
+  lv_obj_set_size(chart, lv_obj_get_width(screen), lv_obj_get_height(screen) - TREND_TITLE_HEIGHT);
+  lv_obj_align(chart, NULL, LV_ALIGN_IN_BOTTOM_MID, 0, 0);
+
+  // no paddings, so the series area is exactly one point per pixel column
+  lv_obj_set_style_local_pad_all(chart, LV_CHART_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_pad_all(chart, LV_CHART_PART_SERIES_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_size(chart, LV_CHART_PART_SERIES, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_line_width(chart, LV_CHART_PART_SERIES, LV_STATE_DEFAULT, 1);
+
+  points    = lv_obj_get_width(chart);
+  bucket_us = TREND_WINDOW_US / points;
+
+  lv_chart_set_type(chart, LV_CHART_TYPE_LINE);
+  lv_chart_set_update_mode(chart, LV_CHART_UPDATE_MODE_SHIFT);
+  lv_chart_set_div_line_count(chart, 3, 0);
+  lv_chart_set_point_count(chart, points);
+
+  max_series = lv_chart_add_series(chart, lv_theme_get_color_primary());
+  min_series = lv_chart_add_series(chart, lv_color_hex3(0x888));
+
+  ESP_LOGD(TAG, "%d points, %lld ms per point", points, bucket_us / 1000);
+
+  fill_chart(esp_timer_get_time());
+
+  append_task = lv_task_create(append_task_cb, bucket_us / 1000, LV_TASK_PRIO_LOW, NULL);
+}
+
+static void trend_destroy()
+{
+  lv_task_del(append_task);
+
+  append_task = NULL;
+  title       = NULL;
+  chart       = NULL;
+  max_series  = NULL;
+  min_series  = NULL;
+}
+
+// The only full pass over the history, when the view is shown
+static void fill_chart(int64_t now_us)
+{
+  trend_bucket_t *buckets = malloc(points * sizeof(trend_bucket_t));
+  ESP_MEM_CHECK(TAG, buckets, return);
+
+  for (uint16_t i = 0; i < points; i++)
+    buckets[i] = (trend_bucket_t){.min = INT32_MAX, .max = INT32_MIN};
+
+  int64_t to_us     = now_us / bucket_us * bucket_us;
+  trend_fill_t fill = {.buckets = buckets, .points = points, .from_us = to_us - points * bucket_us, .bucket_us = bucket_us};
+
+  history_read(shown_index, fill.from_us, to_us - 1, bucket_sample_cb, &fill);
+
+  lv_coord_t data_min = LV_COORD_MAX, data_max = LV_COORD_MIN;
+
+  // the shift mode draws from start_point, which every lv_chart_set_next() moves, a refill starts at 0
+  max_series->start_point = 0;
+  min_series->start_point = 0;
+
+  for (uint16_t i = 0; i < points; i++)
+  {
+    bool empty = buckets[i].max == INT32_MIN;
+
+    max_series->points[i] = empty ? LV_CHART_POINT_DEF : buckets[i].max / 1000;
+    min_series->points[i] = empty ? LV_CHART_POINT_DEF : buckets[i].min / 1000;
+
+    if (!empty)
+    {
+      data_min = LV_MATH_MIN(data_min, min_series->points[i]);
+      data_max = LV_MATH_MAX(data_max, max_series->points[i]);
+    }
+  }
+
+  free(buckets);
+
+  next_bucket_end_us = to_us + bucket_us;
+
+  range_min = range_max = 0;
+
+  if (data_min <= data_max)
+    fit_range(data_min, data_max);
+  else
+    fit_range(GAUGE_MIN_VALUE, GAUGE_MAX_VALUE);
+
+  lv_chart_refresh(chart);
+}
+
+// Shifts the chart by one column per finished bucket, only the new samples are read
+static void append_task_cb(lv_task_t *task)
+{
+  int64_t now_us = esp_timer_get_time();
+
+  // too far behind, e.g. the GUI was paused: a full refill is cheaper than many shifts
+  if (now_us - next_bucket_end_us > TREND_WINDOW_US / 4)
+  {
+    fill_chart(now_us);
+    return;
+  }
+
+  while (next_bucket_end_us <= now_us)
+  {
+    trend_bucket_t bucket = {.min = INT32_MAX, .max = INT32_MIN};
+
+    history_read(shown_index, next_bucket_end_us - bucket_us, next_bucket_end_us - 1, single_bucket_cb, &bucket);
+
+    if (bucket.max == INT32_MIN)
+    {
+      lv_chart_set_next(chart, max_series, LV_CHART_POINT_DEF);
+      lv_chart_set_next(chart, min_series, LV_CHART_POINT_DEF);
+    }
+    else
+    {
+      fit_range(bucket.min / 1000, bucket.max / 1000);
+
+      lv_chart_set_next(chart, max_series, bucket.max / 1000);
+      lv_chart_set_next(chart, min_series, bucket.min / 1000);
+    }
+
+    next_bucket_end_us += bucket_us;
+  }
+}
+
+static void bucket_sample_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg)
+{
+  trend_fill_t *fill = (trend_fill_t *)arg;
+
+  if (pressure < 0 || timestamp_us < fill->from_us)
+    return;
+
+  int64_t index = (timestamp_us - fill->from_us) / fill->bucket_us;
+
+  if (index >= fill->points)
+    return;
+
+  trend_bucket_t *bucket = &fill->buckets[index];
+
+  bucket->min = LV_MATH_MIN(bucket->min, pressure);
+  bucket->max = LV_MATH_MAX(bucket->max, pressure);
+}
+
+static void single_bucket_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg)
+{
+  trend_bucket_t *bucket = (trend_bucket_t *)arg;
+
+  if (pressure < 0)
+    return;
+
+  bucket->min = LV_MATH_MIN(bucket->min, pressure);
+  bucket->max = LV_MATH_MAX(bucket->max, pressure);
+}
+
+// Widens the Y range only, so appending never rescales the chart back and forth
+static void fit_range(lv_coord_t min, lv_coord_t max)
+{
+  bool unset = range_min == range_max;
+
+  if (!unset && min >= range_min && max <= range_max)
+    return;
+
+  range_min = unset ? min - TREND_RANGE_MARGIN : LV_MATH_MIN(range_min, min - TREND_RANGE_MARGIN);
+  range_max = unset ? max + TREND_RANGE_MARGIN : LV_MATH_MAX(range_max, max + TREND_RANGE_MARGIN);
+
+  if (range_min < GAUGE_MIN_VALUE)
+    range_min = GAUGE_MIN_VALUE;
+
+  lv_chart_set_range(chart, range_min, range_max);
+}
@@ -0,0 +1,12 @@
+#ifndef _TREND_H_
+#define _TREND_H_
+
+#include <stdint.h>
+
+#include "screens.h"
+
+// A full screen min/max sparkline of the last CONFIG_UI_TREND_WINDOW_S seconds of one sensor,
+// one chart point per pixel column whatever the window is. The screen arg is the sensor index.
+extern const screen_def_t trend_screen;
+
+#endif // _TREND_H_
@@ -0,0 +1,878 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp32/rom/crc.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "tslog.h"
+
+#include "utils.h"
+
+static const char *TAG = "TSLOG";
+
+/*
+  Append-only time-series log in the "tslog" data partition.
+
+  Every sector starts with a header holding a generation number (seq), sectors are filled and
+  erased strictly in turn, so every sector gets the same number of erases. The sector with
+  the highest seq is the head, the next one is the oldest.
+
+  A sector holds CRC protected blocks. A block is a self-contained delta encoded run of rows:
+    varint dt          - seconds since the previous row (since the block start for the first one)
+    uint8_t mask       - channels carried by the row, ROW_RELAY for a relay transition
+    per channel:       - zigzag varint mean delta, varint (mean - min), varint (max - mean)
+    relay transition:  - uint8_t (relay index << 1 | state)
+  Values are in PRESSURE_RESOLUTION units, a row is written only when something changed.
+  The first row of a block carries all channels, so any block can be decoded alone.
+
+  A torn block write fails its CRC and is skipped, a garbage block header ends the sector.
+  The RAM index keeps first\last times of every sector, so a range query only reads the
+  sectors it overlaps.
+*/
+
+#define TSLOG_PARTITION_LABEL "tslog"
+#define TSLOG_PARTITION_SUBTYPE 0x40
+#define TSLOG_SECTOR_SIZE 4096
+#define TSLOG_MAX_SECTORS 256
+#define TSLOG_SECTOR_MAGIC 0x474C5354 // "TSLG"
+#define TSLOG_BLOCK_MAGIC 0xB10C
+#define TSLOG_ERASED_MAGIC 0xFFFF
+#define TSLOG_VERSION 1
+
+#define TSLOG_BLOCK_SIZE CONFIG_TSLOG_BLOCK_SIZE
+#define TSLOG_FLUSH_INTERVAL_S CONFIG_TSLOG_FLUSH_INTERVAL_S
+#define TSLOG_SPREAD_DEADBAND CONFIG_TSLOG_SPREAD_DEADBAND_KPA // min\max closer than that to the mean are logged as the mean
+#define TSLOG_QUEUE_LENGTH 32
+#define TSLOG_STATS_INTERVAL_MS (10 * 60 * 1000)
+#define TSLOG_VALID_TIME 1577836800 // 2020-01-01, the wall clock is considered synced after it
+
+#define ROW_RELAY 0x80
+#define ROW_MAX_SIZE (5 + 1 + SENSORS_COUNT * 3 * 5 + 1)
+#define LOGICAL_AGGREGATE_SIZE (3 * sizeof(pressure_value_t))
+#define LOGICAL_RELAY_SIZE 2
+
+typedef struct tslog_sector_header
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint16_t version;
+  uint16_t block_size;
+  uint32_t crc;
+} tslog_sector_header_t;
+
+typedef struct tslog_block_header
+{
+  uint16_t magic;
+  uint16_t length; // payload
+  uint32_t t_start;
+  uint32_t t_end;
+  uint32_t crc; // header fields above and the payload
+} tslog_block_header_t;
+
+#define BLOCK_PAYLOAD_MAX (TSLOG_BLOCK_SIZE - sizeof(tslog_block_header_t))
+#define BLOCK_HEADER_CRC_LEN offsetof(tslog_block_header_t, crc)
+#define PAD4(x) (((x) + 3) & ~3)
+
+// RAM index entry
+typedef struct tslog_sector
+{
+  uint32_t seq; // 0 for an erased or invalid sector
+  uint32_t first;
+  uint32_t last;
+  uint16_t offset; // first free byte
+} tslog_sector_t;
+
+typedef enum
+{
+  TSLOG_ITEM_AGGREGATE,
+  TSLOG_ITEM_RELAY
+} tslog_item_type_t;
+
+typedef struct tslog_item
+{
+  uint8_t type;
+  union
+  {
+    pressure_aggregate_t aggregate;
+    struct
+    {
+      uint8_t index;
+      uint8_t state;
+    } relay;
+  };
+} tslog_item_t;
+
+typedef struct tslog_encoder
+{
+  uint32_t t_start;
+  uint32_t t_end;
+  uint32_t last_row;
+  uint16_t length;
+  uint8_t prev_known;
+  tslog_channel_t prev[SENSORS_COUNT]; // stored units, mean and spreads
+  uint8_t payload[PAD4(BLOCK_PAYLOAD_MAX)];
+} tslog_encoder_t;
+
+/*
+  Declarations
+*/
+static void tslog_task(void *pvParameter);
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void relay_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void count_dropped();
+static void count_logical_bytes(uint32_t bytes);
+
+static bool tslog_mount();
+static void scan_sector(uint16_t index, bool verify);
+static bool read_sector_header(uint16_t index, uint32_t *seq);
+static bool advance_sector();
+
+static void add_aggregate(const pressure_aggregate_t *aggregate);
+static void add_relay_transition(uint8_t index, uint8_t state);
+static void emit_row(uint32_t time);
+static bool start_row(uint32_t *time);
+static void flush_block();
+
+static void decode_block(const tslog_block_header_t *header, const uint8_t *payload, uint32_t from, uint32_t to, tslog_row_t *row, size_t *rows, tslog_row_cb_t cb, void *arg);
+static uint32_t block_crc(const tslog_block_header_t *header, const uint8_t *payload);
+
+static void log_stats();
+
+static uint8_t varint_write(uint8_t *buf, uint32_t value);
+static uint8_t varint_read(const uint8_t *buf, uint16_t len, uint32_t *value);
+static uint32_t zigzag(int32_t value);
+static int32_t unzigzag(uint32_t value);
+
+static const esp_partition_t *partition;
+static QueueHandle_t queue;
+static SemaphoreHandle_t index_lock;
+
+static tslog_sector_t sectors[TSLOG_MAX_SECTORS];
+static uint16_t sectors_count;
+static uint16_t head;
+
+static uint32_t boot_time_base; // tslog_time() at boot while the wall clock is not synced
+
+static tslog_channel_t current[SENSORS_COUNT]; // latest 1 second aggregates, stored units
+static uint8_t current_known;
+static uint8_t pending;
+
+static tslog_encoder_t *encoder;
+static tslog_stats_t stats;
+
+void tslog_start()
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TSLOG_PARTITION_SUBTYPE, TSLOG_PARTITION_LABEL);
+
+  if (partition == NULL)
+  {
+    ESP_LOGE(TAG, "No \"%s\" partition, logging is disabled", TSLOG_PARTITION_LABEL);
+    return;
+  }
+
+  index_lock = xSemaphoreCreateMutex();
+  queue      = xQueueCreate(TSLOG_QUEUE_LENGTH, sizeof(tslog_item_t));
+  encoder    = calloc(1, sizeof(tslog_encoder_t));
+
+  ESP_MEM_CHECK(TAG, index_lock && queue && encoder, abort());
+
+  if (!tslog_mount())
+    return;
+
+  xTaskCreate(tslog_task, "tslog", 4096, NULL, 1, NULL);
+
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_AGGREGATE_1S, aggregate_handler, NULL, NULL);
+  esp_event_handler_instance_register(RELAYS_EVENTS, ESP_EVENT_ANY_ID, relay_handler, NULL, NULL);
+}
+
+uint32_t tslog_time()
+{
+  time_t now = time(NULL);
+
+  if (now >= TSLOG_VALID_TIME)
+    return now;
+
+  return boot_time_base + esp_timer_get_time() / 1000000;
+}
+
+static void aggregate_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  tslog_item_t item = {.type = TSLOG_ITEM_AGGREGATE, .aggregate = *(pressure_aggregate_t *)event_data};
+
+  if (xQueueSend(queue, &item, 0) != pdTRUE)
+    count_dropped();
+}
+
+static void relay_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  tslog_item_t item = {
+      .type  = TSLOG_ITEM_RELAY,
+      .relay = {.index = *(uint8_t *)event_data, .state = event_id == RELAY_TURNED_ON ? RELAY_ON : RELAY_OFF}};
+
+  if (xQueueSend(queue, &item, 0) != pdTRUE)
+    count_dropped();
+}
+
+static void count_dropped()
+{
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+  stats.dropped++;
+  xSemaphoreGive(index_lock);
+}
+
+static void tslog_task(void *pvParameter)
+{
+  tslog_item_t item;
+  int64_t stats_logged_at = esp_timer_get_time();
+
+  while (1)
+  {
+    if (xQueueReceive(queue, &item, pdMS_TO_TICKS(TSLOG_STATS_INTERVAL_MS)) == pdTRUE)
+    {
+      if (item.type == TSLOG_ITEM_AGGREGATE)
+        add_aggregate(&item.aggregate);
+      else
+        add_relay_transition(item.relay.index, item.relay.state);
+    }
+
+    if (esp_timer_get_time() - stats_logged_at >= TSLOG_STATS_INTERVAL_MS * 1000LL)
+    {
+      stats_logged_at = esp_timer_get_time();
+      log_stats();
+    }
+  }
+}
+
+/*
+  Mounting
+*/
+static bool tslog_mount()
+{
+  sectors_count = partition->size / TSLOG_SECTOR_SIZE;
+
+  if (sectors_count > TSLOG_MAX_SECTORS)
+    sectors_count = TSLOG_MAX_SECTORS;
+
+  if (sectors_count < 2)
+  {
+    ESP_LOGE(TAG, "The partition is too small");
+    return false;
+  }
+
+  int64_t started = esp_timer_get_time();
+  uint32_t newest_seq = 0;
+
+  for (uint16_t i = 0; i < sectors_count; i++)
+  {
+    sectors[i] = (tslog_sector_t){.seq = 0, .first = UINT32_MAX, .last = 0, .offset = TSLOG_SECTOR_SIZE};
+
+    if (read_sector_header(i, &sectors[i].seq) && sectors[i].seq > newest_seq)
+    {
+      newest_seq = sectors[i].seq;
+      head       = i;
+    }
+  }
+
+  if (newest_seq == 0)
+  {
+    ESP_LOGI(TAG, "Empty log, formatting");
+
+    head = sectors_count - 1; // so the first sector is the next one
+    advance_sector();
+  }
+  else
+  {
+    for (uint16_t i = 0; i < sectors_count; i++)
+    {
+      if (sectors[i].seq != 0)
+        scan_sector(i, i == head);
+
+      if (sectors[i].last > boot_time_base)
+        boot_time_base = sectors[i].last;
+    }
+  }
+
+  stats.sectors = sectors_count;
+  stats.erases  = 0;
+
+  ESP_LOGI(TAG, "Mounted %d sectors in %lld us, head: #%d (seq %d), last record: %d",
+           sectors_count, esp_timer_get_time() - started, head, sectors[head].seq, boot_time_base);
+
+  if (boot_time_base > 0)
+    boot_time_base++;
+
+  return true;
+}
+
+static bool read_sector_header(uint16_t index, uint32_t *seq)
+{
+  tslog_sector_header_t header;
+
+  if (esp_partition_read(partition, index * TSLOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+    return false;
+
+  if (header.magic != TSLOG_SECTOR_MAGIC || header.version != TSLOG_VERSION || header.block_size != TSLOG_BLOCK_SIZE ||
+      header.crc != crc32_le(0, (const uint8_t *)&header, offsetof(tslog_sector_header_t, crc)))
+    return false;
+
+  *seq = header.seq;
+
+  return true;
+}
+
+// Walks block headers only, payload CRCs are checked for the head sector where a write could be torn
+static void scan_sector(uint16_t index, bool verify)
+{
+  tslog_sector_t *sector = &sectors[index];
+  tslog_block_header_t header;
+  uint32_t offset = sizeof(tslog_sector_header_t);
+
+  while (offset + sizeof(header) <= TSLOG_SECTOR_SIZE)
+  {
+    esp_partition_read(partition, index * TSLOG_SECTOR_SIZE + offset, &header, sizeof(header));
+
+    if (header.magic == TSLOG_ERASED_MAGIC && header.length == 0xFFFF)
+      break;
+
+    if (header.magic != TSLOG_BLOCK_MAGIC || header.length > BLOCK_PAYLOAD_MAX ||
+        offset + PAD4(sizeof(header) + header.length) > TSLOG_SECTOR_SIZE)
+    {
+      ESP_LOGW(TAG, "Sector #%d: broken block header at %d, the rest of the sector is skipped", index, offset);
+      offset = TSLOG_SECTOR_SIZE;
+      break;
+    }
+
+    bool valid = true;
+
+    if (verify)
+    {
+      esp_partition_read(partition, index * TSLOG_SECTOR_SIZE + offset + sizeof(header), encoder->payload, header.length);
+      valid = header.crc == block_crc(&header, encoder->payload);
+
+      if (!valid)
+        ESP_LOGW(TAG, "Sector #%d: block at %d fails CRC, skipped", index, offset);
+    }
+
+    if (valid)
+    {
+      if (header.t_start < sector->first)
+        sector->first = header.t_start;
+
+      if (header.t_end > sector->last)
+        sector->last = header.t_end;
+    }
+
+    offset += PAD4(sizeof(header) + header.length);
+  }
+
+  sector->offset = offset;
+}
+
+// false if the sector can't be erased, the head stays and the next flush tries again
+static bool advance_sector()
+{
+  uint16_t next = (head + 1) % sectors_count;
+  uint32_t seq  = sectors[head].seq + 1;
+
+  tslog_sector_header_t header = {
+      .magic      = TSLOG_SECTOR_MAGIC,
+      .seq        = seq,
+      .version    = TSLOG_VERSION,
+      .block_size = TSLOG_BLOCK_SIZE};
+  header.crc = crc32_le(0, (const uint8_t *)&header, offsetof(tslog_sector_header_t, crc));
+
+  // drop the sector from the index before it is erased, so queries skip it
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+  sectors[next] = (tslog_sector_t){.seq = 0, .first = UINT32_MAX, .last = 0, .offset = TSLOG_SECTOR_SIZE};
+  xSemaphoreGive(index_lock);
+
+  int64_t started = esp_timer_get_time();
+
+  esp_err_t err = esp_partition_erase_range(partition, next * TSLOG_SECTOR_SIZE, TSLOG_SECTOR_SIZE);
+  if (err == ESP_OK)
+    err = esp_partition_write(partition, next * TSLOG_SECTOR_SIZE, &header, sizeof(header));
+
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Sector #%d erase failed: %s", next, esp_err_to_name(err));
+
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+
+  if (err == ESP_OK)
+  {
+    sectors[next] = (tslog_sector_t){.seq = seq, .first = UINT32_MAX, .last = 0, .offset = sizeof(header)};
+    head          = next;
+
+    stats.erases++;
+    stats.flash_bytes += sizeof(header);
+  }
+  else
+  {
+    stats.flash_errors++;
+  }
+
+  stats.write_us += esp_timer_get_time() - started;
+  xSemaphoreGive(index_lock);
+
+  return err == ESP_OK;
+}
+
+/*
+  Encoding
+*/
+static pressure_value_t to_stored(pressure_value_t pressure)
+{
+  return pressure < 0 ? pressure : (pressure + PRESSURE_RESOLUTION / 2) / PRESSURE_RESOLUTION;
+}
+
+static pressure_value_t from_stored(pressure_value_t value)
+{
+  return value < 0 ? value : value * PRESSURE_RESOLUTION;
+}
+
+static pressure_value_t stored_spread(pressure_value_t from, pressure_value_t to)
+{
+  pressure_value_t spread = to_stored(to) - to_stored(from);
+  return spread < TSLOG_SPREAD_DEADBAND ? 0 : spread;
+}
+
+static void add_aggregate(const pressure_aggregate_t *aggregate)
+{
+  uint8_t bit = 1 << aggregate->index;
+
+  // a channel seen twice means the next second has started
+  if (pending & bit)
+    emit_row(tslog_time());
+
+  tslog_channel_t *value = &current[aggregate->index];
+
+  value->mean = to_stored(aggregate->mean);
+  value->min  = aggregate->count > 0 ? stored_spread(aggregate->min, aggregate->mean) : 0;
+  value->max  = aggregate->count > 0 ? stored_spread(aggregate->mean, aggregate->max) : 0;
+
+  current_known |= bit;
+  pending |= bit;
+
+  count_logical_bytes(LOGICAL_AGGREGATE_SIZE);
+
+  if (pending == (1 << SENSORS_COUNT) - 1)
+    emit_row(tslog_time());
+}
+
+static void add_relay_transition(uint8_t index, uint8_t state)
+{
+  uint32_t time = tslog_time();
+
+  if (!start_row(&time))
+    return;
+
+  uint8_t *out = encoder->payload + encoder->length;
+
+  out += varint_write(out, time - encoder->last_row);
+  *out++ = ROW_RELAY;
+  *out++ = (index << 1) | (state & 1);
+
+  encoder->length   = out - encoder->payload;
+  encoder->last_row = time;
+
+  count_logical_bytes(LOGICAL_RELAY_SIZE + sizeof(uint32_t));
+}
+
+static void emit_row(uint32_t time)
+{
+  pending = 0;
+
+  if (!start_row(&time))
+    return;
+
+  uint8_t changed = 0;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    uint8_t bit = 1 << i;
+
+    if ((current_known & bit) &&
+        ((encoder->prev_known & bit) == 0 || memcmp(&encoder->prev[i], &current[i], sizeof(tslog_channel_t)) != 0))
+      changed |= bit;
+  }
+
+  count_logical_bytes(sizeof(uint32_t));
+
+  if (changed == 0)
+    return;
+
+  uint8_t *out = encoder->payload + encoder->length;
+
+  out += varint_write(out, time - encoder->last_row);
+  *out++ = changed;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    if ((changed & (1 << i)) == 0)
+      continue;
+
+    pressure_value_t prev_mean = (encoder->prev_known & (1 << i)) ? encoder->prev[i].mean : 0;
+
+    out += varint_write(out, zigzag(current[i].mean - prev_mean));
+    out += varint_write(out, current[i].min);
+    out += varint_write(out, current[i].max);
+
+    encoder->prev[i] = current[i];
+  }
+
+  encoder->prev_known |= changed;
+  encoder->length   = out - encoder->payload;
+  encoder->last_row = time;
+}
+
+// Keeps the time monotonic, flushes the block when it is full or old enough and starts a new one if needed
+static bool start_row(uint32_t *time)
+{
+  if (encoder->length > 0 && *time < encoder->last_row)
+    *time = encoder->last_row;
+
+  if (encoder->length > 0 &&
+      (encoder->length + ROW_MAX_SIZE > BLOCK_PAYLOAD_MAX || *time - encoder->t_start >= TSLOG_FLUSH_INTERVAL_S))
+    flush_block();
+
+  if (encoder->length == 0)
+  {
+    if (*time < encoder->t_end)
+      *time = encoder->t_end;
+
+    encoder->t_start    = *time;
+    encoder->last_row   = *time;
+    encoder->prev_known = 0;
+  }
+
+  encoder->t_end = *time;
+
+  return true;
+}
+
+static void flush_block()
+{
+  tslog_block_header_t header = {
+      .magic   = TSLOG_BLOCK_MAGIC,
+      .length  = encoder->length,
+      .t_start = encoder->t_start,
+      .t_end   = encoder->t_end};
+  header.crc = block_crc(&header, encoder->payload);
+
+  uint16_t padded = PAD4(encoder->length);
+  memset(encoder->payload + encoder->length, 0xFF, padded - encoder->length);
+
+  // the block is lost, the encoder starts over
+  if (sectors[head].offset + sizeof(header) + padded > TSLOG_SECTOR_SIZE && !advance_sector())
+  {
+    encoder->length = 0;
+    return;
+  }
+
+  uint32_t address = head * TSLOG_SECTOR_SIZE + sectors[head].offset;
+  int64_t started  = esp_timer_get_time();
+
+  // the header goes first: a block torn in the middle of the payload fails its CRC on mount
+  esp_err_t err = esp_partition_write(partition, address, &header, sizeof(header));
+  if (err == ESP_OK)
+    err = esp_partition_write(partition, address + sizeof(header), encoder->payload, padded);
+
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Block write failed: %s", esp_err_to_name(err));
+
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+
+  tslog_sector_t *sector = &sectors[head];
+  sector->offset += sizeof(header) + padded;
+
+  if (err == ESP_OK)
+  {
+    if (header.t_start < sector->first)
+      sector->first = header.t_start;
+
+    sector->last = header.t_end;
+
+    stats.blocks++;
+    stats.payload_bytes += encoder->length;
+  }
+  else
+  {
+    stats.flash_errors++;
+  }
+
+  stats.flash_bytes += sizeof(header) + padded;
+  stats.write_us += esp_timer_get_time() - started;
+
+  xSemaphoreGive(index_lock);
+
+  encoder->length = 0;
+}
+
+// 64 bit, tslog_get_stats() must not see it half written
+static void count_logical_bytes(uint32_t bytes)
+{
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+  stats.logical_bytes += bytes;
+  xSemaphoreGive(index_lock);
+}
+
+static uint32_t block_crc(const tslog_block_header_t *header, const uint8_t *payload)
+{
+  uint32_t crc = crc32_le(0, (const uint8_t *)header, BLOCK_HEADER_CRC_LEN);
+  return crc32_le(crc, payload, header->length);
+}
+
+/*
+  Queries
+*/
+size_t tslog_query(uint32_t from, uint32_t to, tslog_row_cb_t cb, void *arg)
+{
+  if (partition == NULL)
+    return 0;
+
+  uint16_t selected[TSLOG_MAX_SECTORS];
+  uint32_t selected_seq[TSLOG_MAX_SECTORS];
+  uint16_t selected_count = 0;
+
+  // oldest first: the sector after the head is the oldest one
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+
+  for (uint16_t n = 1; n <= sectors_count; n++)
+  {
+    uint16_t i = (head + n) % sectors_count;
+
+    if (sectors[i].seq != 0 && sectors[i].first <= to && sectors[i].last >= from)
+    {
+      selected[selected_count]       = i;
+      selected_seq[selected_count++] = sectors[i].seq;
+    }
+  }
+
+  xSemaphoreGive(index_lock);
+
+  uint8_t *payload = malloc(PAD4(BLOCK_PAYLOAD_MAX));
+  ESP_MEM_CHECK(TAG, payload, return 0);
+
+  tslog_row_t row;
+  size_t rows = 0;
+
+  for (uint16_t n = 0; n < selected_count; n++)
+  {
+    uint16_t i      = selected[n];
+    uint32_t offset = sizeof(tslog_sector_header_t);
+    uint32_t seq;
+    tslog_block_header_t header;
+
+    while (offset + sizeof(header) <= TSLOG_SECTOR_SIZE)
+    {
+      esp_partition_read(partition, i * TSLOG_SECTOR_SIZE + offset, &header, sizeof(header));
+
+      if (header.magic != TSLOG_BLOCK_MAGIC || header.length > BLOCK_PAYLOAD_MAX)
+        break;
+
+      if (header.t_end >= from && header.t_start <= to)
+      {
+        esp_partition_read(partition, i * TSLOG_SECTOR_SIZE + offset + sizeof(header), payload, header.length);
+
+        // the sector may have been recycled while it was read
+        if (!read_sector_header(i, &seq) || seq != selected_seq[n])
+          break;
+
+        if (header.crc == block_crc(&header, payload))
+          decode_block(&header, payload, from, to, &row, &rows, cb, arg);
+      }
+
+      offset += PAD4(sizeof(header) + header.length);
+    }
+  }
+
+  free(payload);
+
+  return rows;
+}
+
+// Rows before `from` only build the state up, that state is reported as a row at `from`
+static void decode_block(const tslog_block_header_t *header, const uint8_t *payload, uint32_t from, uint32_t to, tslog_row_t *row, size_t *rows, tslog_row_cb_t cb, void *arg)
+{
+  pressure_value_t means[SENSORS_COUNT] = {0};
+  uint32_t time   = header->t_start;
+  uint16_t offset = 0;
+  bool before     = false;
+
+  memset(row, 0, sizeof(tslog_row_t));
+
+  while (offset < header->length)
+  {
+    uint32_t value;
+
+    offset += varint_read(payload + offset, header->length - offset, &value);
+    time += value;
+
+    if (offset >= header->length || time > to)
+      break;
+
+    if (before && time > from)
+    {
+      row->time        = from;
+      row->changed     = 0;
+      row->relay_index = TSLOG_NO_RELAY_EVENT;
+      cb(row, arg);
+      (*rows)++;
+    }
+
+    before = time < from;
+
+    uint8_t mask = payload[offset++];
+
+    row->time        = time;
+    row->changed     = 0;
+    row->relay_index = TSLOG_NO_RELAY_EVENT;
+
+    if (mask == ROW_RELAY)
+    {
+      if (offset >= header->length)
+        break;
+
+      row->relay_index = payload[offset] >> 1;
+      row->relay_state = payload[offset++] & 1;
+    }
+    else
+    {
+      for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+      {
+        if ((mask & (1 << i)) == 0)
+          continue;
+
+        uint32_t lo, hi;
+
+        offset += varint_read(payload + offset, header->length - offset, &value);
+        offset += varint_read(payload + offset, header->length - offset, &lo);
+        offset += varint_read(payload + offset, header->length - offset, &hi);
+
+        means[i] += unzigzag(value);
+
+        tslog_channel_t *channel = &row->values[i];
+        channel->mean            = from_stored(means[i]);
+        channel->min             = means[i] < 0 ? channel->mean : from_stored(means[i] - lo);
+        channel->max             = means[i] < 0 ? channel->mean : from_stored(means[i] + hi);
+      }
+
+      row->changed = mask;
+    }
+
+    if (!before)
+    {
+      cb(row, arg);
+      (*rows)++;
+    }
+  }
+
+  if (before && header->t_end >= from)
+  {
+    row->time        = from;
+    row->changed     = 0;
+    row->relay_index = TSLOG_NO_RELAY_EVENT;
+    cb(row, arg);
+    (*rows)++;
+  }
+}
+
+void tslog_get_stats(tslog_stats_t *out)
+{
+  if (partition == NULL)
+  {
+    memset(out, 0, sizeof(tslog_stats_t));
+    return;
+  }
+
+  xSemaphoreTake(index_lock, portMAX_DELAY);
+
+  *out              = stats;
+  out->sectors_used = 0;
+  out->oldest       = UINT32_MAX;
+  out->newest       = 0;
+
+  for (uint16_t i = 0; i < sectors_count; i++)
+  {
+    if (sectors[i].seq == 0 || sectors[i].first == UINT32_MAX)
+      continue;
+
+    out->sectors_used++;
+
+    if (sectors[i].first < out->oldest)
+      out->oldest = sectors[i].first;
+
+    if (sectors[i].last > out->newest)
+      out->newest = sectors[i].last;
+  }
+
+  xSemaphoreGive(index_lock);
+}
+
+static void log_stats()
+{
+  tslog_stats_t s;
+  tslog_get_stats(&s);
+
+  if (s.payload_bytes == 0 || s.write_us == 0)
+    return;
+
+  ESP_LOGI(TAG, "%d/%d sectors, %d erases, %d blocks, %d dropped, %d flash errors, span: %d s",
+           s.sectors_used, s.sectors, s.erases, s.blocks, s.dropped, s.flash_errors, s.newest - s.oldest);
+  ESP_LOGI(TAG, "logical: %lld B, encoded: %lld B, flash: %lld B, compression: x%lld.%02lld, write amplification: %lld.%02lld, append: %lld B/s of flash time",
+           s.logical_bytes, s.payload_bytes, s.flash_bytes,
+           s.logical_bytes / s.payload_bytes, s.logical_bytes * 100 / s.payload_bytes % 100,
+           s.flash_bytes / s.payload_bytes, s.flash_bytes * 100 / s.payload_bytes % 100,
+           s.flash_bytes * 1000000 / s.write_us);
+}
+
+static uint8_t varint_write(uint8_t *buf, uint32_t value)
+{
+  uint8_t len = 0;
+
+  while (value >= 0x80)
+  {
+    buf[len++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+
+  buf[len++] = value;
+
+  return len;
+}
+
+static uint8_t varint_read(const uint8_t *buf, uint16_t len, uint32_t *value)
+{
+  uint8_t n = 0;
+  *value    = 0;
+
+  while (n < len && n < 5)
+  {
+    *value |= (uint32_t)(buf[n] & 0x7F) << (7 * n);
+
+    if ((buf[n++] & 0x80) == 0)
+      break;
+  }
+
+  return n;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
@@ -0,0 +1,53 @@
+#ifndef _TSLOG_H_
+#define _TSLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pressure_sensors.h"
+
+#define TSLOG_NO_RELAY_EVENT 0xFF
+
+typedef struct tslog_channel
+{
+  pressure_value_t mean; // Pa or a sensor state
+  pressure_value_t min;
+  pressure_value_t max;
+} tslog_channel_t;
+
+// A decoded log row. Rows are only written when something changed, so the values
+// hold for every second from the row time till the next row.
+typedef struct tslog_row
+{
+  uint32_t time;                          // tslog_time() seconds
+  uint8_t changed;                        // bitmask of channels that changed in this row
+  tslog_channel_t values[SENSORS_COUNT];  // state of all channels
+  uint8_t relay_index;                    // TSLOG_NO_RELAY_EVENT if the row is not a relay transition
+  uint8_t relay_state;
+} tslog_row_t;
+
+typedef void (*tslog_row_cb_t)(const tslog_row_t *row, void *arg);
+
+typedef struct tslog_stats
+{
+  uint32_t sectors;
+  uint32_t sectors_used;
+  uint32_t erases;
+  uint32_t blocks;
+  uint32_t dropped;        // events lost on a full queue
+  uint32_t flash_errors;   // failed erases and writes, the block being written is dropped
+  uint32_t oldest;         // tslog_time() of the oldest row
+  uint32_t newest;
+  uint64_t logical_bytes;  // aggregates and transitions as they come in (pressure_aggregate_t values + time)
+  uint64_t payload_bytes;  // encoded
+  uint64_t flash_bytes;    // written to flash, block and sector headers included
+  uint64_t write_us;       // spent in flash write\erase calls
+} tslog_stats_t;
+
+void tslog_start();
+
+uint32_t tslog_time();
+size_t tslog_query(uint32_t from, uint32_t to, tslog_row_cb_t cb, void *arg);
+void tslog_get_stats(tslog_stats_t *stats);
+
+#endif // _TSLOG_H_
@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/inet.h"
+#include "lwip/sockets.h"
+
+#include "pressure_sensors.h"
+#include "relay.h"
+#include "udp_telemetry.h"
+
+static const char *TAG = "UDP";
+
+/*
+  The sensor tasks push their raw and filtered samples into a small ring per channel and return.
+  The sender task wakes once per frame, lines the rings up by timestamp, since the channels of a
+  cycle are measured by different tasks a few milliseconds apart, and packs whole cycles.
+*/
+
+#define UDP_TELEMETRY_CYCLES CONFIG_UDP_TELEMETRY_CYCLES_PER_FRAME
+#define UDP_TELEMETRY_RING (UDP_TELEMETRY_CYCLES * 2 + 8)
+#define UDP_TELEMETRY_CYCLE_MAX (5 + 1 + SENSORS_COUNT * 2 * 5) // dt, relays, two varints per channel
+#define UDP_TELEMETRY_FRAME_MAX (sizeof(udp_telemetry_header_t) + UDP_TELEMETRY_CYCLES * UDP_TELEMETRY_CYCLE_MAX)
+#define UDP_TELEMETRY_ALIGN_US (PRESSURE_MEASURE_CYCLE_MS * 1000 / 2)
+#define UDP_TELEMETRY_STATS_INTERVAL_US (60 * 1000000LL)
+
+typedef struct udp_sample
+{
+  int64_t timestamp_us;
+  pressure_value_t raw;
+  pressure_value_t filtered;
+  uint8_t relays;
+} udp_sample_t;
+
+typedef struct udp_channel
+{
+  pressure_value_t raw; // waits for the filtered value of the same cycle
+  uint8_t head;
+  uint8_t count;
+  udp_sample_t ring[UDP_TELEMETRY_RING];
+} udp_channel_t;
+
+/*
+  Declarations
+*/
+static void raw_sample_cb(const pressure_aggregate_t *sample, void *arg);
+static void filtered_sample_cb(const pressure_aggregate_t *sample, void *arg);
+static void udp_telemetry_task(void *arg);
+static uint8_t take_cycles(udp_sample_t cycles[][SENSORS_COUNT], uint8_t max);
+static size_t encode_frame(udp_sample_t cycles[][SENSORS_COUNT], uint8_t count);
+static uint8_t varint_write(uint8_t *buf, uint32_t value);
+static uint32_t zigzag(int32_t value);
+
+static udp_channel_t channels[SENSORS_COUNT];
+static portMUX_TYPE channels_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int sock = -1;
+static struct sockaddr_in collector;
+
+static uint32_t seq;
+static uint8_t frame[UDP_TELEMETRY_FRAME_MAX];
+static udp_telemetry_stats_t stats;
+
+void udp_telemetry_start()
+{
+  if (strlen(CONFIG_UDP_TELEMETRY_COLLECTOR) == 0)
+  {
+    ESP_LOGI(TAG, "No collector configured, UDP telemetry is disabled");
+    return;
+  }
+
+  collector.sin_family = AF_INET;
+  collector.sin_port   = htons(CONFIG_UDP_TELEMETRY_PORT);
+
+  if (inet_pton(AF_INET, CONFIG_UDP_TELEMETRY_COLLECTOR, &collector.sin_addr) != 1)
+  {
+    ESP_LOGE(TAG, "\"%s\" is not an IPv4 address, UDP telemetry is disabled", CONFIG_UDP_TELEMETRY_COLLECTOR);
+    return;
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+
+  if (sock < 0)
+  {
+    ESP_LOGE(TAG, "Can't create a socket: errno %d", errno);
+    return;
+  }
+
+  pressure_stream_subscribe(PRESSURE_RATE_RAW, raw_sample_cb, NULL);
+  pressure_stream_subscribe(PRESSURE_RATE_FAST, filtered_sample_cb, NULL);
+
+  xTaskCreate(udp_telemetry_task, "udp telemetry", 3072, NULL, 1, NULL);
+
+  ESP_LOGI(TAG, "Sending to %s:%d, %d cycles per frame", CONFIG_UDP_TELEMETRY_COLLECTOR, CONFIG_UDP_TELEMETRY_PORT, UDP_TELEMETRY_CYCLES);
+}
+
+void udp_telemetry_get_stats(udp_telemetry_stats_t *out)
+{
+  portENTER_CRITICAL(&channels_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&channels_lock);
+}
+
+// The raw sample of a cycle comes right before the filtered one, from the same task
+static void raw_sample_cb(const pressure_aggregate_t *sample, void *arg)
+{
+  channels[sample->index].raw = sample->mean;
+}
+
+static void filtered_sample_cb(const pressure_aggregate_t *sample, void *arg)
+{
+  udp_channel_t *channel = &channels[sample->index];
+  uint8_t relays         = 0;
+
+  for (uint8_t i = 0; i < RELAYS_COUNT; i++)
+    relays |= (relay_get_state(i) == RELAY_ON) << i;
+
+  portENTER_CRITICAL(&channels_lock);
+
+  if (channel->count == UDP_TELEMETRY_RING)
+  {
+    channel->head = (channel->head + 1) % UDP_TELEMETRY_RING;
+    channel->count--;
+    stats.overruns++;
+  }
+
+  channel->ring[(channel->head + channel->count) % UDP_TELEMETRY_RING] = (udp_sample_t){
+      .timestamp_us = sample->timestamp_us,
+      .raw          = channel->raw,
+      .filtered     = sample->mean,
+      .relays       = relays};
+  channel->count++;
+
+  portEXIT_CRITICAL(&channels_lock);
+}
+
+static void udp_telemetry_task(void *arg)
+{
+  static udp_sample_t cycles[UDP_TELEMETRY_CYCLES][SENSORS_COUNT];
+
+  TickType_t last_wake    = xTaskGetTickCount();
+  int64_t stats_logged_at = esp_timer_get_time();
+
+  while (1)
+  {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(UDP_TELEMETRY_CYCLES * PRESSURE_MEASURE_CYCLE_MS));
+
+    uint8_t count;
+
+    // a late wake up may find more than a frame
+    while ((count = take_cycles(cycles, UDP_TELEMETRY_CYCLES)) > 0)
+    {
+      int64_t started = esp_timer_get_time();
+      size_t length   = encode_frame(cycles, count);
+      int64_t encoded = esp_timer_get_time();
+
+      int sent = sendto(sock, frame, length, 0, (struct sockaddr *)&collector, sizeof(collector));
+
+      uint32_t encode_us = encoded - started;
+      uint32_t send_us   = esp_timer_get_time() - encoded;
+
+      portENTER_CRITICAL(&channels_lock);
+
+      if (sent == length)
+      {
+        stats.frames++;
+        stats.bytes += length;
+        stats.samples += count * SENSORS_COUNT * 2;
+      }
+      else
+        stats.send_errors++;
+
+      stats.encode_us_total += encode_us;
+      stats.encode_us_max = encode_us > stats.encode_us_max ? encode_us : stats.encode_us_max;
+      stats.send_us_total += send_us;
+      stats.send_us_max = send_us > stats.send_us_max ? send_us : stats.send_us_max;
+
+      portEXIT_CRITICAL(&channels_lock);
+
+      if (count < UDP_TELEMETRY_CYCLES)
+        break;
+    }
+
+    if (esp_timer_get_time() - stats_logged_at >= UDP_TELEMETRY_STATS_INTERVAL_US)
+    {
+      udp_telemetry_stats_t current;
+      udp_telemetry_get_stats(&current);
+
+      uint32_t attempts = current.frames + current.send_errors;
+
+      ESP_LOGI(TAG, "%u frames, %u bytes/frame, %.2f bytes/sample, encode avg %u us max %u us, send avg %u us max %u us, %u send errors, %u overruns",
+               current.frames,
+               current.frames > 0 ? (uint32_t)(current.bytes / current.frames) : 0,
+               current.samples > 0 ? (double)current.bytes / current.samples : 0.0,
+               attempts > 0 ? (uint32_t)(current.encode_us_total / attempts) : 0, current.encode_us_max,
+               attempts > 0 ? (uint32_t)(current.send_us_total / attempts) : 0, current.send_us_max,
+               current.send_errors, current.overruns);
+
+      stats_logged_at = esp_timer_get_time();
+    }
+  }
+}
+
+// Takes up to max complete cycles, a channel sample is dropped if no other channel has its cycle
+static uint8_t take_cycles(udp_sample_t cycles[][SENSORS_COUNT], uint8_t max)
+{
+  uint8_t count = 0;
+
+  portENTER_CRITICAL(&channels_lock);
+
+  while (count < max)
+  {
+    int64_t newest = INT64_MIN;
+    bool complete  = true;
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    {
+      if (channels[i].count == 0)
+      {
+        complete = false;
+        break;
+      }
+
+      int64_t timestamp_us = channels[i].ring[channels[i].head].timestamp_us;
+      newest               = timestamp_us > newest ? timestamp_us : newest;
+    }
+
+    if (!complete)
+      break;
+
+    bool aligned = true;
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    {
+      udp_channel_t *channel = &channels[i];
+
+      if (channel->ring[channel->head].timestamp_us < newest - UDP_TELEMETRY_ALIGN_US)
+      {
+        channel->head = (channel->head + 1) % UDP_TELEMETRY_RING;
+        channel->count--;
+        aligned = false;
+      }
+    }
+
+    if (!aligned)
+      continue;
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    {
+      udp_channel_t *channel = &channels[i];
+
+      cycles[count][i] = channel->ring[channel->head];
+      channel->head    = (channel->head + 1) % UDP_TELEMETRY_RING;
+      channel->count--;
+    }
+
+    count++;
+  }
+
+  portEXIT_CRITICAL(&channels_lock);
+
+  return count;
+}
+
+static size_t encode_frame(udp_sample_t cycles[][SENSORS_COUNT], uint8_t count)
+{
+  udp_telemetry_header_t *header = (udp_telemetry_header_t *)frame;
+  size_t length                  = sizeof(udp_telemetry_header_t);
+
+  *header = (udp_telemetry_header_t){
+      .magic        = UDP_TELEMETRY_MAGIC,
+      .version      = UDP_TELEMETRY_VERSION,
+      .channels     = SENSORS_COUNT,
+      .seq          = seq++,
+      .time_base_us = cycles[0][0].timestamp_us,
+      .cycles       = count};
+
+  for (uint8_t c = 0; c < count; c++)
+  {
+    const udp_sample_t *cycle    = cycles[c];
+    const udp_sample_t *previous = c > 0 ? cycles[c - 1] : NULL;
+
+    length += varint_write(frame + length, previous != NULL ? cycle[0].timestamp_us - previous[0].timestamp_us : 0);
+    frame[length++] = cycle[0].relays;
+
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    {
+      length += varint_write(frame + length, zigzag(cycle[i].raw - (previous != NULL ? previous[i].raw : 0)));
+      length += varint_write(frame + length, zigzag(cycle[i].filtered - (previous != NULL ? previous[i].filtered : 0)));
+    }
+  }
+
+  return length;
+}
+
+static uint8_t varint_write(uint8_t *buf, uint32_t value)
+{
+  uint8_t len = 0;
+
+  while (value >= 0x80)
+  {
+    buf[len++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+
+  buf[len++] = value;
+
+  return len;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
@@ -0,0 +1,53 @@
+#ifndef _UDP_TELEMETRY_H_
+#define _UDP_TELEMETRY_H_
+
+#include <stdint.h>
+
+/*
+  Full rate raw and filtered samples of every channel, sent as UDP datagrams to
+  CONFIG_UDP_TELEMETRY_COLLECTOR. Little-endian, one frame per datagram:
+
+    header   udp_telemetry_header_t
+    cycles   times the cycle record:
+               varint    microseconds since the previous cycle, 0 for the first one
+               uint8     relay states, bit n is relay n ON
+               channels  times: zigzag varint raw delta, zigzag varint filtered delta
+
+  Value deltas are taken against the same channel in the previous cycle of the frame, and against
+  0 in the first cycle, so every frame decodes on its own. Values are Pa or negative sensor
+  states. A gap in seq is a lost frame. tools/udp_receiver.py is the collector.
+*/
+
+#define UDP_TELEMETRY_MAGIC 0x5550 // "PU"
+#define UDP_TELEMETRY_VERSION 1
+
+typedef struct __attribute__((packed)) udp_telemetry_header
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t channels;
+  uint32_t seq;
+  int64_t time_base_us; // esp_timer time of the first cycle
+  uint8_t cycles;
+  uint8_t reserved;
+} udp_telemetry_header_t;
+
+typedef struct udp_telemetry_stats
+{
+  uint32_t frames;
+  uint64_t bytes;
+  uint64_t samples;     // raw and filtered values sent
+  uint32_t send_errors; // frames lost on the device, their seq is skipped as well
+  uint32_t overruns;    // cycles dropped as the task fell behind
+  uint64_t encode_us_total;
+  uint32_t encode_us_max;
+  uint64_t send_us_total;
+  uint32_t send_us_max;
+} udp_telemetry_stats_t;
+
+// Call before measure_start(), does nothing without a collector configured
+void udp_telemetry_start();
+
+void udp_telemetry_get_stats(udp_telemetry_stats_t *stats);
+
+#endif // _UDP_TELEMETRY_H_
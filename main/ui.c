@@ -11,9 +11,16 @@
 #include "esp_freertos_hooks.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 
+#include "display.h"
+#include "gauge.h"
 #include "pressure_sensors.h"
+#include "relay_control.h"
+#include "screens.h"
+#include "trend.h"
 #include "ui.h"
+#include "ui_perf.h"
 #include "utils.h"
 
 /* Littlevgl specific */
@@ -38,48 +45,108 @@ _UI_EVENTS(DEF_EVENT)
 #define PRESSURE_SENSOR_ABSENT_TEXT "-"
 #define PRESSURE_SENSOR_OVERLOAD_TEXT "OVERLOAD"
 #define PRESSURE_REFERENCE_POWER_ERROR_TEXT "RefV Err"
+#define FRAME_PERIOD_US (1000000 / CONFIG_UI_FRAME_RATE_MAX)
+#define UI_DEADBAND_PA (CONFIG_UI_DEADBAND_KPA * 1000)
+#define DIM_TIMEOUT_US ((int64_t)CONFIG_DISPLAY_DIM_TIMEOUT_S * 1000000)
+#define SLEEP_TIMEOUT_US ((int64_t)CONFIG_DISPLAY_SLEEP_TIMEOUT_S * 1000000)
 
 /**********************
  *      TYPEDEFS
  **********************/
+// Gauge widgets are built once, refreshes go straight to the objects they change
 typedef struct
 {
   uint16_t index;
-  int16_t value;
-} gauge_data_t;
+  pressure_value_t value; // shown
+  lv_obj_t *container;
+  lv_obj_t *meter;
+  lv_obj_t *value_label;
+} gauge_view_t;
+
+// Without interaction the backlight dims, then the panel sleeps and rendering stops
+typedef enum
+{
+  DISPLAY_ACTIVE,
+  DISPLAY_DIMMED,
+  DISPLAY_ASLEEP
+} display_power_t;
+
+#ifdef CONFIG_UI_BENCHMARK
+typedef struct
+{
+  int64_t window_start_us;
+  int64_t busy_us;
+  uint32_t refreshes;
+  uint32_t wakeups;
+} ui_benchmark_t;
+#endif
 
 /**********************
  *  STATIC PROTOTYPES
  **********************/
-static void lv_tick_task(void *arg);
+static void lv_tick_hook(void);
 void guiTask(void *pvParameter);
 
 void gui_monitor_cb(lv_disp_drv_t *disp_drv, uint32_t time, uint32_t px);
 void ui_init(void);
 
+static void home_create(lv_obj_t *screen, uint32_t arg);
+static void home_destroy();
+static void styles_init();
 void create_gauge(lv_obj_t *gauges, uint16_t sensor_index);
-void refresh_gauge(lv_obj_t *container);
-void refresh_gauges();
+void refresh_gauge(gauge_view_t *view);
+uint8_t refresh_gauges();
 void select_next_gauge();
 
 static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 
-void request_sensor_calibration();
+bool request_sensor_calibration();
 
 void restart_interaction_timer();
-void group_focus_cb(lv_group_t *group);
 void stop_interaction_cb(void *arg);
 
+static void wake_display();
+static void idle_step();
+static void start_idle_timer(int64_t idle_us);
+static void idle_timer_cb(void *arg);
+static void wake_request_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+#ifdef CONFIG_UI_BENCHMARK
+static void benchmark_account(int64_t started_us, uint8_t refreshed);
+#endif
+
 /**********************
  *  STATIC VARIABLES
  **********************/
-static lv_obj_t *gauges;
-static lv_group_t *selection_group;
-static lv_obj_t *hidden_selection           = NULL;
+static lv_obj_t *gauges; // NULL while the home screen is not built
+static int8_t selected_gauge                = -1; // shows its trend, -1 for none
 static esp_timer_handle_t interaction_timer = NULL;
 
+// shared by all the builds of the home screen
+static lv_style_t gauges_style;
+static lv_style_t label_style;
+
+static const screen_def_t home_screen = {
+    .name    = "home",
+    .create  = home_create,
+    .destroy = home_destroy};
+
+static display_power_t display_power = DISPLAY_ACTIVE;
+static esp_timer_handle_t idle_timer = NULL;
+static int64_t last_activity_us;
+
 static pressure_value_t sensor_pressure_values[] = {[0 ... SENSORS_COUNT] = PRESSURE_SENSOR_ABSENT};
 
+static gauge_view_t gauge_views[SENSORS_COUNT];
+
+// bit per gauge, set by the sensor side, taken by the GUI task
+static uint32_t dirty_gauges;
+static portMUX_TYPE dirty_gauges_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_UI_BENCHMARK
+static ui_benchmark_t benchmark;
+#endif
+
 //Creates a semaphore to handle concurrent call to lvgl stuff
 //If you wish to call *any* lvgl function from other threads/tasks
 //you should lock on the very same semaphore!
@@ -99,10 +166,9 @@ TaskHandle_t gui_start()
   return uiTaskHandle;
 }
 
-static void lv_tick_task(void *arg)
+// Runs in the FreeRTOS tick interrupt of the GUI core, so LVGL time advances without waking anything up
+static void lv_tick_hook(void)
 {
-  (void)arg;
-
   lv_tick_inc(portTICK_RATE_MS);
 }
 
@@ -115,48 +181,90 @@ void guiTask(void *pvParameter)
 
   lvgl_driver_init();
 
-  static lv_color_t buf1[DISP_BUF_SIZE];
-  static lv_color_t buf2[DISP_BUF_SIZE];
-  static lv_disp_buf_t disp_buf;
-  lv_disp_buf_init(&disp_buf, buf1, buf2, DISP_BUF_SIZE);
-
   lv_disp_drv_t disp_drv;
   lv_disp_drv_init(&disp_drv);
-  disp_drv.flush_cb = disp_driver_flush;
-  // disp_drv.monitor_cb = gui_monitor_cb;
+  display_init(&disp_drv);
+
+  disp_drv.monitor_cb = gui_monitor_cb;
 
-  disp_drv.buffer = &disp_buf;
-  lv_disp_drv_register(&disp_drv);
+  lv_disp_t *disp = lv_disp_drv_register(&disp_drv);
 
-  const esp_timer_create_args_t periodic_timer_args = {
-      .callback = &lv_tick_task,
-      /* name is optional, but may help identify the timer when debugging */
-      .name = "periodic_gui"};
-  esp_timer_handle_t periodic_timer;
-  ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
-  //On ESP32 it's better to create a periodic task instead of esp_register_freertos_tick_hook
-  ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, 10 * 1000)); //10ms (expressed as microseconds)
+  ESP_ERROR_CHECK(esp_register_freertos_tick_hook_for_cpu(lv_tick_hook, GUI_CPU_CORE));
 
   // lv_demo_widgets();
   ui_init();
+  ui_perf_init(disp);
+
+#ifdef CONFIG_DISPLAY_MONITOR
+  ESP_LOGI(TAG, "Full screen redraw:");
+  lv_obj_invalidate(lv_scr_act());
+  lv_refr_now(NULL);
+#endif
 
   TaskHandle_t uiTaskHandle = xTaskGetCurrentTaskHandle();
 
-  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_VALUE_CHANGED, pressure_sensor_update_handler, uiTaskHandle, NULL);
+  esp_event_handler_instance_register(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_UI_VALUE_CHANGED, pressure_sensor_update_handler, uiTaskHandle, NULL);
+  esp_event_handler_instance_register(RELAY_CONTROL_EVENTS, RELAY_CONTROL_MAX_ON_TIME_EXCEEDED, wake_request_handler, uiTaskHandle, NULL);
+
+  const esp_timer_create_args_t idle_timer_args = {
+      .callback = &idle_timer_cb,
+      .arg      = uiTaskHandle,
+      .name     = "display_idle"};
+
+  ESP_ERROR_CHECK(esp_timer_create(&idle_timer_args, &idle_timer));
+  wake_display();
 
   uint32_t ulNotifiedValue;
+  TickType_t wait       = 0;
+  bool frame_pending    = false;
+  int64_t last_frame_us = 0;
+  bool swallow_button   = false;
 
   while (1)
   {
-    xTaskNotifyWait(0x00,              /*  Don't clear any notification bits on entry. */
-                    ULONG_MAX,         /* Reset the notification value to 0 on exit. */
-                    &ulNotifiedValue,  /* Notified value pass out in
+    uint8_t refreshed = 0;
+
+    // sleeps until the next LVGL task is due or a notification comes in
+    ulNotifiedValue = 0;
+    xTaskNotifyWait(0x00,             /*  Don't clear any notification bits on entry. */
+                    ULONG_MAX,        /* Reset the notification value to 0 on exit. */
+                    &ulNotifiedValue, /* Notified value pass out in
                                               reference_voltage. */
-                    pdMS_TO_TICKS(5)); /* Block for 5 ms. */
+                    wait);
 
+    int64_t started = esp_timer_get_time();
+
+    // the press which wakes the panel up is not an interaction with what it did not show
+    if ((ulNotifiedValue & UI_BUTTON_PUSHED) != 0)
+    {
+      swallow_button = display_power == DISPLAY_ASLEEP;
+    }
+
+    if ((ulNotifiedValue & (UI_BUTTON_PUSHED | UI_WAKE_REQUESTED)) != 0)
+    {
+      wake_display();
+    }
+    else if ((ulNotifiedValue & UI_IDLE_TIMEOUT) != 0)
+    {
+      idle_step();
+    }
+
+    if (swallow_button)
+    {
+      ulNotifiedValue &= ~(UI_BUTTON_TAPPED | UI_BUTTON_HELD_3_SEC);
+    }
+
+    // pressure changes are coalesced into at most one gauges refresh per frame, the latest value wins
     if ((ulNotifiedValue & UI_PRESSURE_CHANGED) != 0)
     {
-      refresh_gauges();
+      frame_pending = true;
+    }
+
+    if (frame_pending && display_power != DISPLAY_ASLEEP && started - last_frame_us >= FRAME_PERIOD_US)
+    {
+      refreshed     = refresh_gauges();
+      frame_pending = false;
+      last_frame_us = started;
     }
 
     if ((ulNotifiedValue & UI_BUTTON_TAPPED) != 0)
@@ -169,59 +277,110 @@ void guiTask(void *pvParameter)
       restart_interaction_timer();
     }
 
-    if ((ulNotifiedValue & UI_BUTTON_HELD_3_SEC) != 0)
+    if ((ulNotifiedValue & UI_INTERACTION_TIMEOUT) != 0 && selected_gauge >= 0)
     {
-      request_sensor_calibration();
+      selected_gauge = -1;
+      screens_show(SCREEN_HOME, 0);
+    }
+
+    // with no gauge selected the long press toggles the performance overlay
+    if ((ulNotifiedValue & UI_BUTTON_HELD_3_SEC) != 0 && !request_sensor_calibration())
+    {
+      ui_perf_toggle_overlay();
     }
 
     //Try to lock the semaphore, if success, call lvgl stuff
-    if (xSemaphoreTake(xGuiSemaphore, (TickType_t)10) == pdTRUE)
+    wait = 1;
+
+    // nothing is rendered for a sleeping panel, pending changes are drawn on wake up
+    if (display_power == DISPLAY_ASLEEP)
     {
-      lv_task_handler();
+      wait = portMAX_DELAY;
+    }
+    else if (xSemaphoreTake(xGuiSemaphore, (TickType_t)10) == pdTRUE)
+    {
+      int64_t handler_started = esp_timer_get_time();
+      uint32_t next_task_ms   = lv_task_handler();
       xSemaphoreGive(xGuiSemaphore);
+
+      ui_perf_handler_done(handler_started);
+
+      if (next_task_ms == LV_NO_TASK_READY)
+        wait = portMAX_DELAY;
+      else if (next_task_ms > portTICK_RATE_MS)
+        wait = pdMS_TO_TICKS(next_task_ms);
+    }
+
+    if (frame_pending && display_power != DISPLAY_ASLEEP)
+    {
+      int64_t frame_left_us = FRAME_PERIOD_US - (esp_timer_get_time() - last_frame_us);
+      TickType_t frame_wait = frame_left_us > 0 ? pdMS_TO_TICKS(frame_left_us / 1000) + 1 : 0;
+
+      if (frame_wait < wait)
+        wait = frame_wait;
     }
+
+#ifdef CONFIG_UI_BENCHMARK
+    benchmark_account(started, refreshed);
+#else
+    (void)started;
+    (void)refreshed;
+#endif
   }
 
   //A task should NEVER return
   vTaskDelete(NULL);
 }
 
+// Render and flush time of every refresh, the tick is 10 ms so short ones read as 0 ms
 void gui_monitor_cb(lv_disp_drv_t *disp_drv, uint32_t time, uint32_t px)
 {
-  ESP_LOGI(TAG, "%d px refreshed in %d ms", px, time);
-}
-
-void group_focus_cb(lv_group_t *group)
-{
-  // ESP_LOGI(TAG, "Group focus event");
-  // if (lv_group_get_focused(group) == hidden_selection)
-  //   ESP_LOGI(TAG, "Hidden obj got focused");
+  ui_perf_add_frame_px(px);
+
+#ifdef CONFIG_DISPLAY_MONITOR
+  if (time == 0)
+    ESP_LOGI(TAG, "%d px refreshed within a tick", px);
+  else
+    ESP_LOGI(TAG, "%d px refreshed in %d ms (%d px/ms)", px, time, px / time);
+#endif
 }
 
+// Only the home screen is built at start, the others when navigated to
 void ui_init(void)
 {
   const esp_timer_create_args_t interaction_timer_args = {
       .callback = &stop_interaction_cb,
+      .arg      = xTaskGetCurrentTaskHandle(),
       .name     = "interaction_watchdog"};
 
   ESP_ERROR_CHECK(esp_timer_create(&interaction_timer_args, &interaction_timer));
 
-  hidden_selection = lv_obj_create(lv_scr_act(), NULL);
-  lv_obj_set_hidden(hidden_selection, true);
-  // lv_obj_set_event_cb(hidden_selection, hidden_selection_event_cb);
+  styles_init();
 
-  selection_group = lv_group_create();
-  lv_group_add_obj(selection_group, hidden_selection);
-  lv_group_set_focus_cb(selection_group, group_focus_cb);
+  screens_register(SCREEN_HOME, &home_screen);
+  screens_register(SCREEN_TREND, &trend_screen);
+
+  screens_show(SCREEN_HOME, 0);
+}
+
+static void styles_init()
+{
+  lv_style_init(&gauges_style);
+  lv_style_set_pad_inner(&gauges_style, LV_STATE_DEFAULT, LV_DPX(9));
+  lv_style_set_pad_left(&gauges_style, LV_STATE_DEFAULT, LV_DPX(10));
+  lv_style_set_pad_right(&gauges_style, LV_STATE_DEFAULT, LV_DPX(0));
+  lv_style_set_pad_top(&gauges_style, LV_STATE_DEFAULT, LV_DPX(9));
 
-  gauges = lv_cont_create(lv_scr_act(), NULL);
+  lv_style_init(&label_style);
+  lv_style_set_text_font(&label_style, LV_STATE_DEFAULT, lv_theme_get_font_small());
+  lv_style_set_text_color(&label_style, LV_STATE_DEFAULT, lv_theme_get_color_primary());
+}
 
-  lv_obj_set_style_local_pad_inner(gauges, LV_CONT_PART_MAIN, LV_STATE_DEFAULT, LV_DPX(9));
-  lv_obj_set_style_local_pad_left(gauges, LV_CONT_PART_MAIN, LV_STATE_DEFAULT, LV_DPX(10));
-  lv_obj_set_style_local_pad_right(gauges, LV_CONT_PART_MAIN, LV_STATE_DEFAULT, LV_DPX(0));
-  lv_obj_set_style_local_pad_top(gauges, LV_CONT_PART_MAIN, LV_STATE_DEFAULT, LV_DPX(9));
+static void home_create(lv_obj_t *screen, uint32_t arg)
+{
+  gauges = lv_cont_create(screen, NULL);
 
-  // lv_obj_add_style(gauges, LV_CONT_PART_MAIN, &style);
+  lv_obj_add_style(gauges, LV_CONT_PART_MAIN, &gauges_style);
   lv_cont_set_fit(gauges, LV_FIT_PARENT);
   lv_cont_set_layout(gauges, LV_LAYOUT_PRETTY_TOP);
 
@@ -230,66 +389,60 @@ void ui_init(void)
     create_gauge(gauges, i);
   }
 
+  // fresh widgets show nothing yet
+  portENTER_CRITICAL(&dirty_gauges_lock);
+  dirty_gauges = (1 << SENSORS_COUNT) - 1;
+  portEXIT_CRITICAL(&dirty_gauges_lock);
+
   refresh_gauges();
 }
 
+static void home_destroy()
+{
+  gauges = NULL;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    gauge_views[i].container   = NULL;
+    gauge_views[i].meter       = NULL;
+    gauge_views[i].value_label = NULL;
+  }
+}
+
 void create_gauge(lv_obj_t *gauges, uint16_t sensor_index)
 {
-  gauge_data_t *gauge_data = calloc(sizeof(gauge_data_t), 1);
-  gauge_data->index        = sensor_index;
-  gauge_data->value        = INT16_MIN;
+  gauge_view_t *view = &gauge_views[sensor_index];
+  view->index        = sensor_index;
+  view->value        = INT32_MIN;
 
   lv_obj_t *container = lv_obj_create(gauges, NULL);
   lv_obj_set_size(container, 105, 71);
 
-  lv_obj_set_user_data(container, gauge_data);
+  view->container = container;
 
   // gauge
 
-  static lv_style_t gauge_style;
-  lv_style_init(&gauge_style);
-
-  lv_style_set_border_width(&gauge_style, LV_STATE_DEFAULT, 0);
-  lv_style_set_radius(&gauge_style, LV_STATE_DEFAULT, LV_RADIUS_CIRCLE);
-  lv_style_set_pad_left(&gauge_style, LV_STATE_DEFAULT, 0);
-  lv_style_set_pad_right(&gauge_style, LV_STATE_DEFAULT, 0);
-  lv_style_set_pad_top(&gauge_style, LV_STATE_DEFAULT, LV_DPX(3));
-  lv_style_set_pad_inner(&gauge_style, LV_STATE_DEFAULT, LV_DPX(25));
-  lv_style_set_scale_width(&gauge_style, LV_STATE_DEFAULT, LV_DPX(10));
-
-  lv_style_set_line_color(&gauge_style, LV_STATE_DEFAULT, lv_theme_get_color_primary());
-  lv_style_set_scale_grad_color(&gauge_style, LV_STATE_DEFAULT, lv_theme_get_color_primary());
-  lv_style_set_scale_end_color(&gauge_style, LV_STATE_DEFAULT, lv_color_hex3(0x888));
-  lv_style_set_line_width(&gauge_style, LV_STATE_DEFAULT, LV_DPX(2));
-  lv_style_set_scale_end_line_width(&gauge_style, LV_STATE_DEFAULT, LV_DPX(2));
-
-  lv_obj_t *gauge = lv_linemeter_create(container, NULL);
-  lv_obj_add_style(gauge, LV_LABEL_PART_MAIN, &gauge_style);
-
-  lv_obj_set_size(gauge, 65, 65);
+  lv_obj_t *gauge = gauge_create(container);
   lv_obj_align(gauge, NULL, LV_ALIGN_CENTER, 0, 0);
 
-  lv_linemeter_set_range(gauge, 0, 800);
-  lv_linemeter_set_scale(gauge, 240, 23);
+  view->meter = gauge;
 
   // labels
 
   lv_obj_t *label;
 
-  // value label
+  // value label: fixed box with centered text, so a text change never needs a realign
 
   label = lv_label_create(gauge, NULL);
+  lv_label_set_long_mode(label, LV_LABEL_LONG_CROP);
+  lv_label_set_align(label, LV_LABEL_ALIGN_CENTER);
   lv_label_set_text(label, PRESSURE_SENSOR_ABSENT_TEXT);
+  lv_obj_set_size(label, lv_obj_get_width(gauge), lv_font_get_line_height(lv_obj_get_style_text_font(label, LV_LABEL_PART_MAIN)));
   lv_obj_align(label, NULL, LV_ALIGN_CENTER, 0, 0);
-  lv_label_set_align(label, LV_LABEL_ALIGN_CENTER);
 
-  // static labels
-
-  static lv_style_t label_style;
+  view->value_label = label;
 
-  lv_style_init(&label_style);
-  lv_style_set_text_font(&label_style, LV_STATE_DEFAULT, lv_theme_get_font_small());
-  lv_style_set_text_color(&label_style, LV_STATE_DEFAULT, lv_theme_get_color_primary());
+  // static labels
 
   // index
 
@@ -298,81 +451,70 @@ void create_gauge(lv_obj_t *gauges, uint16_t sensor_index)
   lv_label_set_text_fmt(label, "%d", sensor_index + 1);
   lv_obj_align(label, NULL, LV_ALIGN_IN_TOP_LEFT, LV_DPX(5), LV_DPX(3));
 
-  // unit
-
-  label = lv_label_create(container, NULL);
-  lv_obj_add_style(label, LV_LABEL_PART_MAIN, &label_style);
-  lv_label_set_static_text(label, "kPa");
-  lv_obj_align(label, NULL, LV_ALIGN_IN_BOTTOM_MID, 0, -5);
-
-  lv_group_add_obj(selection_group, container);
+  // the unit is a part of the gauge scale image
 }
 
-void refresh_gauge(lv_obj_t *container)
+void refresh_gauge(gauge_view_t *view)
 {
-  gauge_data_t *data = (gauge_data_t *)lv_obj_get_user_data(container);
-  int32_t value      = sensor_pressure_values[data->index];
+  pressure_value_t value = sensor_pressure_values[view->index];
 
-  if (data->value != value)
-  {
-    data->value = value;
+  if (view->value == value)
+    return;
 
-    char text_value[20];
-    int32_t gauge_value = 0;
+  view->value = value;
 
-    lv_obj_t *gauge, *gauge_text;
-    lv_obj_type_t type;
+  char text_value[20];
+  int32_t gauge_value = 0;
 
-    lv_obj_t *child = lv_obj_get_child(container, NULL);
-    lv_obj_get_type(child, &type);
+  switch (value)
+  {
+  case PRESSURE_REFERENCE_POWER_ERROR:
+    lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_REFERENCE_POWER_ERROR_TEXT);
+    break;
+
+  case PRESSURE_SENSOR_ABSENT:
+    lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_SENSOR_ABSENT_TEXT);
+    break;
+
+  case PRESSURE_SENSOR_OVERLOAD:
+    lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_SENSOR_OVERLOAD_TEXT);
+    gauge_value = GAUGE_MAX_VALUE;
+    break;
+
+  default:
+    gauge_value = value / 1000; // Pa to Kpa
+    lv_snprintf(text_value, sizeof(text_value), "%03d", gauge_value);
+    break;
+  }
 
-    while (child && strcmp(type.type[0], "lv_linemeter") != 0)
-    {
-      child = lv_obj_get_child(container, child);
-      lv_obj_get_type(child, &type);
-    };
+  gauge_set_value(view->meter, gauge_value);
+  lv_label_set_text(view->value_label, text_value);
+}
 
-    gauge      = child;
-    gauge_text = lv_obj_get_child(gauge, NULL);
+// Refreshes only gauges marked dirty since the last call, returns how many were marked.
+// Away from the home screen the mask stays dirty, so the sensor side stops waking the task.
+uint8_t refresh_gauges()
+{
+  if (gauges == NULL)
+    return 0;
 
-    switch (value)
-    {
-    case PRESSURE_REFERENCE_POWER_ERROR:
-      lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_REFERENCE_POWER_ERROR_TEXT);
-      break;
-
-    case PRESSURE_SENSOR_ABSENT:
-      lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_SENSOR_ABSENT_TEXT);
-      break;
-
-    case PRESSURE_SENSOR_OVERLOAD:
-      lv_snprintf(text_value, sizeof(text_value), "%s", PRESSURE_SENSOR_OVERLOAD_TEXT);
-      gauge_value = lv_linemeter_get_max_value(gauge);
-      break;
-
-    default:
-      gauge_value = value / 1000; // Pa to Kpa
-      lv_snprintf(text_value, sizeof(text_value), "%03d", gauge_value);
-      break;
-    }
+  portENTER_CRITICAL(&dirty_gauges_lock);
+  uint32_t dirty = dirty_gauges;
+  dirty_gauges   = 0;
+  portEXIT_CRITICAL(&dirty_gauges_lock);
 
-    lv_linemeter_set_value(gauge, gauge_value);
+  uint8_t refreshed = 0;
 
-    lv_label_set_text(gauge_text, text_value);
-    lv_obj_align(gauge_text, NULL, LV_ALIGN_CENTER, 0, 0);
-    lv_label_set_align(gauge_text, LV_LABEL_ALIGN_CENTER);
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    if (dirty & (1 << i))
+    {
+      refresh_gauge(&gauge_views[i]);
+      refreshed++;
+    }
   }
-}
 
-void refresh_gauges()
-{
-  lv_obj_t *gauge = lv_obj_get_child(gauges, NULL);
-
-  while (gauge)
-  {
-    refresh_gauge(gauge);
-    gauge = lv_obj_get_child(gauges, gauge);
-  };
+  return refreshed;
 }
 
 void event_cb(lv_obj_t *obj, lv_event_t event)
@@ -382,16 +524,18 @@ void event_cb(lv_obj_t *obj, lv_event_t event)
 
 void select_next_gauge()
 {
-  lv_group_focus_next(selection_group);
+  selected_gauge = selected_gauge + 1 < SENSORS_COUNT ? selected_gauge + 1 : -1;
+
+  if (selected_gauge >= 0)
+    screens_show(SCREEN_TREND, selected_gauge);
+  else
+    screens_show(SCREEN_HOME, 0);
 }
 
+// esp_timer task, the GUI task does the switch
 void stop_interaction_cb(void *arg)
 {
-  esp_timer_stop(interaction_timer);
-  if (hidden_selection != NULL)
-  {
-    lv_group_focus_obj(hidden_selection);
-  }
+  xTaskNotify((TaskHandle_t)arg, UI_INTERACTION_TIMEOUT, eSetBits);
 }
 
 void restart_interaction_timer()
@@ -400,15 +544,78 @@ void restart_interaction_timer()
   ESP_ERROR_CHECK(esp_timer_start_once(interaction_timer, MAX_INTERACTION_TIME_MS * 1000)); // in microseconds
 }
 
-void request_sensor_calibration()
+static void wake_display()
 {
-  lv_obj_t *selected = lv_group_get_focused(selection_group);
+  last_activity_us = esp_timer_get_time();
+
+  if (display_power == DISPLAY_ASLEEP)
+    display_wake();
+  else if (display_power == DISPLAY_DIMMED)
+    display_set_backlight(CONFIG_DISPLAY_BACKLIGHT_LEVEL);
+
+  display_power = DISPLAY_ACTIVE;
+  start_idle_timer(0);
+}
+
+// The idle time decides, so a timeout which was already on its way when a button got pushed does nothing
+static void idle_step()
+{
+  int64_t idle_us = esp_timer_get_time() - last_activity_us;
+
+  if (SLEEP_TIMEOUT_US > 0 && idle_us >= SLEEP_TIMEOUT_US)
+  {
+    if (display_power != DISPLAY_ASLEEP)
+      display_sleep();
 
-  if (selected != hidden_selection)
+    display_power = DISPLAY_ASLEEP;
+    return;
+  }
+
+  if (DIM_TIMEOUT_US > 0 && idle_us >= DIM_TIMEOUT_US && display_power == DISPLAY_ACTIVE)
   {
-    gauge_data_t *data = (gauge_data_t *)lv_obj_get_user_data(selected);
-    calibrate_sensor(data->index);
+    display_set_backlight(CONFIG_DISPLAY_DIM_LEVEL);
+    display_power = DISPLAY_DIMMED;
+    ESP_LOGI(TAG, "Display dimmed");
   }
+
+  start_idle_timer(idle_us);
+}
+
+static void start_idle_timer(int64_t idle_us)
+{
+  esp_timer_stop(idle_timer);
+
+  int64_t next_us = 0;
+
+  if (DIM_TIMEOUT_US > idle_us)
+    next_us = DIM_TIMEOUT_US;
+
+  if (SLEEP_TIMEOUT_US > idle_us && (next_us == 0 || SLEEP_TIMEOUT_US < next_us))
+    next_us = SLEEP_TIMEOUT_US;
+
+  if (next_us > 0)
+    ESP_ERROR_CHECK(esp_timer_start_once(idle_timer, next_us - idle_us));
+}
+
+static void idle_timer_cb(void *arg)
+{
+  xTaskNotify((TaskHandle_t)arg, UI_IDLE_TIMEOUT, eSetBits);
+}
+
+static void wake_request_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+  xTaskNotify((TaskHandle_t)event_handler_arg, UI_WAKE_REQUESTED, eSetBits);
+}
+
+// false if no gauge is selected
+bool request_sensor_calibration()
+{
+  if (selected_gauge < 0)
+    return false;
+
+  calibrate_sensor(selected_gauge);
+
+  return true;
 }
 
 static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
@@ -417,7 +624,59 @@ static void pressure_sensor_update_handler(void *event_handler_arg, esp_event_ba
   TaskHandle_t uiTaskHandle = (TaskHandle_t)event_handler_arg;
   sensor_pressure_t *sensor = (sensor_pressure_t *)event_data;
 
-  sensor_pressure_values[sensor->index] = sensor->pressure;
+  pressure_value_t value    = sensor->pressure;
+  pressure_value_t previous = sensor_pressure_values[sensor->index];
+
+  if (previous == value)
+    return;
+
+  // the stream comes rounded to kPa already, a value flipping between two steps is held at the shown one
+  if (value >= 0 && previous >= 0 && abs(value - previous) <= UI_DEADBAND_PA)
+    return;
+
+  sensor_pressure_values[sensor->index] = value;
+
+  // a sensor going into an error state is an alarm, it has to be seen
+  if (value < 0 && previous >= 0)
+    xTaskNotify(uiTaskHandle, UI_WAKE_REQUESTED, eSetBits);
+
+  portENTER_CRITICAL(&dirty_gauges_lock);
+  bool was_clean = dirty_gauges == 0;
+  dirty_gauges |= 1 << sensor->index;
+  portEXIT_CRITICAL(&dirty_gauges_lock);
+
+  // the GUI task is woken once per frame, later changes only update the value and the mask
+  if (was_clean)
+    xTaskNotify(uiTaskHandle, UI_PRESSURE_CHANGED, eSetBits);
+}
+
+#ifdef CONFIG_UI_BENCHMARK
+// GUI task busy time: gauge refreshes and lv_task_handler() including flushes, logged once per window
+static void benchmark_account(int64_t started_us, uint8_t refreshed)
+{
+  int64_t now = esp_timer_get_time();
+
+  benchmark.busy_us += now - started_us;
+  benchmark.refreshes += refreshed;
+  benchmark.wakeups++;
+
+  if (benchmark.window_start_us == 0)
+    benchmark.window_start_us = now;
 
-  xTaskNotify(uiTaskHandle, UI_PRESSURE_CHANGED, eSetBits);
-}
\ No newline at end of file
+  int64_t window_us = now - benchmark.window_start_us;
+
+  if (window_us < CONFIG_UI_BENCHMARK_WINDOW_S * 1000000LL)
+    return;
+
+  ESP_LOGI(TAG, "GUI task: %lld us/s busy (%lld.%01lld%% of core %d), %d wakeups/s, %d gauge refreshes/s",
+           benchmark.busy_us * 1000000 / window_us,
+           benchmark.busy_us * 100 / window_us, benchmark.busy_us * 1000 / window_us % 10, GUI_CPU_CORE,
+           (uint32_t)(benchmark.wakeups * 1000000LL / window_us),
+           (uint32_t)(benchmark.refreshes * 1000000LL / window_us));
+
+  benchmark.window_start_us = now;
+  benchmark.busy_us         = 0;
+  benchmark.refreshes       = 0;
+  benchmark.wakeups         = 0;
+}
+#endif
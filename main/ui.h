@@ -8,7 +8,10 @@
   EVENT(UI_PRESSURE_CHANGED) \
   EVENT(UI_BUTTON_PUSHED)    \
   EVENT(UI_BUTTON_TAPPED)    \
-  EVENT(UI_BUTTON_HELD_3_SEC)
+  EVENT(UI_BUTTON_HELD_3_SEC) \
+  EVENT(UI_IDLE_TIMEOUT)      \
+  EVENT(UI_WAKE_REQUESTED)    \
+  EVENT(UI_INTERACTION_TIMEOUT)
 
 enum UI_EVENTS
 {
@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ui_perf.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+
+static const char *TAG = "UI_PERF";
+
+#define UI_PERF_SAMPLE_PERIOD_MS 1000
+
+/*
+  Frame time is measured around LVGL's display refresh task, so it covers rendering and the
+  flushes it waits for. The pixel count comes from the monitor callback which LVGL calls from
+  inside the same task. Counters are cumulative since boot.
+*/
+
+/*
+  Declarations
+*/
+static void refr_task_wrapper(lv_task_t *task);
+static void sample_task_cb(lv_task_t *task);
+static void update_overlay();
+static void log_stats();
+
+static const uint16_t histogram_bounds_ms[UI_PERF_HISTOGRAM_BUCKETS] = UI_PERF_HISTOGRAM_BOUNDS_MS;
+
+static ui_perf_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static lv_task_cb_t refr_task_cb;
+static uint32_t frame_px;
+
+static lv_obj_t *overlay;
+static uint32_t samples;
+
+void ui_perf_init(lv_disp_t *disp)
+{
+  refr_task_cb                = disp->refr_task->task_cb;
+  disp->refr_task->task_cb    = refr_task_wrapper;
+  stats.stack_free_min        = UINT32_MAX;
+
+  lv_task_create(sample_task_cb, UI_PERF_SAMPLE_PERIOD_MS, LV_TASK_PRIO_LOW, NULL);
+
+#ifdef CONFIG_UI_PERF_OVERLAY_ON_START
+  ui_perf_toggle_overlay();
+#endif
+}
+
+void ui_perf_add_frame_px(uint32_t px)
+{
+  frame_px += px;
+}
+
+void ui_perf_handler_done(int64_t started_us)
+{
+  uint32_t elapsed = esp_timer_get_time() - started_us;
+
+  portENTER_CRITICAL(&stats_lock);
+
+  stats.handler_calls++;
+  stats.handler_us_total += elapsed;
+
+  if (elapsed > stats.handler_us_max)
+    stats.handler_us_max = elapsed;
+
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void ui_perf_toggle_overlay()
+{
+  if (overlay != NULL)
+  {
+    lv_obj_del(overlay);
+    overlay = NULL;
+    return;
+  }
+
+  overlay = lv_label_create(lv_layer_top(), NULL);
+
+  lv_obj_set_style_local_bg_opa(overlay, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT, LV_OPA_70);
+  lv_obj_set_style_local_bg_color(overlay, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_BLACK);
+  lv_obj_set_style_local_text_color(overlay, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_WHITE);
+  lv_obj_set_style_local_text_font(overlay, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT, lv_theme_get_font_small());
+  lv_obj_set_style_local_pad_all(overlay, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT, LV_DPX(3));
+
+  update_overlay();
+}
+
+void ui_perf_get(ui_perf_stats_t *out)
+{
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+static void refr_task_wrapper(lv_task_t *task)
+{
+  int64_t started = esp_timer_get_time();
+
+  frame_px = 0;
+  refr_task_cb(task);
+
+  if (frame_px == 0)
+    return;
+
+  uint32_t elapsed = esp_timer_get_time() - started;
+  uint8_t bucket   = 0;
+
+  while (bucket < UI_PERF_HISTOGRAM_BUCKETS - 1 && elapsed > histogram_bounds_ms[bucket] * 1000)
+    bucket++;
+
+  portENTER_CRITICAL(&stats_lock);
+
+  stats.frames++;
+  stats.frame_histogram[bucket]++;
+  stats.frame_us_total += elapsed;
+  stats.px_total += frame_px;
+
+  if (elapsed > stats.frame_us_max)
+    stats.frame_us_max = elapsed;
+
+  if (frame_px > stats.px_max)
+    stats.px_max = frame_px;
+
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+// LVGL memory and the stack can only be looked at from the GUI task
+static void sample_task_cb(lv_task_t *task)
+{
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+
+  uint32_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+
+  portENTER_CRITICAL(&stats_lock);
+
+  stats.lv_mem_used     = mon.total_size - mon.free_size;
+  stats.lv_mem_max_used = mon.max_used;
+  stats.lv_mem_frag     = mon.frag_pct;
+
+  if (stack_free < stats.stack_free_min)
+    stats.stack_free_min = stack_free;
+
+  portEXIT_CRITICAL(&stats_lock);
+
+  if (overlay != NULL)
+    update_overlay();
+
+#if CONFIG_UI_PERF_LOG_INTERVAL_S > 0
+  if (++samples % (CONFIG_UI_PERF_LOG_INTERVAL_S * 1000 / UI_PERF_SAMPLE_PERIOD_MS) == 0)
+    log_stats();
+#else
+  (void)samples;
+  (void)log_stats;
+#endif
+}
+
+static void update_overlay()
+{
+  ui_perf_stats_t s;
+  ui_perf_get(&s);
+
+  uint32_t frame_avg_us   = s.frames ? s.frame_us_total / s.frames : 0;
+  uint32_t px_avg         = s.frames ? s.px_total / s.frames : 0;
+  uint32_t handler_avg_us = s.handler_calls ? s.handler_us_total / s.handler_calls : 0;
+
+  lv_label_set_text_fmt(overlay,
+                        "frame %d.%d/%d ms, %d frames\n"
+                        "px/frame %d, max %d\n"
+                        "handler %d/%d us\n"
+                        "lv_mem %d, peak %d, frag %d%%\n"
+                        "stack free %d",
+                        frame_avg_us / 1000, frame_avg_us / 100 % 10, s.frame_us_max / 1000, s.frames,
+                        px_avg, s.px_max,
+                        handler_avg_us, s.handler_us_max,
+                        s.lv_mem_used, s.lv_mem_max_used, s.lv_mem_frag,
+                        s.stack_free_min);
+}
+
+static void log_stats()
+{
+  ui_perf_stats_t s;
+  ui_perf_get(&s);
+
+  if (s.frames == 0)
+    return;
+
+  char histogram[UI_PERF_HISTOGRAM_BUCKETS * 16];
+  size_t length = 0;
+
+  for (uint8_t i = 0; i < UI_PERF_HISTOGRAM_BUCKETS; i++)
+  {
+    if (i < UI_PERF_HISTOGRAM_BUCKETS - 1)
+      length += snprintf(histogram + length, sizeof(histogram) - length, "<=%d:%d ", histogram_bounds_ms[i], s.frame_histogram[i]);
+    else
+      length += snprintf(histogram + length, sizeof(histogram) - length, ">%d:%d", histogram_bounds_ms[i - 1], s.frame_histogram[i]);
+  }
+
+  ESP_LOGI(TAG, "%d frames, avg %lld us, max %d us, avg %lld px, max %d px; frame ms %s",
+           s.frames, s.frame_us_total / s.frames, s.frame_us_max, s.px_total / s.frames, s.px_max, histogram);
+  ESP_LOGI(TAG, "lv_task_handler avg %lld us, max %d us; lv_mem %d B, peak %d B, frag %d%%; GUI stack free min %d B",
+           s.handler_calls ? s.handler_us_total / s.handler_calls : 0, s.handler_us_max,
+           s.lv_mem_used, s.lv_mem_max_used, s.lv_mem_frag, s.stack_free_min);
+}
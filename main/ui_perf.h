@@ -0,0 +1,39 @@
+#ifndef _UI_PERF_H_
+#define _UI_PERF_H_
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+#define UI_PERF_HISTOGRAM_BUCKETS 8
+
+// Frame time histogram upper bounds, ms, the last bucket takes the rest
+#define UI_PERF_HISTOGRAM_BOUNDS_MS {2, 5, 10, 20, 40, 80, 160, UINT16_MAX}
+
+typedef struct ui_perf_stats
+{
+  uint32_t frames;                                     // display refreshes which redrew something
+  uint32_t frame_histogram[UI_PERF_HISTOGRAM_BUCKETS]; // render + flush time
+  uint64_t frame_us_total;
+  uint32_t frame_us_max;
+  uint64_t px_total;
+  uint32_t px_max;
+  uint32_t handler_calls; // lv_task_handler()
+  uint64_t handler_us_total;
+  uint32_t handler_us_max;
+  uint32_t lv_mem_used; // bytes
+  uint32_t lv_mem_max_used;
+  uint8_t lv_mem_frag; // %
+  uint32_t stack_free_min; // GUI task stack high water mark, bytes
+} ui_perf_stats_t;
+
+// GUI task only
+void ui_perf_init(lv_disp_t *disp);
+void ui_perf_add_frame_px(uint32_t px);
+void ui_perf_handler_done(int64_t started_us);
+void ui_perf_toggle_overlay();
+
+// Any task, for the log and /metrics
+void ui_perf_get(ui_perf_stats_t *stats);
+
+#endif // _UI_PERF_H_
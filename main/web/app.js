@@ -0,0 +1,248 @@
+"use strict";
+
+// Everything comes from the /api/v1/stream WebSocket, see main/live_stream.h
+
+const SENSORS = 5;
+const FULL_SCALE = 1200000; // Pa, SENSOR_MAX_PRESSURE
+const RATE = 5; // frames per second
+const BATCH_MS = 500;
+const TREND_MS = 5 * 60 * 1000;
+const COLORS = ["#4aa8ff", "#f0a030", "#3ecf6e", "#e05d8a", "#b38cff"];
+
+// pressure_value_t states below zero
+const STATES = { "-128": "reference power error", "-127": "absent", "-126": "overload" };
+
+const trend = [];  // [time_ms, p0, ..., p4], oldest first
+let controller = null;
+let socket = null;
+let retryMs = 1000;
+let dirty = false;
+
+const gauges = [];
+
+function el(tag, className, parent) {
+  const e = document.createElement(tag);
+  if (className) e.className = className;
+  if (parent) parent.appendChild(e);
+  return e;
+}
+
+function bar(pa) {
+  return (pa / 100000).toFixed(2);
+}
+
+function buildGauges() {
+  const section = document.getElementById("gauges");
+
+  for (let i = 0; i < SENSORS; i++) {
+    const gauge = el("div", "gauge", section);
+    el("div", "name", gauge).textContent = "Sensor " + i;
+    const value = el("div", "value", gauge);
+    const track = el("div", "bar", gauge);
+    const fill = el("div", "fill", track);
+    fill.style.background = COLORS[i];
+
+    gauges.push({ value, track, fill, marks: [] });
+  }
+}
+
+function showPressure(i, pa) {
+  const g = gauges[i];
+
+  if (pa < 0) {
+    g.value.className = "value fault";
+    g.value.textContent = STATES[pa] || "state " + pa;
+    g.fill.style.width = "0";
+    return;
+  }
+
+  g.value.className = "value";
+  g.value.innerHTML = bar(pa) + " <small>bar</small>";
+  g.fill.style.width = Math.min(100, (100 * pa) / FULL_SCALE) + "%";
+}
+
+// low and high mark ticks on the gauge of the controlled sensor
+function showMarks() {
+  gauges.forEach((g, i) => {
+    g.marks.forEach((m) => m.remove());
+    g.marks = [];
+
+    if (!controller || controller.sensor !== i) return;
+
+    for (const pa of [controller.low_mark, controller.high_mark]) {
+      const mark = el("div", "mark", g.track);
+      mark.style.left = (100 * pa) / FULL_SCALE + "%";
+      g.marks.push(mark);
+    }
+  });
+}
+
+function showState(state) {
+  const relays = document.getElementById("relays");
+  relays.textContent = "";
+
+  (state.relays || []).forEach((on, i) => {
+    el("span", on ? "relay on" : "relay", relays).textContent = "Relay " + i + (on ? " ON" : " OFF");
+  });
+
+  controller = state.controller || null;
+
+  const list = document.getElementById("controller");
+  const rows = controller
+    ? [
+        ["State", controller.manual_override ? "manual override" : "automatic"],
+        ["Relay", controller.relay + (controller.relay_on ? ", ON" : ", OFF")],
+        ["Sensor", controller.sensor],
+        ["Low mark", bar(controller.low_mark) + " bar"],
+        ["High mark", bar(controller.high_mark) + " bar"],
+        ["Under low mark", controller.under_low_mark ? "yes" : "no"],
+        ["Above high mark", controller.above_high_mark ? "yes" : "no"],
+        ["Max ON time exceeded", controller.max_on_time_exceeded ? "yes" : "no"],
+        ["Min OFF time passed", controller.min_off_time_passed ? "yes" : "no"],
+      ]
+    : [["State", "not running"]];
+
+  list.textContent = "";
+  for (const [name, value] of rows) {
+    el("dt", null, list).textContent = name;
+    el("dd", null, list).textContent = value;
+  }
+
+  showMarks();
+  dirty = true;
+}
+
+function onMessage(event) {
+  const message = JSON.parse(event.data);
+  const frames = message.frames;
+
+  for (const frame of frames) trend.push(frame);
+
+  if (frames.length > 0) {
+    const last = frames[frames.length - 1];
+    for (let i = 0; i < SENSORS; i++) showPressure(i, last[i + 1]);
+
+    // the uptime of the device is the clock of the trend
+    const oldest = last[0] - TREND_MS;
+    let drop = 0;
+    while (drop < trend.length && trend[drop][0] < oldest) drop++;
+    trend.splice(0, drop);
+  }
+
+  if (message.state) showState(message.state);
+
+  dirty = true;
+}
+
+function drawTrend() {
+  requestAnimationFrame(drawTrend);
+
+  if (!dirty) return;
+  dirty = false;
+
+  const canvas = document.getElementById("trend");
+  const ratio = window.devicePixelRatio || 1;
+  const width = canvas.clientWidth * ratio;
+  const height = canvas.clientHeight * ratio;
+
+  if (canvas.width !== width || canvas.height !== height) {
+    canvas.width = width;
+    canvas.height = height;
+  }
+
+  const ctx = canvas.getContext("2d");
+  ctx.clearRect(0, 0, width, height);
+
+  if (trend.length < 2) return;
+
+  const end = trend[trend.length - 1][0];
+  let top = controller ? controller.high_mark : 0;
+
+  for (const frame of trend) for (let i = 1; i <= SENSORS; i++) top = Math.max(top, frame[i]);
+
+  top = Math.min(FULL_SCALE, Math.max(100000, top * 1.1));
+
+  const x = (t) => width - ((end - t) / TREND_MS) * width;
+  const y = (pa) => height - (pa / top) * height;
+
+  ctx.lineWidth = ratio;
+
+  if (controller) {
+    ctx.strokeStyle = "#8a929c";
+    ctx.setLineDash([4 * ratio, 4 * ratio]);
+    for (const pa of [controller.low_mark, controller.high_mark]) {
+      ctx.beginPath();
+      ctx.moveTo(0, y(pa));
+      ctx.lineTo(width, y(pa));
+      ctx.stroke();
+    }
+    ctx.setLineDash([]);
+  }
+
+  for (let i = 1; i <= SENSORS; i++) {
+    ctx.strokeStyle = COLORS[i - 1];
+    ctx.beginPath();
+
+    let drawing = false;
+    for (const frame of trend) {
+      // sensor states break the line
+      if (frame[i] < 0) {
+        drawing = false;
+        continue;
+      }
+
+      if (drawing) ctx.lineTo(x(frame[0]), y(frame[i]));
+      else ctx.moveTo(x(frame[0]), y(frame[i]));
+      drawing = true;
+    }
+
+    ctx.stroke();
+  }
+
+  ctx.fillStyle = "#8a929c";
+  ctx.font = 12 * ratio + "px system-ui, sans-serif";
+  ctx.fillText(bar(top) + " bar", 4 * ratio, 14 * ratio);
+}
+
+function setStatus(text, live) {
+  const status = document.getElementById("status");
+  status.textContent = text;
+  status.className = live ? "status live" : "status";
+}
+
+function connect() {
+  const scheme = location.protocol === "https:" ? "wss" : "ws";
+  socket = new WebSocket(scheme + "://" + location.host + "/api/v1/stream?rate=" + RATE + "&batch=" + BATCH_MS);
+
+  socket.onopen = () => {
+    retryMs = 1000;
+    setStatus("live", true);
+  };
+
+  socket.onmessage = onMessage;
+
+  socket.onclose = () => {
+    socket = null;
+
+    if (document.hidden) return;
+
+    setStatus("reconnecting", false);
+    setTimeout(connect, retryMs);
+    retryMs = Math.min(retryMs * 2, 30000);
+  };
+}
+
+// the device serves a few stream clients only, a hidden tab gives its slot back
+document.addEventListener("visibilitychange", () => {
+  if (document.hidden) {
+    if (socket) socket.close();
+    setStatus("paused", false);
+  } else if (!socket) {
+    trend.length = 0;
+    connect();
+  }
+});
+
+buildGauges();
+connect();
+requestAnimationFrame(drawTrend);
@@ -5,18 +5,97 @@
 #include "freertos/FreeRTOS.h"
 
 #include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 
+#if CONFIG_BT_ENABLED
+#include "esp_bt.h"
+#endif
+
 #include <wifi_provisioning/manager.h>
+#if CONFIG_WIFI_PROV_SCHEME_BLE
 #include <wifi_provisioning/scheme_ble.h>
+#else
+#include <wifi_provisioning/scheme_softap.h>
+#endif
 
+#include "http_server.h"
+#include "metrics.h"
+#include "stor.h"
 #include "wifi.h"
 
 static const char *TAG = "WIFI";
 
 #define SERV_NAME_PREFIX "PROV_"
 
+/*
+  Everything but esp_netif_init() runs in its own task, so the measure loop and the controller
+  start without waiting for the radio, the BLE provisioning or an access point. The access point
+  and channel of the last connection are kept in NVS, the first attempt after a boot or a
+  connection loss goes straight to them without the all channel scan. Failed attempts are
+  retried with a doubling delay, the retries scan all channels.
+*/
+
+/*
+  The BT controller and host memory is only needed to provision over BLE. Once a device has been
+  provisioned it is flagged in NVS, and from the next boot on the memory goes back to the heap
+  before anything else allocates, the provisioning manager is skipped then. A device which has
+  lost its credentials clears the flag and restarts to provision again.
+*/
+
+#define WIFI_STORE "wifi"
+#define BSSID_KEY "bssid"
+#define CHANNEL_KEY "channel"
+#define BT_RECLAIM_KEY "bt_reclaim"
+
+#define RETRY_MIN_MS 250
+#define RETRY_MAX_MS (30 * 1000)
+
+/*
+  Declarations
+*/
+static void wifi_init_task(void *arg);
+static void connect();
+static void retry_connect(void *arg);
+static void schedule_retry(uint8_t reason);
+static void remember_ap(const uint8_t *bssid, uint8_t channel);
+static void prov_mgr_deinit();
+static bool has_credentials();
+static void report_bt_released(size_t bytes);
+
+static bool provisioned;
+static uint8_t retries; // since the last IP
+// the next attempt is the first one after the boot or the last IP, it goes to the cached access point
+static bool first_attempt = true;
+static bool attempt_hinted;
+
+static uint8_t cached_bssid[6];
+static uint8_t cached_channel; // 0 if nothing is cached
+
+static esp_timer_handle_t retry_timer;
+static int64_t connect_started_us;
+static bool got_ip;
+
+static bool bt_released;
+
+#if !CONFIG_WIFI_PROV_SCHEME_BLE
+static httpd_handle_t prov_server; // protocomm keeps the pointer
+#endif
+
+// Wall clock for log timestamps, SNTP retries and resyncs by itself once started
+static void sntp_start()
+{
+  if (sntp_enabled())
+    return;
+
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, "pool.ntp.org");
+  sntp_init();
+}
+
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
 {
@@ -49,7 +128,7 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
       break;
     case WIFI_PROV_END:
       /* De-initialize manager once provisioning is finished */
-      wifi_prov_mgr_deinit();
+      prov_mgr_deinit();
       break;
     default:
       break;
@@ -60,20 +139,40 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     switch (event_id)
     {
     case WIFI_EVENT_STA_START:
-      esp_wifi_connect();
+      connect();
       break;
 
     case WIFI_EVENT_STA_CONNECTED:;
       wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
 
-      ESP_LOGI(TAG, "connected to a network with SSID: %s", (char *)(&event->ssid));
+      ESP_LOGI(TAG, "connected to a network with SSID: %s, channel %d after %lld ms",
+               (char *)(&event->ssid), event->channel, (esp_timer_get_time() - connect_started_us) / 1000);
       ESP_LOGI(TAG, "waiting for ip");
 
+      if (attempt_hinted)
+      {
+        ESP_LOGI(TAG, "The cached access point is hit");
+        metrics_add(METRIC_WIFI_HINT_HITS, 0, 1);
+        attempt_hinted = false;
+      }
+
+      remember_ap(event->bssid, event->channel);
+
       break;
 
-    case WIFI_EVENT_STA_DISCONNECTED:
-      ESP_LOGI(TAG, "disconnected");
-      esp_wifi_connect();
+    case WIFI_EVENT_STA_DISCONNECTED:;
+      wifi_event_sta_disconnected_t *disconnected = (wifi_event_sta_disconnected_t *)event_data;
+
+      // the hinted attempt failed, the retries scan
+      if (attempt_hinted)
+      {
+        ESP_LOGI(TAG, "The cached access point is missed");
+        metrics_add(METRIC_WIFI_HINT_MISSES, 0, 1);
+        attempt_hinted = false;
+      }
+
+      metrics_add(METRIC_WIFI_DISCONNECTS, 0, 1);
+      schedule_retry(disconnected->reason);
       break;
 
     default:
@@ -86,7 +185,22 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     {
     case IP_EVENT_STA_GOT_IP:;
       ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-      ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+      int64_t now_us           = esp_timer_get_time();
+      uint32_t connect_ms      = (now_us - connect_started_us) / 1000;
+
+      ESP_LOGI(TAG, "got ip:" IPSTR " %u ms after the connect, %lld ms after the app start, %d retries",
+               IP2STR(&event->ip_info.ip), connect_ms, now_us / 1000, retries);
+
+      metrics_set(METRIC_WIFI_CONNECT_MS, 0, connect_ms);
+
+      if (!got_ip)
+        metrics_set(METRIC_BOOT_IP_MS, 0, now_us / 1000);
+
+      got_ip        = true;
+      retries       = 0;
+      first_attempt = true;
+
+      sntp_start();
       break;
 
     default:
@@ -103,10 +217,50 @@ static void get_device_service_name(char *service_name, size_t max)
            SERV_NAME_PREFIX, eth_mac[3], eth_mac[4], eth_mac[5]);
 }
 
-void wifi_init(void)
+void wifi_reclaim_bt_memory(void)
+{
+#if CONFIG_BT_ENABLED
+#if CONFIG_WIFI_PROV_SCHEME_BLE
+  if (stor_get_i32(WIFI_STORE, BT_RECLAIM_KEY, 0) == 0)
+    return;
+#endif
+
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  esp_err_t err      = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+
+  if (err != ESP_OK)
+  {
+    ESP_LOGW(TAG, "BT memory is not released: %s", esp_err_to_name(err));
+    return;
+  }
+
+  bt_released = true;
+
+  report_bt_released(heap_caps_get_free_size(MALLOC_CAP_8BIT) - free_before);
+#endif
+}
+
+void wifi_start(void)
 {
+  // the servers open their sockets right away, they only need the stack
   ESP_ERROR_CHECK(esp_netif_init());
 
+  const esp_timer_create_args_t timer_args = {.callback = &retry_connect, .name = "wifi retry"};
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &retry_timer));
+
+  xTaskCreatePinnedToCore(wifi_init_task, "wifi init", 4096, NULL, 1, NULL, 0);
+}
+
+static void wifi_init_task(void *arg)
+{
+  int64_t started_us = esp_timer_get_time();
+
+  int64_t bssid  = stor_get_i64(WIFI_STORE, BSSID_KEY, 0);
+  cached_channel = stor_get_i32(WIFI_STORE, CHANNEL_KEY, 0);
+
+  for (uint8_t i = 0; i < sizeof(cached_bssid); i++)
+    cached_bssid[i] = bssid >> (8 * i);
+
   ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
   ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
@@ -116,17 +270,42 @@ void wifi_init(void)
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
+#if CONFIG_WIFI_PROV_SCHEME_BLE
+  if (bt_released)
+  {
+    // the BLE provisioning can't run without its memory, the next boot keeps it
+    if (!has_credentials())
+    {
+      ESP_LOGW(TAG, "No credentials, restarting to provision");
+      stor_set_i32(WIFI_STORE, BT_RECLAIM_KEY, 0);
+      esp_restart();
+    }
+
+    provisioned = true;
+  }
+  else
+  {
+    wifi_prov_mgr_config_t config = {
+        .scheme               = wifi_prov_scheme_ble,
+        .scheme_event_handler = WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BTDM};
+
+    /* Initialize provisioning manager with the
+    * configuration parameters set above */
+    ESP_ERROR_CHECK(wifi_prov_mgr_init(config));
+
+    /* Let's find out if the device is provisioned */
+    ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+  }
+#else
+  esp_netif_create_default_wifi_ap();
+
   wifi_prov_mgr_config_t config = {
-      .scheme               = wifi_prov_scheme_ble,
-      .scheme_event_handler = WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BTDM};
+      .scheme               = wifi_prov_scheme_softap,
+      .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE};
 
-  /* Initialize provisioning manager with the
-  * configuration parameters set above */
   ESP_ERROR_CHECK(wifi_prov_mgr_init(config));
-
-  bool provisioned = false;
-  /* Let's find out if the device is provisioned */
   ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+#endif
 
   /* If device is not yet provisioned start provisioning service */
   if (!provisioned)
@@ -162,6 +341,7 @@ void wifi_init(void)
      */
     const char *service_key = NULL;
 
+#if CONFIG_WIFI_PROV_SCHEME_BLE
     /* This step is only useful when scheme is wifi_prov_scheme_ble. This will
     * set a custom 128 bit UUID which will be included in the BLE advertisement
     * and will correspond to the primary GATT service that provides provisioning
@@ -194,6 +374,13 @@ void wifi_init(void)
         0x7e,
     };
     wifi_prov_scheme_ble_set_service_uuid(custom_service_uuid);
+#else
+    // protocomm would start its own server on the port of the app one, it shares that instead
+    while ((prov_server = http_server_handle()) == NULL)
+      vTaskDelay(pdMS_TO_TICKS(10));
+
+    wifi_prov_scheme_softap_set_httpd_handle(&prov_server);
+#endif
 
     ESP_ERROR_CHECK(wifi_prov_mgr_start_provisioning(security, pop, service_name, service_key));
 
@@ -209,11 +396,117 @@ void wifi_init(void)
 
     /* We don't need the manager as device is already provisioned,
     * so let's release it's resources */
-    wifi_prov_mgr_deinit();
+    if (!bt_released)
+      prov_mgr_deinit();
+
+    /* The credentials are loaded already, the access point hints must not go to the flash */
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 
     /* Start Wi-Fi station */
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_start());
     ESP_LOGI(TAG, "Waiting for wifi");
   }
-}
\ No newline at end of file
+
+  ESP_LOGI(TAG, "Initialized in %lld ms", (esp_timer_get_time() - started_us) / 1000);
+
+  vTaskDelete(NULL);
+}
+
+// The first attempt after a boot or a successful connection tries the last access point only
+static void connect()
+{
+  if (provisioned)
+  {
+    wifi_config_t config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &config));
+
+    bool hinted    = first_attempt && cached_channel != 0;
+    attempt_hinted = hinted;
+
+    config.sta.bssid_set   = hinted;
+    config.sta.channel     = hinted ? cached_channel : 0;
+    config.sta.scan_method = WIFI_FAST_SCAN;
+
+    if (hinted)
+      memcpy(config.sta.bssid, cached_bssid, sizeof(cached_bssid));
+
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &config));
+
+    if (hinted)
+      ESP_LOGI(TAG, "Connecting to " MACSTR " on channel %d", MAC2STR(cached_bssid), cached_channel);
+  }
+
+  first_attempt      = false;
+  connect_started_us = esp_timer_get_time();
+  esp_wifi_connect();
+}
+
+static void retry_connect(void *arg)
+{
+  connect();
+}
+
+static void schedule_retry(uint8_t reason)
+{
+  uint32_t delay_ms = RETRY_MIN_MS << (retries < 7 ? retries : 7);
+
+  if (delay_ms > RETRY_MAX_MS)
+    delay_ms = RETRY_MAX_MS;
+
+  retries++;
+
+  ESP_LOGI(TAG, "disconnected, reason %d, retry #%d in %u ms", reason, retries, delay_ms);
+
+  // fails if a retry is waiting already, a disconnect then changes nothing
+  esp_timer_start_once(retry_timer, delay_ms * 1000);
+}
+
+// Written only when the access point changes, not on every reconnect
+static void remember_ap(const uint8_t *bssid, uint8_t channel)
+{
+  if (channel == cached_channel && memcmp(bssid, cached_bssid, sizeof(cached_bssid)) == 0)
+    return;
+
+  int64_t packed = 0;
+
+  for (uint8_t i = 0; i < sizeof(cached_bssid); i++)
+    packed |= (int64_t)bssid[i] << (8 * i);
+
+  memcpy(cached_bssid, bssid, sizeof(cached_bssid));
+  cached_channel = channel;
+
+  stor_set_i64(WIFI_STORE, BSSID_KEY, packed);
+  stor_set_i32(WIFI_STORE, CHANNEL_KEY, channel);
+}
+
+// The BLE scheme handler releases the BT memory on the deinit
+static void prov_mgr_deinit()
+{
+#if CONFIG_WIFI_PROV_SCHEME_BLE
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+  wifi_prov_mgr_deinit();
+
+  report_bt_released(heap_caps_get_free_size(MALLOC_CAP_8BIT) - free_before);
+
+  // from the next boot on the memory goes back before the history allocates
+  stor_set_i32(WIFI_STORE, BT_RECLAIM_KEY, 1);
+  bt_released = true;
+#else
+  wifi_prov_mgr_deinit();
+#endif
+}
+
+static bool has_credentials()
+{
+  wifi_config_t config;
+
+  return esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK && config.sta.ssid[0] != 0;
+}
+
+static void report_bt_released(size_t bytes)
+{
+  ESP_LOGI(TAG, "Released %u bytes of BT memory", bytes);
+  metrics_set(METRIC_BT_RELEASED_BYTES, 0, bytes);
+}
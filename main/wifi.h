@@ -1,6 +1,10 @@
 #ifndef _PRESSURE_WIFI_H_
 #define _PRESSURE_WIFI_H_
 
-void wifi_init(void);
+// Initializes the network stack and brings WiFi up in the background
+void wifi_start(void);
+
+// Call before the big allocations, gives the BT memory back once the device is provisioned
+void wifi_reclaim_bt_memory(void);
 
 #endif /* _PRESSURE_WIFI_H_ */
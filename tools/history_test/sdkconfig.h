@@ -0,0 +1,11 @@
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+// The options of the project sdkconfig history.c is built with
+
+#define CONFIG_FREERTOS_HZ 100
+
+#define CONFIG_HISTORY_BLOCK_SIZE 256
+#define CONFIG_HISTORY_BLOCKS_PER_CHANNEL 48
+
+#endif // _HOST_SDKCONFIG_H_
@@ -0,0 +1,106 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "../../main/history.c"
+
+/*
+  Appends sample streams to a ring the way the sensor task does and decodes every block back,
+  each sample has to come out with its value and its timestamp. Exits with the number of
+  failed checks.
+*/
+
+#define TEST_BLOCKS 8
+
+typedef struct decoded
+{
+  int64_t next_timestamp_us;
+  pressure_value_t value;
+  size_t samples;
+  size_t errors;
+} decoded_t;
+
+static uint32_t failures;
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  if (level > host_log_level)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  printf("%s: ", tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+void pressure_stream_subscribe(pressure_rate_t rate, pressure_stream_cb_t cb, void *arg)
+{
+}
+
+static void check(bool ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+
+  if (!ok)
+    failures++;
+}
+
+static void decoded_sample_cb(int64_t timestamp_us, pressure_value_t pressure, void *arg)
+{
+  decoded_t *decoded = (decoded_t *)arg;
+
+  if (timestamp_us != decoded->next_timestamp_us || pressure != decoded->value)
+    decoded->errors++;
+
+  decoded->next_timestamp_us = timestamp_us + HISTORY_PERIOD_US;
+  decoded->samples++;
+}
+
+// A constant channel, as an absent sensor or a steady tank gives, never fills a block
+static void test_constant(pressure_value_t value, uint32_t samples, const char *name)
+{
+  history_ring_t ring;
+  char what[96];
+
+  if (!ring_init(&ring, TEST_BLOCKS))
+  {
+    check(false, "ring_init");
+    return;
+  }
+
+  for (uint32_t n = 0; n < samples; n++)
+    ring_append(&ring, (int64_t)n * HISTORY_PERIOD_US, value);
+
+  decoded_t decoded = {.next_timestamp_us = 0, .value = value};
+  history_block_t block;
+  bool counts_ok = true;
+
+  for (uint32_t seq = ring_block(&ring, 0)->seq; ring_copy_block(&ring, seq, &block); seq++)
+  {
+    counts_ok = counts_ok && block.count > 0;
+    block_decode(&block, INT64_MIN, INT64_MAX, decoded_sample_cb, &decoded);
+  }
+
+  snprintf(what, sizeof(what), "%s, %u samples in %u blocks", name, samples, ring.used);
+  check(counts_ok && decoded.samples == samples && decoded.errors == 0, what);
+
+  snprintf(what, sizeof(what), "%s, blocks hold %u samples at most", name, UINT16_MAX);
+  check(ring.used == (samples + UINT16_MAX - 1) / UINT16_MAX, what);
+
+  ring_free(&ring);
+}
+
+int main()
+{
+  // over 65536 samples, 44 minutes of the fast stream
+  test_constant(PRESSURE_SENSOR_ABSENT, 3 * 65536 + 1000, "absent sensor");
+  test_constant(500000, 70000, "steady pressure");
+  test_constant(0, UINT16_MAX, "exactly one block");
+
+  printf("%u failed\n", failures);
+
+  return failures;
+}
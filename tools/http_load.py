@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Load test for the controller REST API.
+
+Keeps N keep-alive connections busy for a while and reports requests per second and the
+latency distribution. The measure loop counters from /api/v1/snapshot are read before and
+after the run so a late cycle caused by the server load shows up in the report.
+
+  tools/http_load.py 192.168.1.50 -c 4 -d 30
+  tools/http_load.py 192.168.1.50 --path /api/v1/pressure --conditional
+"""
+
+import argparse
+import http.client
+import json
+import threading
+import time
+
+
+def get_json(host, port, path, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request("GET", path)
+        response = conn.getresponse()
+        return json.loads(response.read())
+    finally:
+        conn.close()
+
+
+def worker(args, deadline, results, lock):
+    latencies = []
+    statuses = {}
+    errors = 0
+    etag = None
+    conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+
+    while time.monotonic() < deadline:
+        headers = {}
+        if args.conditional and etag:
+            headers["If-None-Match"] = etag
+
+        started = time.perf_counter()
+        try:
+            conn.request("GET", args.path, headers=headers)
+            response = conn.getresponse()
+            response.read()
+        except (OSError, http.client.HTTPException):
+            errors += 1
+            conn.close()
+            conn = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+            continue
+
+        latencies.append(time.perf_counter() - started)
+        statuses[response.status] = statuses.get(response.status, 0) + 1
+        etag = response.getheader("ETag", etag)
+
+    conn.close()
+
+    with lock:
+        results["latencies"].extend(latencies)
+        results["errors"] += errors
+        for status, count in statuses.items():
+            results["statuses"][status] = results["statuses"].get(status, 0) + count
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[index]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("-p", "--port", type=int, default=80)
+    parser.add_argument("-c", "--connections", type=int, default=2,
+                        help="parallel keep-alive connections, keep it below the server socket limit")
+    parser.add_argument("-d", "--duration", type=float, default=10.0, help="seconds")
+    parser.add_argument("--path", default="/api/v1/snapshot")
+    parser.add_argument("--conditional", action="store_true",
+                        help="send If-None-Match with the last ETag, expect 304 while nothing changes")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    loop_before = get_json(args.host, args.port, "/api/v1/snapshot", args.timeout).get("loop")
+
+    results = {"latencies": [], "statuses": {}, "errors": 0}
+    lock = threading.Lock()
+    started = time.monotonic()
+    deadline = started + args.duration
+
+    threads = [threading.Thread(target=worker, args=(args, deadline, results, lock))
+               for _ in range(args.connections)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    elapsed = time.monotonic() - started
+
+    loop_after = get_json(args.host, args.port, "/api/v1/snapshot", args.timeout).get("loop")
+
+    latencies = sorted(results["latencies"])
+    ms = lambda v: v * 1000.0
+
+    print("%s%s, %d connections, %.1f s" % (args.host, args.path, args.connections, elapsed))
+    print("  requests  %d (%.1f req/s), errors %d" % (len(latencies), len(latencies) / elapsed, results["errors"]))
+    print("  statuses  %s" % ", ".join("%d: %d" % kv for kv in sorted(results["statuses"].items())))
+    print("  latency   p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms" % (
+        ms(percentile(latencies, 50)), ms(percentile(latencies, 90)),
+        ms(percentile(latencies, 99)), ms(latencies[-1] if latencies else 0)))
+
+    if loop_before and loop_after:
+        cycles = loop_after["cycles"] - loop_before["cycles"]
+        late = loop_after["late"] - loop_before["late"]
+        print("  measure   %d cycles (%.1f/s), %d late, max interval %d us" % (
+            cycles, cycles / elapsed, late, loop_after["max_interval_us"]))
+
+
+if __name__ == "__main__":
+    main()
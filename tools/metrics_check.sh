@@ -0,0 +1,33 @@
+#!/bin/sh
+# Scrapes /metrics like Prometheus would and checks the exposition format.
+#
+#   tools/metrics_check.sh 192.168.1.50
+#
+# promtool does the check when it is installed, otherwise every sample line has to parse and
+# belong to a family with a TYPE line.
+
+set -eu
+
+host=${1:?usage: $0 host[:port]}
+page=$(mktemp)
+trap 'rm -f "$page"' EXIT
+
+curl -sfS -H 'Accept: text/plain' -o "$page" -w 'HTTP %{http_code}, %{size_download} bytes in %{time_total} s\n' "http://$host/metrics"
+
+if command -v promtool >/dev/null 2>&1; then
+  promtool check metrics <"$page"
+else
+  awk '
+    /^# TYPE / { typed[$3] = 1; next }
+    /^#/ || /^$/ { next }
+    {
+      if ($0 !~ /^[a-zA-Z_:][a-zA-Z0-9_:]*(\{[^}]*\})? -?[0-9.eE+-]+$/) { print "bad line " NR ": " $0; bad = 1; next }
+      name = $1; sub(/\{.*/, "", name); family = name; sub(/_(bucket|sum|count)$/, "", family)
+      if (!(name in typed) && !(family in typed)) { print "no TYPE for " name; bad = 1 }
+      samples++
+    }
+    END { print samples " samples"; exit bad }
+  ' "$page"
+fi
+
+grep -E '_(measure_cycle_seconds_count|event_queue_depth|heap_free_bytes) ' "$page" || true
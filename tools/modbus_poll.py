@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""
+Modbus TCP client for the controller (see main/modbus_server.h for the register map).
+
+Polls the input registers, coils and holding registers like a SCADA master would, from several
+connections at once, and reports the request rate, latency and exceptions:
+
+  tools/modbus_poll.py 192.168.1.50 --masters 2 --rate 10 --duration 60
+
+Prints the decoded registers once:
+
+  tools/modbus_poll.py 192.168.1.50 --show
+
+Writes the controller settings, all of them in one request, and the override coils:
+
+  tools/modbus_poll.py 192.168.1.50 --set low_mark=250000 high_mark=820000 max_on=300 min_off=300
+  tools/modbus_poll.py 192.168.1.50 --override on --relay on
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+SENSORS = 5
+RELAYS = 2
+
+IR_PRESSURE = 0
+IR_PRESSURE_1S = IR_PRESSURE + SENSORS * 2
+IR_RELAYS = IR_PRESSURE_1S + SENSORS * 2
+IR_CONTROLLER = IR_RELAYS + 1
+IR_UPTIME = IR_CONTROLLER + 1
+IR_SEQ = IR_UPTIME + 2
+IR_DEGRADATION = IR_SEQ + 2
+IR_COUNT = IR_DEGRADATION + 1
+
+HR_NAMES = ["low_mark", "high_mark", "max_on", "min_off"]
+HR_COUNT = 6
+
+COIL_OVERRIDE = RELAYS
+COIL_COUNT = RELAYS + 1
+
+CONTROLLER_BITS = ["running", "relay_on", "under_low_mark", "above_high_mark",
+                   "max_on_exceeded", "min_off_passed", "manual_override"]
+
+
+class ModbusError(Exception):
+    pass
+
+
+class Client:
+    def __init__(self, host, port, unit=1, timeout=2.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.unit = unit
+        self.transaction = 0
+
+    def close(self):
+        self.sock.close()
+
+    def request(self, pdu):
+        self.transaction = (self.transaction + 1) & 0xFFFF
+        self.sock.sendall(struct.pack(">HHHB", self.transaction, 0, len(pdu) + 1, self.unit) + pdu)
+
+        transaction, protocol, length, _ = struct.unpack(">HHHB", self._recv(7))
+        response = self._recv(length - 1)
+
+        if transaction != self.transaction or protocol != 0:
+            raise ModbusError("unexpected transaction %d" % transaction)
+        if response[0] & 0x80:
+            raise ModbusError("exception %d on function %d" % (response[1], pdu[0]))
+
+        return response
+
+    def _recv(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ModbusError("connection closed")
+            data += chunk
+        return data
+
+    def read_registers(self, function, address, count):
+        response = self.request(struct.pack(">BHH", function, address, count))
+        return list(struct.unpack(">%dH" % count, response[2:2 + count * 2]))
+
+    def read_input_registers(self, address, count):
+        return self.read_registers(4, address, count)
+
+    def read_holding_registers(self, address, count):
+        return self.read_registers(3, address, count)
+
+    def read_coils(self, address, count):
+        response = self.request(struct.pack(">BHH", 1, address, count))
+        return [(response[2 + i // 8] >> (i % 8)) & 1 for i in range(count)]
+
+    def write_registers(self, address, values):
+        self.request(struct.pack(">BHHB%dH" % len(values), 16, address, len(values), len(values) * 2, *values))
+
+    def write_coil(self, address, value):
+        self.request(struct.pack(">BHH", 5, address, 0xFF00 if value else 0))
+
+
+def i32(registers, address):
+    value = registers[address] << 16 | registers[address + 1]
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def show(client):
+    ir = client.read_input_registers(0, IR_COUNT)
+    hr = client.read_holding_registers(0, HR_COUNT)
+    coils = client.read_coils(0, COIL_COUNT)
+
+    for ch in range(SENSORS):
+        print("sensor %d: %d Pa, 1 s mean %d Pa" % (ch, i32(ir, IR_PRESSURE + ch * 2), i32(ir, IR_PRESSURE_1S + ch * 2)))
+
+    print("relays: %s" % " ".join("%d=%s" % (i, "ON" if ir[IR_RELAYS] >> i & 1 else "OFF") for i in range(RELAYS)))
+    print("controller: %s" % " ".join(name for bit, name in enumerate(CONTROLLER_BITS) if ir[IR_CONTROLLER] >> bit & 1))
+    print("uptime %d s, seq %d, degradation %d %%" % (i32(ir, IR_UPTIME) & 0xFFFFFFFF, i32(ir, IR_SEQ) & 0xFFFFFFFF, ir[IR_DEGRADATION]))
+    print("settings: low_mark=%d high_mark=%d max_on=%d min_off=%d" % (i32(hr, 0), i32(hr, 2), hr[4], hr[5]))
+    print("coils: %s" % coils)
+
+
+def set_settings(client, assignments):
+    hr = client.read_holding_registers(0, HR_COUNT)
+    settings = {"low_mark": i32(hr, 0), "high_mark": i32(hr, 2), "max_on": hr[4], "min_off": hr[5]}
+
+    for assignment in assignments:
+        name, _, value = assignment.partition("=")
+        if name not in settings:
+            raise SystemExit("unknown setting %s, one of %s" % (name, ", ".join(HR_NAMES)))
+        settings[name] = int(value)
+
+    values = []
+    for name in ("low_mark", "high_mark"):
+        value = settings[name] & 0xFFFFFFFF
+        values += [value >> 16, value & 0xFFFF]
+    values += [settings["max_on"], settings["min_off"]]
+
+    client.write_registers(0, values)
+
+
+def poll(host, port, rate, duration, results, lock):
+    latencies = []
+    errors = 0
+    client = Client(host, port)
+    period = 1.0 / rate
+    next_at = started = time.monotonic()
+
+    try:
+        while time.monotonic() - started < duration:
+            sent = time.monotonic()
+            try:
+                client.read_input_registers(0, IR_COUNT)
+                client.read_coils(0, COIL_COUNT)
+                client.read_holding_registers(0, HR_COUNT)
+                latencies.append(time.monotonic() - sent)
+            except (ModbusError, socket.timeout) as e:
+                errors += 1
+                print("error: %s" % e, file=sys.stderr)
+
+            next_at += period
+            time.sleep(max(0.0, next_at - time.monotonic()))
+    finally:
+        client.close()
+
+    with lock:
+        results.append((latencies, errors, time.monotonic() - started))
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("-p", "--port", type=int, default=502)
+    parser.add_argument("--masters", type=int, default=2, help="concurrent connections")
+    parser.add_argument("--rate", type=float, default=10.0, help="polls per second per master, three requests each")
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds")
+    parser.add_argument("--show", action="store_true", help="print the registers and exit")
+    parser.add_argument("--set", nargs="+", metavar="NAME=VALUE", help="write controller settings: " + ", ".join(HR_NAMES))
+    parser.add_argument("--override", choices=["on", "off"])
+    parser.add_argument("--relay", choices=["on", "off"], help="controlled relay, under the override")
+    args = parser.parse_args()
+
+    if args.show or args.set or args.override or args.relay:
+        client = Client(args.host, args.port)
+        try:
+            if args.set:
+                set_settings(client, args.set)
+            if args.override:
+                client.write_coil(COIL_OVERRIDE, args.override == "on")
+            if args.relay:
+                client.write_coil(0, args.relay == "on")
+            show(client)
+        except ModbusError as e:
+            raise SystemExit(str(e))
+        finally:
+            client.close()
+        return
+
+    results = []
+    lock = threading.Lock()
+    threads = [threading.Thread(target=poll, args=(args.host, args.port, args.rate, args.duration, results, lock))
+               for _ in range(args.masters)]
+
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    latencies = sorted(l for result, _, _ in results for l in result)
+    errors = sum(e for _, e, _ in results)
+    elapsed = max(t for _, _, t in results)
+
+    if not latencies:
+        raise SystemExit("no successful polls, %d errors" % errors)
+
+    print("%d polls (%d requests) in %.1f s, %.1f polls/s, %d errors" % (
+        len(latencies), len(latencies) * 3, elapsed, len(latencies) / elapsed, errors))
+    print("poll latency ms: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f" % tuple(
+        1000 * v for v in (percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), latencies[-1])))
+
+
+if __name__ == "__main__":
+    main()
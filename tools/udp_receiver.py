@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""
+Collector for the controller UDP telemetry (see main/udp_telemetry.h for the frame format).
+
+Decodes every frame into CSV rows, one per measure cycle:
+
+  time_us,seq,relays,raw0,filtered0,raw1,filtered1,...
+
+Lost frames are found from sequence gaps and reported with the rate every few seconds.
+
+  tools/udp_receiver.py -o samples.csv
+  tools/udp_receiver.py --raw frames.bin   # frames as they came, each prefixed with a uint16 length
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+MAGIC = 0x5550
+VERSION = 1
+HEADER = struct.Struct("<HBBIqBB")
+
+
+def varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return value, offset
+        shift += 7
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def decode(data):
+    """Returns (seq, [(time_us, relays, [(raw, filtered), ...]), ...])"""
+    magic, version, channels, seq, time_us, cycles, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a telemetry frame: magic %04x version %d" % (magic, version))
+
+    offset = HEADER.size
+    previous = [(0, 0)] * channels
+    rows = []
+
+    for _ in range(cycles):
+        dt, offset = varint(data, offset)
+        time_us += dt
+        relays = data[offset]
+        offset += 1
+
+        values = []
+        for ch in range(channels):
+            raw, offset = varint(data, offset)
+            filtered, offset = varint(data, offset)
+            values.append((previous[ch][0] + unzigzag(raw), previous[ch][1] + unzigzag(filtered)))
+
+        previous = values
+        rows.append((time_us, relays, values))
+
+    if offset != len(data):
+        raise ValueError("%d trailing bytes" % (len(data) - offset))
+
+    return seq, rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--port", type=int, default=5005)
+    parser.add_argument("-o", "--output", help="CSV file, stdout if omitted")
+    parser.add_argument("--raw", help="write undecoded frames to this file instead")
+    parser.add_argument("--report", type=float, default=5.0, help="seconds between reports on stderr")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+    sock.settimeout(1.0)
+
+    raw_file = open(args.raw, "wb") if args.raw else None
+    csv_file = None if raw_file else (open(args.output, "w") if args.output else sys.stdout)
+    header_written = False
+
+    expected = None
+    frames = lost = reordered = bytes_in = samples = 0
+    reported_at = time.monotonic()
+
+    try:
+        while True:
+            try:
+                data, _ = sock.recvfrom(2048)
+            except socket.timeout:
+                data = None
+
+            if data:
+                try:
+                    seq, rows = decode(data)
+                except (ValueError, IndexError, struct.error) as e:
+                    print("bad frame: %s" % e, file=sys.stderr)
+                    continue
+
+                if expected is not None and seq != expected:
+                    gap = (seq - expected) & 0xFFFFFFFF
+                    if gap < 0x80000000:
+                        lost += gap
+                    else:
+                        reordered += 1
+                expected = (seq + 1) & 0xFFFFFFFF
+
+                frames += 1
+                bytes_in += len(data)
+                samples += sum(len(values) * 2 for _, _, values in rows)
+
+                if raw_file:
+                    raw_file.write(struct.pack("<H", len(data)) + data)
+                else:
+                    if not header_written:
+                        channels = len(rows[0][2]) if rows else 0
+                        columns = ["time_us", "seq", "relays"]
+                        for ch in range(channels):
+                            columns += ["raw%d" % ch, "filtered%d" % ch]
+                        csv_file.write(",".join(columns) + "\n")
+                        header_written = True
+
+                    for time_us, relays, values in rows:
+                        fields = [str(time_us), str(seq), str(relays)]
+                        for raw, filtered in values:
+                            fields += [str(raw), str(filtered)]
+                        csv_file.write(",".join(fields) + "\n")
+
+            now = time.monotonic()
+            if now - reported_at >= args.report and frames > 0:
+                print("%d frames, %d lost (%.2f%%), %d reordered, %.2f bytes/sample, %.0f bytes/s" % (
+                    frames, lost, 100.0 * lost / (frames + lost), reordered,
+                    float(bytes_in) / samples if samples else 0.0, bytes_in / (now - reported_at)),
+                    file=sys.stderr)
+                bytes_in = samples = 0
+                reported_at = now
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if raw_file:
+            raw_file.close()
+        elif csv_file is not sys.stdout:
+            csv_file.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "history.h"
+#include "pressure_sensors.h"
+#include "relay_control.h"
+#include "screens.h"
+#include "ui.h"
+#include "ui_perf.h"
+
+#include "host.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+
+/*
+  Headless GUI benchmark: ui.c with its screens and widgets and the real LVGL, drawing into an
+  in-memory 240x240 display (host_display.c). The GUI task loop runs unchanged on the virtual
+  clock of host_idf.c; between its waits the bench posts PRESSURE_SENSOR_UI_VALUE_CHANGED at the
+  UI rate the way the sensor task does, rounded to kPa and only on change.
+
+  The trend scenario shows the trend screen of sensor 0 instead. Its samples go through the fast
+  stream into history.c, which encodes them into blocks as on the device, and the trend window
+  before the scenario is filled the same way before the screen is built.
+
+  Every scenario gets the same update stream on every run, so frames, invalidated pixels, LVGL
+  heap and the framebuffer hash are comparable between builds. Render times are host clock
+  measurements, compare them on the same machine only.
+
+    ui_bench [-v] [-d seconds] [scenario...]
+*/
+
+static const char *TAG = "BENCH";
+
+#define BENCH_START_US 1000000LL   // the home screen is built and drawn by then
+#define BENCH_SETTLE_US 1000000LL  // after the last update, for the pending frame
+#define CYCLE_US (PRESSURE_MEASURE_CYCLE_MS * 1000LL)
+#define UI_PERIOD_US (CYCLE_US * 2)
+#define TREND_SENSOR 0
+#define BENCH_DURATION_S 60
+
+typedef pressure_value_t (*scenario_value_fn_t)(uint8_t index, int64_t t_ms, uint32_t *rng);
+
+typedef struct
+{
+  const char *name;
+  scenario_value_fn_t value;
+  bool trend; // on the trend screen of TREND_SENSOR
+} scenario_t;
+
+/*
+  Declarations
+*/
+static pressure_value_t steady(uint8_t index, int64_t t_ms, uint32_t *rng);
+static pressure_value_t noisy(uint8_t index, int64_t t_ms, uint32_t *rng);
+static pressure_value_t ramping(uint8_t index, int64_t t_ms, uint32_t *rng);
+static pressure_value_t dropouts(uint8_t index, int64_t t_ms, uint32_t *rng);
+
+static void start_scenario(int64_t now_us);
+static void finish_scenario();
+static void feed_sample(int64_t now_us);
+static void feed_history(int64_t timestamp_us, uint8_t index, pressure_value_t value);
+static void fill_trend_window(int64_t now_us);
+static uint32_t framebuffer_hash();
+static uint32_t xorshift(uint32_t *state);
+
+ESP_EVENT_DEFINE_BASE(PRESSURE_SENSORS_EVENTS);
+_PRESSURE_SENSORS_EVENTS(DEF_EVENT)
+
+ESP_EVENT_DEFINE_BASE(RELAY_CONTROL_EVENTS);
+_RELAY_CONTROL_EVENTS(DEF_EVENT)
+
+static const scenario_t scenarios[] = {
+    {"steady", steady},
+    {"noisy", noisy},
+    {"ramping", ramping},
+    {"dropouts", dropouts},
+    {"trend", ramping, true}};
+
+#define SCENARIOS_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static bool selected[SCENARIOS_COUNT];
+static int64_t duration_us = BENCH_DURATION_S * 1000000LL;
+
+static int current = -1;
+static int64_t started_us;
+static int64_t origin_us; // of the scenario time, the trend window starts before started_us
+static int64_t next_sample_us;
+static uint32_t rng;
+static uint32_t updates;
+static pressure_value_t posted[SENSORS_COUNT];
+static ui_perf_stats_t perf_before;
+
+static pressure_stream_cb_t history_cb;
+static void *history_cb_arg;
+
+int main(int argc, char **argv)
+{
+  bool any = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+    {
+      host_log_level = ESP_LOG_INFO;
+    }
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+    {
+      duration_us = atoll(argv[++i]) * 1000000LL;
+    }
+    else
+    {
+      bool found = false;
+
+      for (uint8_t s = 0; s < SCENARIOS_COUNT; s++)
+      {
+        if (strcmp(argv[i], scenarios[s].name) == 0)
+          selected[s] = found = any = true;
+      }
+
+      if (!found)
+      {
+        fprintf(stderr, "usage: %s [-v] [-d seconds] [steady|noisy|ramping|dropouts|trend]...\n", argv[0]);
+        return 1;
+      }
+    }
+  }
+
+  if (!any)
+    memset(selected, true, sizeof(selected));
+
+  printf("%-9s %7s %6s %5s %8s %8s %9s %8s %8s %8s %7s %7s %5s %8s\n",
+         "scenario", "updates", "frames", "fps", "frame_us", "max_us", "px/update", "px/frame",
+         "task_us", "max_us", "lv_mem", "peak", "frag", "fb_hash");
+
+  history_init();
+
+  // the GUI task never returns, the bench runs from inside its waits and exits after the last scenario
+  gui_start();
+
+  return 0;
+}
+
+int64_t bench_next_event_us()
+{
+  if (current < 0)
+    return BENCH_START_US;
+
+  if (current >= (int)SCENARIOS_COUNT)
+    return INT64_MAX;
+
+  if (next_sample_us < started_us + duration_us)
+    return next_sample_us;
+
+  return started_us + duration_us + BENCH_SETTLE_US;
+}
+
+void bench_run_event(int64_t now_us)
+{
+  if (current < 0)
+  {
+    screen_stats_t home;
+    screens_get_stats(SCREEN_HOME, &home);
+
+    printf("# home screen built in %u us, LVGL heap %u bytes\n", home.build_us, home.mem_after_build);
+
+    start_scenario(now_us);
+    return;
+  }
+
+  if (next_sample_us < started_us + duration_us)
+  {
+    feed_sample(now_us);
+    return;
+  }
+
+  finish_scenario();
+  start_scenario(now_us);
+}
+
+// sensor task side: UI rate, kPa rounded, posted on change only
+static void feed_sample(int64_t now_us)
+{
+  int64_t t_ms = (now_us - origin_us) / 1000;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+  {
+    pressure_value_t value = scenarios[current].value(i, t_ms, &rng);
+
+    // the fast stream runs at twice the UI rate
+    if (scenarios[current].trend)
+    {
+      feed_history(now_us, i, value);
+      feed_history(now_us + CYCLE_US, i, value);
+    }
+
+    if (value >= 0)
+      value = (value + PRESSURE_RESOLUTION / 2) / PRESSURE_RESOLUTION * PRESSURE_RESOLUTION;
+
+    if (value == posted[i])
+      continue;
+
+    posted[i] = value;
+    updates++;
+
+    sensor_pressure_t sensor = {.index = i, .pressure = value};
+    esp_event_post(PRESSURE_SENSORS_EVENTS, PRESSURE_SENSOR_UI_VALUE_CHANGED, &sensor, sizeof(sensor), 0);
+  }
+
+  next_sample_us += UI_PERIOD_US;
+}
+
+static void start_scenario(int64_t now_us)
+{
+  do
+    current++;
+  while (current < (int)SCENARIOS_COUNT && !selected[current]);
+
+  if (current >= (int)SCENARIOS_COUNT)
+    exit(0);
+
+  ESP_LOGI(TAG, "%s", scenarios[current].name);
+
+  started_us     = now_us;
+  origin_us      = scenarios[current].trend ? now_us - CONFIG_UI_TREND_WINDOW_S * 1000000LL : now_us;
+  next_sample_us = now_us;
+  rng            = 0x2545F491 + current;
+  updates        = 0;
+
+  for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+    posted[i] = INT32_MIN;
+
+  if (scenarios[current].trend)
+  {
+    fill_trend_window(now_us);
+    screens_show(SCREEN_TREND, TREND_SENSOR);
+  }
+
+  ui_perf_get(&perf_before);
+}
+
+// the window before the scenario, continued by the scenario stream, so the chart starts full
+static void fill_trend_window(int64_t now_us)
+{
+  for (int64_t t_us = origin_us; t_us < now_us; t_us += CYCLE_US)
+  {
+    for (uint8_t i = 0; i < SENSORS_COUNT; i++)
+      feed_history(t_us, i, scenarios[current].value(i, (t_us - origin_us) / 1000, &rng));
+  }
+}
+
+static void feed_history(int64_t timestamp_us, uint8_t index, pressure_value_t value)
+{
+  pressure_aggregate_t sample = {
+      .index        = index,
+      .rate         = PRESSURE_RATE_FAST,
+      .count        = value >= 0,
+      .timestamp_us = timestamp_us,
+      .mean         = value,
+      .min          = value,
+      .max          = value};
+
+  if (history_cb != NULL)
+    history_cb(&sample, history_cb_arg);
+}
+
+static void finish_scenario()
+{
+  ui_perf_stats_t after;
+  ui_perf_get(&after);
+
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+
+  uint32_t frames     = after.frames - perf_before.frames;
+  uint64_t frame_us   = after.frame_us_total - perf_before.frame_us_total;
+  uint64_t px         = after.px_total - perf_before.px_total;
+  uint32_t calls      = after.handler_calls - perf_before.handler_calls;
+  uint64_t handler_us = after.handler_us_total - perf_before.handler_us_total;
+
+  printf("%-9s %7u %6u %5.1f %8llu %8u %9llu %8llu %8llu %8u %7u %7u %4u%% %08x\n",
+         scenarios[current].name, updates, frames, frames * 1e6 / (duration_us + BENCH_SETTLE_US),
+         frames ? (unsigned long long)(frame_us / frames) : 0ULL, after.frame_us_max,
+         updates ? (unsigned long long)(px / updates) : 0ULL,
+         frames ? (unsigned long long)(px / frames) : 0ULL,
+         calls ? (unsigned long long)(handler_us / calls) : 0ULL, after.handler_us_max,
+         mon.total_size - mon.free_size, mon.max_used, mon.frag_pct, framebuffer_hash());
+
+  static const uint16_t bounds[] = UI_PERF_HISTOGRAM_BOUNDS_MS;
+
+  printf("  frame ms:");
+
+  for (uint8_t i = 0; i < UI_PERF_HISTOGRAM_BUCKETS; i++)
+  {
+    uint32_t count = after.frame_histogram[i] - perf_before.frame_histogram[i];
+
+    if (i < UI_PERF_HISTOGRAM_BUCKETS - 1)
+      printf(" <=%u:%u", bounds[i], count);
+    else
+      printf(" >%u:%u", bounds[i - 1], count);
+  }
+
+  printf("\n");
+
+  if (scenarios[current].trend)
+  {
+    screen_stats_t trend;
+    screens_get_stats(SCREEN_TREND, &trend);
+
+    printf("# trend screen built in %u us, LVGL heap %u bytes, peak %u bytes\n",
+           trend.build_us, trend.mem_after_build, trend.mem_peak);
+
+    screens_show(SCREEN_HOME, 0);
+  }
+
+  fflush(stdout);
+}
+
+/*
+  Update streams, Pa
+*/
+
+static pressure_value_t base_pressure(uint8_t index)
+{
+  return 120000 + index * 150000;
+}
+
+// nothing changes after the first update
+static pressure_value_t steady(uint8_t index, int64_t t_ms, uint32_t *rng)
+{
+  return base_pressure(index);
+}
+
+// +-3 kPa of noise, the displayed value flips on most samples
+static pressure_value_t noisy(uint8_t index, int64_t t_ms, uint32_t *rng)
+{
+  return base_pressure(index) + (int32_t)(xorshift(rng) % 6001) - 3000;
+}
+
+// 0..800 kPa and back in 20 s, sensors out of phase
+static pressure_value_t ramping(uint8_t index, int64_t t_ms, uint32_t *rng)
+{
+  int64_t phase = (t_ms + index * 4000) % 20000;
+
+  return (phase < 10000 ? phase : 20000 - phase) * 80;
+}
+
+// noisy, every sensor drops out for 2 s of every 10 s, the last one overloads instead
+static pressure_value_t dropouts(uint8_t index, int64_t t_ms, uint32_t *rng)
+{
+  pressure_value_t value = noisy(index, t_ms, rng);
+
+  if ((t_ms / 1000 + index * 2) % 10 < 2)
+    return index == SENSORS_COUNT - 1 ? PRESSURE_SENSOR_OVERLOAD : PRESSURE_SENSOR_ABSENT;
+
+  return value;
+}
+
+/*
+  The rest of the firmware the GUI code calls
+*/
+
+void calibrate_sensor(uint8_t index)
+{
+}
+
+// history.c takes the fast stream only
+void pressure_stream_subscribe(pressure_rate_t rate, pressure_stream_cb_t cb, void *arg)
+{
+  history_cb     = cb;
+  history_cb_arg = arg;
+}
+
+// FNV-1a
+static uint32_t framebuffer_hash()
+{
+  const uint8_t *data = (const uint8_t *)host_display_framebuffer();
+  uint32_t hash       = 2166136261u;
+
+  for (size_t i = 0; i < LV_HOR_RES_MAX * LV_VER_RES_MAX * sizeof(lv_color_t); i++)
+    hash = (hash ^ data[i]) * 16777619u;
+
+  return hash;
+}
+
+static uint32_t xorshift(uint32_t *state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return *state = x;
+}
@@ -0,0 +1,19 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+// Implemented by the bench: the next moment it wants control at and what it does then.
+// INT64_MAX when it is done, the GUI task is never woken up again.
+int64_t bench_next_event_us();
+void bench_run_event(int64_t now_us);
+
+// Host clock, us
+int64_t host_real_time_us();
+
+// Framebuffer of the in-memory display, LV_HOR_RES_MAX x LV_VER_RES_MAX
+const lv_color_t *host_display_framebuffer();
+
+#endif // _HOST_H_
@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "display.h"
+#include "host.h"
+
+/* Littlevgl specific */
+#include "lvgl/lvgl.h"
+#include "lvgl_helpers.h"
+
+/*
+  display.c without the panel: the same draw buffers, flushes are copied into a framebuffer
+  and are ready right away. Power management has nothing to switch.
+*/
+
+#define DISPLAY_BUFFER_SIZE (LV_HOR_RES_MAX * CONFIG_DISPLAY_BUFFER_LINES)
+
+/*
+  Declarations
+*/
+static void display_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_map);
+
+static lv_color_t framebuffer[LV_HOR_RES_MAX * LV_VER_RES_MAX];
+
+static lv_disp_buf_t disp_buf;
+static lv_color_t buf1[DISPLAY_BUFFER_SIZE];
+#ifdef CONFIG_DISPLAY_DOUBLE_BUFFER
+static lv_color_t buf2[DISPLAY_BUFFER_SIZE];
+#endif
+
+void lvgl_driver_init(void)
+{
+}
+
+void display_init(lv_disp_drv_t *disp_drv)
+{
+#ifdef CONFIG_DISPLAY_DOUBLE_BUFFER
+  lv_disp_buf_init(&disp_buf, buf1, buf2, DISPLAY_BUFFER_SIZE);
+#else
+  lv_disp_buf_init(&disp_buf, buf1, NULL, DISPLAY_BUFFER_SIZE);
+#endif
+
+  disp_drv->buffer   = &disp_buf;
+  disp_drv->flush_cb = display_flush;
+}
+
+void display_set_backlight(uint8_t percent)
+{
+}
+
+void display_sleep()
+{
+}
+
+void display_wake()
+{
+}
+
+const lv_color_t *host_display_framebuffer()
+{
+  return framebuffer;
+}
+
+static void display_flush(lv_disp_drv_t *disp_drv, const lv_area_t *area, lv_color_t *color_map)
+{
+  lv_coord_t width = lv_area_get_width(area);
+
+  for (lv_coord_t y = area->y1; y <= area->y2; y++)
+  {
+    memcpy(&framebuffer[y * LV_HOR_RES_MAX + area->x1], color_map, width * sizeof(lv_color_t));
+    color_map += width;
+  }
+
+  lv_disp_flush_ready(disp_drv);
+}
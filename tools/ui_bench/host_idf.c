@@ -0,0 +1,295 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_event.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "host.h"
+
+/*
+  One task on a virtual clock. The GUI task runs as on the device, but when it waits the clock
+  jumps to whatever comes first: the wait deadline, an esp_timer or the next bench event. The
+  host time the task spends busy is added on top, so it measures its own work in real time
+  while the schedule of the updates it gets stays the same from run to run.
+*/
+
+#define HOST_TIMERS_MAX 8
+#define HOST_HANDLERS_MAX 16
+#define TICK_US (portTICK_PERIOD_MS * 1000)
+
+struct esp_timer
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  int64_t deadline_us; // 0 if stopped
+  int64_t period_us;
+};
+
+typedef struct
+{
+  esp_event_base_t base;
+  int32_t id;
+  esp_event_handler_t handler;
+  void *arg;
+} host_handler_t;
+
+/*
+  Declarations
+*/
+static void advance_to(int64_t time_us);
+static struct esp_timer *next_timer();
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+static int64_t virtual_us;
+static int64_t woke_up_real_us;
+static int64_t ticks_delivered;
+
+static uint32_t notified_value;
+static TaskHandle_t task_handle = (TaskHandle_t)&task_handle;
+
+static struct esp_timer timers[HOST_TIMERS_MAX];
+static uint8_t timers_count;
+
+static host_handler_t handlers[HOST_HANDLERS_MAX];
+static uint8_t handlers_count;
+
+static esp_freertos_tick_cb_t tick_hook;
+
+int64_t host_real_time_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+  return virtual_us + (host_real_time_us() - woke_up_real_us);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+  if (handle != NULL)
+    *handle = task_handle;
+
+  woke_up_real_us = host_real_time_us();
+  task(arg);
+
+  return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  return task_handle;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+  notified_value |= value;
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+  notified_value &= ~clear_on_entry;
+
+  int64_t now      = esp_timer_get_time();
+  int64_t deadline = ticks == portMAX_DELAY ? INT64_MAX : now + (int64_t)ticks * TICK_US;
+
+  advance_to(now);
+
+  while (notified_value == 0 && virtual_us < deadline)
+  {
+    struct esp_timer *timer = next_timer();
+    int64_t timer_us        = timer != NULL ? timer->deadline_us : INT64_MAX;
+    int64_t event_us        = bench_next_event_us();
+    int64_t next_us         = deadline;
+
+    if (timer_us < next_us)
+      next_us = timer_us;
+
+    if (event_us < next_us)
+      next_us = event_us;
+
+    if (next_us == INT64_MAX)
+      exit(0); // nothing will ever wake the task up
+
+    advance_to(next_us);
+
+    if (next_us == timer_us)
+    {
+      timer->deadline_us = timer->period_us > 0 ? timer->deadline_us + timer->period_us : 0;
+      timer->callback(timer->arg);
+    }
+    else if (next_us == event_us)
+    {
+      bench_run_event(next_us);
+    }
+  }
+
+  if (value != NULL)
+    *value = notified_value;
+
+  BaseType_t notified = notified_value != 0 ? pdTRUE : pdFALSE;
+  notified_value &= ~clear_on_exit;
+
+  woke_up_real_us = host_real_time_us();
+
+  return notified;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  return 0;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  advance_to(esp_timer_get_time() + (int64_t)ticks * TICK_US);
+  woke_up_real_us = host_real_time_us();
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  exit(0);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+  if (timers_count == HOST_TIMERS_MAX)
+    return ESP_ERR_NO_MEM;
+
+  struct esp_timer *timer = &timers[timers_count++];
+
+  timer->callback    = args->callback;
+  timer->arg         = args->arg;
+  timer->deadline_us = 0;
+
+  *handle = timer;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+  if (timer->deadline_us != 0)
+    return ESP_ERR_INVALID_STATE;
+
+  timer->deadline_us = esp_timer_get_time() + timeout_us;
+  timer->period_us   = 0;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+  if (timer->deadline_us != 0)
+    return ESP_ERR_INVALID_STATE;
+
+  timer->deadline_us = esp_timer_get_time() + period_us;
+  timer->period_us   = period_us;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+  if (timer->deadline_us == 0)
+    return ESP_ERR_INVALID_STATE;
+
+  timer->deadline_us = 0;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+  timer->deadline_us = 0;
+  timer->callback    = NULL;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler,
+                                              void *event_handler_arg, esp_event_handler_instance_t *instance)
+{
+  if (handlers_count == HOST_HANDLERS_MAX)
+    return ESP_ERR_NO_MEM;
+
+  handlers[handlers_count++] = (host_handler_t){.base = event_base, .id = event_id, .handler = event_handler, .arg = event_handler_arg};
+
+  return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, void *event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+  for (uint8_t i = 0; i < handlers_count; i++)
+  {
+    host_handler_t *h = &handlers[i];
+
+    if (h->base == event_base && (h->id == event_id || h->id == ESP_EVENT_ANY_ID))
+      h->handler(h->arg, event_base, event_id, event_data);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t esp_register_freertos_tick_hook_for_cpu(esp_freertos_tick_cb_t tick_cb, UBaseType_t cpu)
+{
+  tick_hook = tick_cb;
+  return ESP_OK;
+}
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  static const char letters[] = "-EWIDV";
+
+  if (level > host_log_level)
+    return;
+
+  va_list args;
+  va_start(args, format);
+
+  fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+  vfprintf(stderr, format, args);
+  fputc('\n', stderr);
+
+  va_end(args);
+}
+
+// Moves the virtual clock, the busy time of the task is counted in, and runs the tick hook for every tick passed
+static void advance_to(int64_t time_us)
+{
+  int64_t now = esp_timer_get_time();
+
+  virtual_us      = time_us > now ? time_us : now;
+  woke_up_real_us = host_real_time_us();
+
+  for (; (ticks_delivered + 1) * TICK_US <= virtual_us; ticks_delivered++)
+  {
+    if (tick_hook != NULL)
+      tick_hook();
+  }
+}
+
+static struct esp_timer *next_timer()
+{
+  struct esp_timer *next = NULL;
+
+  for (uint8_t i = 0; i < timers_count; i++)
+  {
+    if (timers[i].deadline_us != 0 && timers[i].callback != NULL && (next == NULL || timers[i].deadline_us < next->deadline_us))
+      next = &timers[i];
+  }
+
+  return next;
+}
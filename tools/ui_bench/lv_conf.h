@@ -0,0 +1,33 @@
+#ifndef LV_CONF_H
+#define LV_CONF_H
+
+#include <stdint.h>
+
+// The device configuration (sdkconfig LVGL section) as far as it changes the rendering cost,
+// everything else is left to LVGL defaults
+
+#define LV_HOR_RES_MAX 240
+#define LV_VER_RES_MAX 240
+
+#define LV_COLOR_DEPTH 16
+#define LV_COLOR_16_SWAP 1
+
+#define LV_MEM_CUSTOM 0
+#define LV_MEM_SIZE (32U * 1024U)
+
+#define LV_TICK_CUSTOM 0
+#define LV_USE_LOG 0
+#define LV_USE_GPU 0
+#define LV_USE_FILESYSTEM 0
+
+#define LV_FONT_MONTSERRAT_12 1
+#define LV_FONT_MONTSERRAT_16 1
+
+#define LV_USE_THEME_MATERIAL 1
+#define LV_THEME_DEFAULT_INIT lv_theme_material_init
+#define LV_THEME_DEFAULT_FONT_SMALL &lv_font_montserrat_12
+#define LV_THEME_DEFAULT_FONT_NORMAL &lv_font_montserrat_16
+#define LV_THEME_DEFAULT_FONT_SUBTITLE &lv_font_montserrat_16
+#define LV_THEME_DEFAULT_FONT_TITLE &lv_font_montserrat_16
+
+#endif // LV_CONF_H
@@ -0,0 +1,23 @@
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+// The options of the project sdkconfig the GUI code is built with
+
+#define CONFIG_FREERTOS_HZ 100
+
+#define CONFIG_UI_FRAME_RATE_MAX 5
+#define CONFIG_UI_DEADBAND_KPA 1
+#define CONFIG_UI_TREND_WINDOW_S 240
+#define CONFIG_UI_PERF_LOG_INTERVAL_S 0
+
+#define CONFIG_DISPLAY_BUFFER_LINES 40
+#define CONFIG_DISPLAY_DOUBLE_BUFFER 1
+#define CONFIG_DISPLAY_BACKLIGHT_LEVEL 100
+#define CONFIG_DISPLAY_DIM_TIMEOUT_S 0
+#define CONFIG_DISPLAY_DIM_LEVEL 10
+#define CONFIG_DISPLAY_SLEEP_TIMEOUT_S 0
+
+#define CONFIG_HISTORY_BLOCK_SIZE 256
+#define CONFIG_HISTORY_BLOCKS_PER_CHANNEL 48
+
+#endif // _HOST_SDKCONFIG_H_
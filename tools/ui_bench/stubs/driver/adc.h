@@ -0,0 +1,4 @@
+#ifndef _HOST_ADC_H_
+#define _HOST_ADC_H_
+
+#endif // _HOST_ADC_H_
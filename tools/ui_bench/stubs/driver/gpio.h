@@ -0,0 +1,6 @@
+#ifndef _HOST_GPIO_H_
+#define _HOST_GPIO_H_
+
+typedef int gpio_num_t;
+
+#endif // _HOST_GPIO_H_
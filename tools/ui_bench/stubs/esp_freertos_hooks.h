@@ -0,0 +1,12 @@
+#ifndef _HOST_ESP_FREERTOS_HOOKS_H_
+#define _HOST_ESP_FREERTOS_HOOKS_H_
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef void (*esp_freertos_tick_cb_t)(void);
+
+// called once per virtual tick
+esp_err_t esp_register_freertos_tick_hook_for_cpu(esp_freertos_tick_cb_t tick_cb, UBaseType_t cpu);
+
+#endif // _HOST_ESP_FREERTOS_HOOKS_H_
@@ -0,0 +1,6 @@
+#ifndef _HOST_ESP_SYSTEM_H_
+#define _HOST_ESP_SYSTEM_H_
+
+#include "esp_err.h"
+
+#endif // _HOST_ESP_SYSTEM_H_
@@ -0,0 +1,24 @@
+#ifndef _HOST_SEMPHR_H_
+#define _HOST_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+// single threaded, always free
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return (SemaphoreHandle_t)1;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  return pdTRUE;
+}
+
+#endif // _HOST_SEMPHR_H_
@@ -0,0 +1,11 @@
+#ifndef _HOST_LVGL_HELPERS_H_
+#define _HOST_LVGL_HELPERS_H_
+
+#include "lvgl/lvgl.h"
+
+#define DISP_BUF_SIZE (LV_HOR_RES_MAX * 40)
+
+// nothing to bring up, see host_display.c
+void lvgl_driver_init(void);
+
+#endif // _HOST_LVGL_HELPERS_H_
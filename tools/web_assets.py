@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""
+Gzips the dashboard assets for embedding, called by main/CMakeLists.txt on every build:
+
+  tools/web_assets.py main/web build/web index.html app.js style.css
+
+@name@ in index.html becomes "name?v=<hash of the file>", so the other assets can be cached
+for good and a new build still gets its own. The output does not depend on the time of the
+build, an unchanged asset gives the same bytes.
+"""
+
+import gzip
+import hashlib
+import os
+import sys
+
+
+def compress(data, path):
+    with open(path + ".tmp", "wb") as out:
+        with gzip.GzipFile(filename="", mode="wb", compresslevel=9, fileobj=out, mtime=0) as gz:
+            gz.write(data)
+    os.replace(path + ".tmp", path)
+
+
+def main():
+    if len(sys.argv) < 4:
+        raise SystemExit("usage: %s source_dir output_dir index.html [assets...]" % sys.argv[0])
+
+    source_dir, output_dir, index, assets = sys.argv[1], sys.argv[2], sys.argv[3], sys.argv[4:]
+    os.makedirs(output_dir, exist_ok=True)
+
+    with open(os.path.join(source_dir, index), "rb") as f:
+        page = f.read()
+
+    for name in assets:
+        with open(os.path.join(source_dir, name), "rb") as f:
+            data = f.read()
+
+        version = hashlib.sha256(data).hexdigest()[:8]
+        page = page.replace(("@%s@" % name).encode(), ("%s?v=%s" % (name, version)).encode())
+
+        compress(data, os.path.join(output_dir, name + ".gz"))
+
+    compress(page, os.path.join(output_dir, index + ".gz"))
+
+
+if __name__ == "__main__":
+    main()